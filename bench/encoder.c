@@ -0,0 +1,385 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+/*
+Micro-benchmark of tile encoders.
+Synthetic rasters resembling imagery (smooth terrain with fine texture)
+are encoded repeatedly, reporting time, output size and heap allocations per tile.
+*/
+
+#if !defined(_XOPEN_SOURCE)
+# define _XOPEN_SOURCE 600 // clock_gettime
+#endif
+
+#include "saim_decoder_jpeg.h"
+#include "saim_decoder_png.h"
+#include "jpeg_encoder.h"
+#include "png_encoder.h"
+#include "webp_encoder.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+Allocations are counted by interposing malloc family on glibc,
+that also catches allocations made inside shared encoder libraries.
+*/
+#if defined(__GLIBC__)
+# define ENCODER_COUNT_ALLOCATIONS
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t count, size_t size);
+extern void * __libc_realloc(void * pointer, size_t size);
+extern void __libc_free(void * pointer);
+
+static unsigned long long allocations = 0;
+
+void * malloc(size_t size)
+{
+	__atomic_add_fetch(&allocations, 1ull, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+void * calloc(size_t count, size_t size)
+{
+	__atomic_add_fetch(&allocations, 1ull, __ATOMIC_RELAXED);
+	return __libc_calloc(count, size);
+}
+void * realloc(void * pointer, size_t size)
+{
+	__atomic_add_fetch(&allocations, 1ull, __ATOMIC_RELAXED);
+	return __libc_realloc(pointer, size);
+}
+void free(void * pointer)
+{
+	__libc_free(pointer);
+}
+#endif
+
+struct raster_t {
+	unsigned char * data;
+	int width;
+	int height;
+	int bytes_per_pixel;
+};
+
+struct result_t {
+	double nanoseconds; // per tile
+	double bytes; // per tile
+	double allocations; // per tile, negative when unknown
+};
+
+typedef bool (*encode_func_t)(const struct raster_t * raster, int setting, size_t * size);
+
+static unsigned long long now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+
+static unsigned long long get_allocations(void)
+{
+#if defined(ENCODER_COUNT_ALLOCATIONS)
+	return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Makes raster with low frequency relief and high frequency noise, like satellite imagery
+ */
+static bool make_raster(struct raster_t * raster, int width, int height, int bytes_per_pixel, int seed)
+{
+	unsigned int state = 2463534242u + (unsigned int)seed * 2654435761u;
+
+	raster->data = (unsigned char *) malloc((size_t)width * (size_t)height * (size_t)bytes_per_pixel);
+	if (raster->data == NULL)
+		return false;
+	raster->width = width;
+	raster->height = height;
+	raster->bytes_per_pixel = bytes_per_pixel;
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+		{
+			unsigned char * pixel = raster->data + ((size_t)y * (size_t)width + (size_t)x) * (size_t)bytes_per_pixel;
+			double u = (double)x / (double)width * 6.2831853 + seed;
+			double v = (double)y / (double)height * 6.2831853 - seed;
+			double relief = 0.5 + 0.25 * sin(u * 1.3 + cos(v * 0.7)) + 0.2 * cos(v * 2.1 - sin(u * 0.9));
+			int noise;
+
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			noise = (int)(state % 25u) - 12;
+			for (int c = 0; c < bytes_per_pixel && c < 3; ++c)
+			{
+				static const double kTint[3] = {0.8, 1.0, 0.6};
+				int value = (int)(relief * 255.0 * kTint[c]) + noise;
+				pixel[c] = (unsigned char)(value < 0 ? 0 : (value > 255 ? 255 : value));
+			}
+			if (bytes_per_pixel == 4)
+				pixel[3] = 255;
+		}
+	return true;
+}
+
+static bool encode_saim_jpeg(const struct raster_t * raster, int quality, size_t * size)
+{
+	saim_bitmap bitmap;
+	unsigned char * data = NULL;
+	unsigned long data_size = 0;
+	bool result;
+
+	bitmap.data = raster->data;
+	result = saim_decoder_jpeg__save_to_buffer(&bitmap, quality, false,
+		raster->width, raster->height, raster->bytes_per_pixel, &data, &data_size);
+	if (data != NULL)
+		free((void*)data);
+	*size = (size_t)data_size;
+	return result;
+}
+
+static struct jpeg_encoder_t * jpeg_encoder = NULL;
+
+static bool encode_jpeg(const struct raster_t * raster, int quality, enum jpeg_subsampling_t subsampling, size_t * size)
+{
+	const unsigned char * data;
+
+	return jpeg_encoder__encode(jpeg_encoder, raster->data, raster->width, raster->height, raster->bytes_per_pixel,
+		quality, subsampling, &data, size);
+}
+
+static bool encode_jpeg_420(const struct raster_t * raster, int quality, size_t * size)
+{
+	return encode_jpeg(raster, quality, JPEG_SUBSAMPLING_420, size);
+}
+
+static bool encode_jpeg_444(const struct raster_t * raster, int quality, size_t * size)
+{
+	return encode_jpeg(raster, quality, JPEG_SUBSAMPLING_444, size);
+}
+
+static struct png_encoder_t * png_encoder = NULL;
+
+static bool encode_png(const struct raster_t * raster, int profile, size_t * size)
+{
+	const unsigned char * data;
+
+	return png_encoder__encode(png_encoder, raster->data, raster->width, raster->height, raster->bytes_per_pixel,
+		(enum png_profile_t)profile, &data, size);
+}
+
+static bool encode_webp(const struct raster_t * raster, int quality, size_t * size)
+{
+	unsigned char * data;
+
+	if (!webp_encoder__encode(raster->data, raster->width, raster->height, raster->bytes_per_pixel,
+		quality, &data, size))
+		return false;
+	webp_encoder__free(data);
+	return true;
+}
+
+static bool encode_saim_png(const struct raster_t * raster, int setting, size_t * size)
+{
+	saim_bitmap bitmap;
+	saim_string string;
+	bool result;
+
+	(void) setting;
+	bitmap.data = raster->data;
+	saim_string_create(&string);
+	result = saim_decoder_png__save_to_buffer(&bitmap, false,
+		raster->width, raster->height, raster->bytes_per_pixel, &string);
+	*size = (size_t)string.length;
+	saim_string_destroy(&string);
+	return result;
+}
+
+/**
+ * Runs encoder until both minimum iterations and minimum time are reached
+ */
+static bool measure(encode_func_t encode, const struct raster_t * rasters, int raster_count,
+	int setting, double min_seconds, struct result_t * result)
+{
+	unsigned long long start, finish, start_allocations;
+	unsigned long long bytes = 0;
+	unsigned long long iterations = 0;
+	size_t size;
+
+	// Warm up, encoders may initialize tables on first use
+	if (!encode(&rasters[0], setting, &size))
+		return false;
+
+	start_allocations = get_allocations();
+	start = now();
+	do
+	{
+		for (int i = 0; i < raster_count; ++i)
+		{
+			if (!encode(&rasters[i], setting, &size))
+				return false;
+			bytes += size;
+		}
+		iterations += (unsigned long long)raster_count;
+		finish = now();
+	}
+	while (iterations < 16 || (double)(finish - start) < min_seconds * 1e9);
+
+	result->nanoseconds = (double)(finish - start) / (double)iterations;
+	result->bytes = (double)bytes / (double)iterations;
+#if defined(ENCODER_COUNT_ALLOCATIONS)
+	result->allocations = (double)(get_allocations() - start_allocations) / (double)iterations;
+#else
+	(void) start_allocations;
+	result->allocations = -1.0;
+#endif
+	return true;
+}
+
+static void report(const char * name, const char * setting_name, int setting,
+	const struct raster_t * raster, const struct result_t * result)
+{
+	char allocations[32];
+
+	if (result->allocations < 0.0)
+		snprintf(allocations, sizeof(allocations), "n/a");
+	else
+		snprintf(allocations, sizeof(allocations), "%.1f", result->allocations);
+	printf("%-10s %4ix%-4i bpp %i %-8s %3i %12.0f ns/tile %10.0f bytes/tile %8s allocs/tile %8.1f tiles/s\n",
+		name, raster->width, raster->height, raster->bytes_per_pixel, setting_name, setting,
+		result->nanoseconds, result->bytes, allocations, 1e9 / result->nanoseconds);
+}
+
+static void print_usage(const char * name)
+{
+	printf("Usage: %s <option(s)>\n"
+		   "Options:\n"
+		   "\t-h,--help\tShow this help message\n"
+		   "\t-t,--time\tMinimum time per case in seconds (default is 1.0)\n"
+		   "\t-s,--size\tTile size, may be repeated (default is 256 and 512)\n"
+		, name);
+}
+
+int main(int argc, char const *argv[])
+{
+	static const int kQualities[] = {50, 75, 85, 95};
+	static const int kRasterCount = 4; // different rasters to defeat branch predictor and caches
+	struct raster_t rasters[4];
+	struct result_t result;
+	int sizes[8];
+	int size_count = 0;
+	double min_seconds = 1.0;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char * arg = argv[i];
+		const char * value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0)
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+		if (value == NULL)
+		{
+			printf("Option %s requires a value\n", arg);
+			return 1;
+		}
+		if (strcmp(arg, "-t") == 0 || strcmp(arg, "--time") == 0)
+			min_seconds = atof(value);
+		else if ((strcmp(arg, "-s") == 0 || strcmp(arg, "--size") == 0) && size_count < 8)
+			sizes[size_count++] = atoi(value);
+		else
+		{
+			printf("Unknown option %s\n", arg);
+			print_usage(argv[0]);
+			return 1;
+		}
+		++i;
+	}
+	if (size_count == 0)
+	{
+		sizes[size_count++] = 256;
+		sizes[size_count++] = 512;
+	}
+	jpeg_encoder = jpeg_encoder__create();
+	png_encoder = png_encoder__create();
+	if (jpeg_encoder == NULL || png_encoder == NULL)
+	{
+		printf("Encoders init has failed\n");
+		return 1;
+	}
+
+	for (int s = 0; s < size_count; ++s)
+	{
+		for (int i = 0; i < kRasterCount; ++i)
+			if (sizes[s] <= 0 || !make_raster(&rasters[i], sizes[s], sizes[s], 3, i))
+			{
+				printf("Failed to make %ix%i raster\n", sizes[s], sizes[s]);
+				return 1;
+			}
+
+		for (size_t q = 0; q < sizeof(kQualities)/sizeof(kQualities[0]); ++q)
+		{
+			if (!measure(encode_saim_jpeg, rasters, kRasterCount, kQualities[q], min_seconds, &result))
+			{
+				printf("saim jpeg encoding has failed\n");
+				return 2;
+			}
+			report("saim-jpeg", "quality", kQualities[q], &rasters[0], &result);
+		}
+		for (size_t q = 0; q < sizeof(kQualities)/sizeof(kQualities[0]); ++q)
+		{
+			if (!measure(encode_jpeg_420, rasters, kRasterCount, kQualities[q], min_seconds, &result))
+			{
+				printf("jpeg encoding has failed\n");
+				return 2;
+			}
+			report("jpeg-420", "quality", kQualities[q], &rasters[0], &result);
+			if (!measure(encode_jpeg_444, rasters, kRasterCount, kQualities[q], min_seconds, &result))
+			{
+				printf("jpeg encoding has failed\n");
+				return 2;
+			}
+			report("jpeg-444", "quality", kQualities[q], &rasters[0], &result);
+		}
+		if (!measure(encode_saim_png, rasters, kRasterCount, 0, min_seconds, &result))
+		{
+			printf("saim png encoding has failed\n");
+			return 2;
+		}
+		report("saim-png", "default", 0, &rasters[0], &result);
+		for (int profile = PNG_PROFILE_FAST; profile <= PNG_PROFILE_SMALL; ++profile)
+		{
+			if (!measure(encode_png, rasters, kRasterCount, profile, min_seconds, &result))
+			{
+				printf("png encoding has failed\n");
+				return 2;
+			}
+			report("png", "profile", profile, &rasters[0], &result);
+		}
+		// Quality 0 stands for lossless WebP
+		for (int q = -1; webp_encoder__is_available() && q < (int)(sizeof(kQualities)/sizeof(kQualities[0])); ++q)
+		{
+			int quality = (q < 0) ? 0 : kQualities[q];
+			if (!measure(encode_webp, rasters, kRasterCount, quality, min_seconds, &result))
+			{
+				printf("webp encoding has failed\n");
+				return 2;
+			}
+			report((quality == 0) ? "webp-ll" : "webp", "quality", quality, &rasters[0], &result);
+		}
+
+		for (int i = 0; i < kRasterCount; ++i)
+			free((void*)rasters[i].data);
+	}
+	jpeg_encoder__destroy(jpeg_encoder);
+	png_encoder__destroy(png_encoder);
+	return 0;
+}
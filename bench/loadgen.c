@@ -0,0 +1,510 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+/*
+HTTP load generator for tile server.
+Every connection is served by its own thread with keep-alive requests.
+Workloads:
+	cold  - sweep of distinct tiles at a single lod, each tile is requested once;
+	warm  - the same sweep repeated, so tiles come from the caches;
+	mixed - panning sequences over random faces with zipf distributed lods.
+*/
+
+#if !defined(_XOPEN_SOURCE)
+# define _XOPEN_SOURCE 600 // clock_gettime, getaddrinfo
+#endif
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+enum workload_t {
+	WORKLOAD_COLD,
+	WORKLOAD_WARM,
+	WORKLOAD_MIXED
+};
+
+struct options_t {
+	const char * host;
+	const char * port;
+	const char * format;
+	enum workload_t workload;
+	int connections;
+	int requests; // for cold and warm workloads
+	int duration; // in seconds, for mixed workload
+	int sweep_lod; // for cold and warm workloads
+	int min_lod;
+	int max_lod;
+	double zipf; // exponent of lods distribution
+	unsigned int seed;
+};
+
+struct worker_t {
+	const struct options_t * options;
+	const double * lod_weights; // cumulative
+	unsigned int random;
+	unsigned long long * latencies; // in microseconds
+	size_t count;
+	size_t capacity;
+	unsigned long long errors;
+	unsigned long long bytes;
+	int socket;
+	pthread_t thread;
+};
+
+static int sweep_cursor = 0;
+static unsigned long long deadline = 0;
+
+static unsigned long long now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ull + (unsigned long long)ts.tv_nsec / 1000ull;
+}
+
+static unsigned int next_random(unsigned int * state)
+{
+	// xorshift32
+	unsigned int x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static int connect_to_server(const struct options_t * options)
+{
+	struct addrinfo hints, *result, *info;
+	int fd = -1;
+	int flag = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(options->host, options->port, &hints, &result) != 0)
+		return -1;
+	for (info = result; info != NULL; info = info->ai_next)
+	{
+		fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (connect(fd, info->ai_addr, info->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(result);
+	if (fd >= 0)
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+	return fd;
+}
+
+static bool send_all(int fd, const char * data, size_t size)
+{
+	while (size != 0)
+	{
+		ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+		if (sent <= 0)
+			return false;
+		data += sent;
+		size -= (size_t)sent;
+	}
+	return true;
+}
+
+/**
+ * Reads a response and returns its status code or 0 on failure.
+ * Connection is closed when server doesn't keep it alive.
+ */
+static int read_response(struct worker_t * worker)
+{
+	char buffer[16 * 1024];
+	size_t length = 0;
+	char * end = NULL;
+	long long content_length = -1;
+	long long body;
+	bool keep_alive = true;
+	int status;
+
+	// Read headers
+	while (end == NULL)
+	{
+		ssize_t received;
+		if (length == sizeof(buffer) - 1)
+			return 0;
+		received = recv(worker->socket, buffer + length, sizeof(buffer) - 1 - length, 0);
+		if (received <= 0)
+			return 0;
+		length += (size_t)received;
+		buffer[length] = '\0';
+		end = strstr(buffer, "\r\n\r\n");
+	}
+	if (sscanf(buffer, "HTTP/%*d.%*d %d", &status) != 1)
+		return 0;
+	*end = '\0';
+	for (char * line = strstr(buffer, "\r\n"); line != NULL; line = strstr(line + 2, "\r\n"))
+	{
+		if (strncasecmp(line + 2, "Content-Length:", 15) == 0)
+			content_length = atoll(line + 2 + 15);
+		else if (strncasecmp(line + 2, "Connection: close", 17) == 0)
+			keep_alive = false;
+	}
+	if (content_length < 0)
+		return 0;
+
+	// Skip body
+	body = (long long)(length - (size_t)(end + 4 - buffer));
+	while (body < content_length)
+	{
+		size_t chunk = sizeof(buffer);
+		ssize_t received;
+		if ((long long)chunk > content_length - body)
+			chunk = (size_t)(content_length - body);
+		received = recv(worker->socket, buffer, chunk, 0);
+		if (received <= 0)
+			return 0;
+		body += received;
+	}
+	worker->bytes += (unsigned long long)content_length;
+	if (!keep_alive)
+	{
+		close(worker->socket);
+		worker->socket = -1;
+	}
+	return status;
+}
+
+static void record(struct worker_t * worker, unsigned long long latency)
+{
+	if (worker->count == worker->capacity)
+	{
+		size_t capacity = (worker->capacity == 0) ? 4096 : worker->capacity * 2;
+		unsigned long long * latencies = (unsigned long long *) realloc(worker->latencies,
+			capacity * sizeof(unsigned long long));
+		if (latencies == NULL)
+			return;
+		worker->latencies = latencies;
+		worker->capacity = capacity;
+	}
+	worker->latencies[worker->count++] = latency;
+}
+
+static bool request_tile(struct worker_t * worker, int face, int lod, int x, int y)
+{
+	char request[256];
+	unsigned long long start;
+	int length;
+	int status = 0;
+
+	length = snprintf(request, sizeof(request),
+		"GET /?face=%i&lod=%i&x=%i&y=%i&format=%s HTTP/1.1\r\n"
+		"Host: %s\r\n"
+		"\r\n",
+		face, lod, x, y, worker->options->format, worker->options->host);
+
+	start = now();
+	// One retry covers keep-alive connection closed by the server in between
+	for (int attempt = 0; attempt < 2 && status == 0; ++attempt)
+	{
+		if (worker->socket < 0)
+			worker->socket = connect_to_server(worker->options);
+		if (worker->socket < 0)
+			break;
+		if (send_all(worker->socket, request, (size_t)length))
+			status = read_response(worker);
+		if (status == 0 && worker->socket >= 0)
+		{
+			close(worker->socket);
+			worker->socket = -1;
+		}
+	}
+	if (status != 200)
+	{
+		++worker->errors;
+		return false;
+	}
+	record(worker, now() - start);
+	return true;
+}
+
+/**
+ * Distinct tiles in row-major order of every face, like a client panning along rows
+ */
+static void * sweep_routine(void * argument)
+{
+	struct worker_t * worker = (struct worker_t *) argument;
+	const struct options_t * options = worker->options;
+	int side = 1 << options->sweep_lod;
+	int index;
+
+	while ((index = __atomic_fetch_add(&sweep_cursor, 1, __ATOMIC_RELAXED)) < options->requests)
+	{
+		int face = index % 6;
+		int cell = (index / 6) % (side * side);
+		request_tile(worker, face, options->sweep_lod, cell % side, cell / side);
+	}
+	return NULL;
+}
+
+static int choose_lod(struct worker_t * worker)
+{
+	const struct options_t * options = worker->options;
+	int count = options->max_lod - options->min_lod + 1;
+	double value = (double)next_random(&worker->random) / 4294967296.0;
+
+	for (int i = 0; i < count - 1; ++i)
+		if (value < worker->lod_weights[i])
+			return options->min_lod + i;
+	return options->max_lod;
+}
+
+/**
+ * Panning sequences: a random start tile and a walk with occasional turns
+ */
+static void * mixed_routine(void * argument)
+{
+	static const int kDirections[8][2] = {
+		{1,0}, {-1,0}, {0,1}, {0,-1}, {1,1}, {-1,1}, {1,-1}, {-1,-1}
+	};
+	struct worker_t * worker = (struct worker_t *) argument;
+
+	while (now() < deadline)
+	{
+		int lod = choose_lod(worker);
+		int side = 1 << lod;
+		int face = (int)(next_random(&worker->random) % 6);
+		int x = (int)(next_random(&worker->random) % (unsigned int)side);
+		int y = (int)(next_random(&worker->random) % (unsigned int)side);
+		int direction = (int)(next_random(&worker->random) % 8);
+		int steps = 8 + (int)(next_random(&worker->random) % 25);
+
+		for (int step = 0; step < steps && now() < deadline; ++step)
+		{
+			request_tile(worker, face, lod, x, y);
+			if (next_random(&worker->random) % 8 == 0)
+				direction = (int)(next_random(&worker->random) % 8);
+			x = (x + kDirections[direction][0] + side) % side;
+			y = (y + kDirections[direction][1] + side) % side;
+		}
+	}
+	return NULL;
+}
+
+static int compare_latencies(const void * a, const void * b)
+{
+	unsigned long long first = *(const unsigned long long *)a;
+	unsigned long long second = *(const unsigned long long *)b;
+	return (first > second) - (first < second);
+}
+
+static double percentile(const unsigned long long * sorted, size_t count, double fraction)
+{
+	size_t index;
+
+	if (count == 0)
+		return 0.0;
+	index = (size_t)(fraction * (double)count);
+	if (index >= count)
+		index = count - 1;
+	return (double)sorted[index] / 1000.0;
+}
+
+static bool parse_workload(const char * name, enum workload_t * workload)
+{
+	if (strcmp(name, "cold") == 0)
+		*workload = WORKLOAD_COLD;
+	else if (strcmp(name, "warm") == 0)
+		*workload = WORKLOAD_WARM;
+	else if (strcmp(name, "mixed") == 0)
+		*workload = WORKLOAD_MIXED;
+	else
+		return false;
+	return true;
+}
+
+static void print_usage(const char * name)
+{
+	printf("Usage: %s <option(s)>\n"
+		   "Options:\n"
+		   "\t-h,--help\tShow this help message\n"
+		   "\t--host\t\tServer host (default is 127.0.0.1)\n"
+		   "\t-p,--port\tServer port (default is 8080)\n"
+		   "\t-w,--workload\tcold, warm or mixed (default is mixed)\n"
+		   "\t-c,--connections\tNumber of connections (default is 16)\n"
+		   "\t-n,--requests\tNumber of tiles in cold and warm sweeps (default is 2000)\n"
+		   "\t-d,--duration\tMixed workload duration in seconds (default is 10)\n"
+		   "\t--sweep-lod\tLod of cold and warm sweeps (default is 8)\n"
+		   "\t--lods\t\tLods range of mixed workload (default is 0-12)\n"
+		   "\t--zipf\t\tExponent of lods popularity (default is 1.0)\n"
+		   "\t--format\tImage format (default is jpeg)\n"
+		   "\t--seed\t\tRandom seed (default is 1)\n"
+		, name);
+}
+
+int main(int argc, char const *argv[])
+{
+	struct options_t options;
+	struct worker_t * workers;
+	double * lod_weights;
+	double total;
+	unsigned long long * latencies;
+	unsigned long long start, elapsed, errors = 0, bytes = 0;
+	size_t count = 0;
+	int lod_count;
+
+	options.host = "127.0.0.1";
+	options.port = "8080";
+	options.format = "jpeg";
+	options.workload = WORKLOAD_MIXED;
+	options.connections = 16;
+	options.requests = 2000;
+	options.duration = 10;
+	options.sweep_lod = 8;
+	options.min_lod = 0;
+	options.max_lod = 12;
+	options.zipf = 1.0;
+	options.seed = 1;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char * arg = argv[i];
+		const char * value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0)
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+		if (value == NULL)
+		{
+			printf("Option %s requires a value\n", arg);
+			return 1;
+		}
+		if (strcmp(arg, "--host") == 0)
+			options.host = value;
+		else if (strcmp(arg, "-p") == 0 || strcmp(arg, "--port") == 0)
+			options.port = value;
+		else if (strcmp(arg, "-w") == 0 || strcmp(arg, "--workload") == 0)
+		{
+			if (!parse_workload(value, &options.workload))
+			{
+				printf("Unknown workload %s\n", value);
+				return 1;
+			}
+		}
+		else if (strcmp(arg, "-c") == 0 || strcmp(arg, "--connections") == 0)
+			options.connections = atoi(value);
+		else if (strcmp(arg, "-n") == 0 || strcmp(arg, "--requests") == 0)
+			options.requests = atoi(value);
+		else if (strcmp(arg, "-d") == 0 || strcmp(arg, "--duration") == 0)
+			options.duration = atoi(value);
+		else if (strcmp(arg, "--sweep-lod") == 0)
+			options.sweep_lod = atoi(value);
+		else if (strcmp(arg, "--lods") == 0)
+		{
+			if (sscanf(value, "%d-%d", &options.min_lod, &options.max_lod) != 2)
+			{
+				printf("Wrong lods range %s\n", value);
+				return 1;
+			}
+		}
+		else if (strcmp(arg, "--zipf") == 0)
+			options.zipf = atof(value);
+		else if (strcmp(arg, "--format") == 0)
+			options.format = value;
+		else if (strcmp(arg, "--seed") == 0)
+			options.seed = (unsigned int)strtoul(value, NULL, 10);
+		else
+		{
+			printf("Unknown option %s\n", arg);
+			print_usage(argv[0]);
+			return 1;
+		}
+		++i;
+	}
+	if (options.connections < 1 || options.sweep_lod < 0 || options.sweep_lod > 20
+		|| options.min_lod < 0 || options.max_lod > 20 || options.min_lod > options.max_lod)
+	{
+		printf("Wrong options\n");
+		return 1;
+	}
+
+	// Cumulative zipf distribution, lower lods are more popular
+	lod_count = options.max_lod - options.min_lod + 1;
+	lod_weights = (double *) malloc((size_t)lod_count * sizeof(double));
+	workers = (struct worker_t *) calloc((size_t)options.connections, sizeof(struct worker_t));
+	if (lod_weights == NULL || workers == NULL)
+	{
+		printf("Out of memory\n");
+		return 1;
+	}
+	total = 0.0;
+	for (int i = 0; i < lod_count; ++i)
+		total += 1.0 / pow((double)(i + 1), options.zipf);
+	for (int i = 0; i < lod_count; ++i)
+		lod_weights[i] = ((i > 0) ? lod_weights[i - 1] : 0.0) + 1.0 / pow((double)(i + 1), options.zipf) / total;
+
+	start = now();
+	deadline = start + (unsigned long long)options.duration * 1000000ull;
+	for (int i = 0; i < options.connections; ++i)
+	{
+		workers[i].options = &options;
+		workers[i].lod_weights = lod_weights;
+		workers[i].random = options.seed * 2654435761u + (unsigned int)i * 40503u + 1u;
+		workers[i].socket = -1;
+		pthread_create(&workers[i].thread, NULL,
+			(options.workload == WORKLOAD_MIXED) ? mixed_routine : sweep_routine, &workers[i]);
+	}
+	for (int i = 0; i < options.connections; ++i)
+	{
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].socket >= 0)
+			close(workers[i].socket);
+		count += workers[i].count;
+		errors += workers[i].errors;
+		bytes += workers[i].bytes;
+	}
+	elapsed = now() - start;
+
+	// Merge latencies of all connections
+	latencies = (unsigned long long *) malloc((count + 1) * sizeof(unsigned long long));
+	if (latencies == NULL)
+	{
+		printf("Out of memory\n");
+		return 1;
+	}
+	count = 0;
+	for (int i = 0; i < options.connections; ++i)
+	{
+		memcpy(latencies + count, workers[i].latencies, workers[i].count * sizeof(unsigned long long));
+		count += workers[i].count;
+		free((void*)workers[i].latencies);
+	}
+	qsort(latencies, count, sizeof(unsigned long long), compare_latencies);
+
+	printf("%-6s requests %zu errors %llu time %.2f s throughput %.1f tiles/s %.2f MB/s"
+		" latency p50 %.2f ms p99 %.2f ms p999 %.2f ms\n",
+		(options.workload == WORKLOAD_COLD) ? "cold" : (options.workload == WORKLOAD_WARM) ? "warm" : "mixed",
+		count, errors, (double)elapsed / 1e6,
+		(double)count * 1e6 / (double)elapsed, (double)bytes / (double)elapsed,
+		percentile(latencies, count, 0.5), percentile(latencies, count, 0.99), percentile(latencies, count, 0.999));
+
+	free((void*)latencies);
+	free((void*)workers);
+	free((void*)lod_weights);
+	return (errors == 0) ? 0 : 2;
+}
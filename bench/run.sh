@@ -0,0 +1,50 @@
+#!/bin/sh
+# Runs tile server against the local upstream stub and measures it with cold, warm and mixed workloads.
+# Usage: run.sh server upstream loadgen server_port upstream_port latency jitter connections requests duration
+
+SERVER=$1
+UPSTREAM=$2
+LOADGEN=$3
+SERVER_PORT=$4
+UPSTREAM_PORT=$5
+LATENCY=$6
+JITTER=$7
+CONNECTIONS=$8
+REQUESTS=$9
+DURATION=${10}
+
+if [ ! -x "$SERVER" ]; then
+	echo "Server binary $SERVER is missing, run make first"
+	exit 1
+fi
+
+cleanup() {
+	[ -n "$SERVER_PID" ] && kill $SERVER_PID 2>/dev/null
+	[ -n "$UPSTREAM_PID" ] && kill $UPSTREAM_PID 2>/dev/null
+	wait 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+wait_port() {
+	for i in $(seq 50); do
+		curl -s -o /dev/null "http://127.0.0.1:$1/" && return 0
+		sleep 0.1
+	done
+	echo "Port $1 isn't listening"
+	exit 1
+}
+
+"$UPSTREAM" --port $UPSTREAM_PORT --latency $LATENCY --jitter $JITTER > /dev/null &
+UPSTREAM_PID=$!
+wait_port $UPSTREAM_PORT
+
+# Source tiles are fetched by curl inside saim, so proxy variable routes them to the stub
+http_proxy=http://127.0.0.1:$UPSTREAM_PORT HTTP_PROXY=http://127.0.0.1:$UPSTREAM_PORT no_proxy= \
+	"$SERVER" --port $SERVER_PORT --cache 256 > /dev/null &
+SERVER_PID=$!
+wait_port $SERVER_PORT
+
+echo "Upstream latency ${LATENCY}+${JITTER} ms, $CONNECTIONS connections"
+"$LOADGEN" --port $SERVER_PORT --workload cold --connections $CONNECTIONS --requests $REQUESTS
+"$LOADGEN" --port $SERVER_PORT --workload warm --connections $CONNECTIONS --requests $REQUESTS
+"$LOADGEN" --port $SERVER_PORT --workload mixed --connections $CONNECTIONS --duration $DURATION
@@ -0,0 +1,276 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+/*
+Local stand-in for the imagery source.
+Tile server is pointed to it via http_proxy environment variable, that curl honors,
+so every source tile request is answered here with a canned JPEG image after a delay.
+*/
+
+#if !defined(_XOPEN_SOURCE)
+# define _XOPEN_SOURCE 500 // usleep
+#endif
+
+#include <microhttpd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <jpeglib.h> // needs stdio.h
+
+/* Older microhttpd library versions use int instead of enum. */
+#if defined(_MHD_FIXED_ENUM)
+# define __MHD_INT_RESULT enum MHD_Result
+#else
+# define __MHD_INT_RESULT int
+#endif
+
+#define UPSTREAM_TILE_COUNT 8
+
+struct tile_t {
+	unsigned char * data;
+	unsigned long size;
+};
+
+struct upstream_t {
+	struct tile_t tiles[UPSTREAM_TILE_COUNT];
+	int tile_count;
+	int latency; // in milliseconds
+	int jitter; // in milliseconds
+	unsigned long long requests;
+};
+
+static volatile sig_atomic_t finishing = 0;
+
+static void on_terminate(int func)
+{
+	(void) func;
+	finishing = 1;
+}
+
+/**
+ * Makes tile image with some texture, so decoding costs like a real one
+ */
+static int make_tile(struct tile_t * tile, int size, int seed)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	unsigned char * row;
+	JSAMPROW row_pointer[1];
+
+	row = (unsigned char *) malloc((size_t)size * 3);
+	if (row == NULL)
+		return 0;
+	tile->data = NULL;
+	tile->size = 0;
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, &tile->data, &tile->size);
+	cinfo.image_width = (JDIMENSION)size;
+	cinfo.image_height = (JDIMENSION)size;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 90, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height)
+	{
+		int y = (int)cinfo.next_scanline;
+		for (int x = 0; x < size; ++x)
+		{
+			unsigned int noise = (unsigned int)(x * 7919 + y * 104729 + seed * 1299709);
+			noise = (noise ^ (noise >> 13)) * 2654435761u;
+			row[3*x+0] = (unsigned char)((x + seed * 31) ^ (noise >> 28));
+			row[3*x+1] = (unsigned char)((y + seed * 17) ^ (noise >> 27));
+			row[3*x+2] = (unsigned char)(((x + y) / 2) ^ (noise >> 26));
+		}
+		row_pointer[0] = row;
+		jpeg_write_scanlines(&cinfo, row_pointer, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	free((void*)row);
+	return tile->data != NULL;
+}
+
+static int load_tile(struct tile_t * tile, const char * filename)
+{
+	FILE * file;
+	long size;
+
+	file = fopen(filename, "rb");
+	if (file == NULL)
+		return 0;
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	tile->data = (size > 0) ? (unsigned char *) malloc((size_t)size) : NULL;
+	if (tile->data == NULL || fread(tile->data, 1, (size_t)size, file) != (size_t)size)
+	{
+		free((void*)tile->data);
+		fclose(file);
+		return 0;
+	}
+	tile->size = (unsigned long)size;
+	fclose(file);
+	return 1;
+}
+
+static unsigned int hash_string(const char * string)
+{
+	unsigned int hash = 2166136261u;
+	for (; *string != '\0'; ++string)
+		hash = (hash ^ (unsigned char)*string) * 16777619u;
+	return hash;
+}
+
+static __MHD_INT_RESULT
+answer_callback(void *cls, struct MHD_Connection *connection,
+	const char *url, const char *method, const char *version,
+	const char *upload_data, size_t *upload_data_size, void **ptr)
+{
+	static int aptr;
+	struct upstream_t * upstream = (struct upstream_t *) cls;
+	struct MHD_Response * response;
+	struct tile_t * tile;
+	unsigned int hash;
+	int delay;
+	int ret;
+
+	(void) version;           /* Unused. Silent compiler warning. */
+	(void) upload_data;       /* Unused. Silent compiler warning. */
+	(void) upload_data_size;  /* Unused. Silent compiler warning. */
+
+	if (0 != strcmp(method, "GET"))
+		return MHD_NO;              /* unexpected method */
+
+	if (&aptr != *ptr)
+	{
+		/* do never respond on first call */
+		*ptr = &aptr;
+		return MHD_YES;
+	}
+	*ptr = NULL;                  /* reset when done */
+
+	// Same URL always gets the same tile
+	hash = hash_string(url);
+	tile = &upstream->tiles[hash % (unsigned int)upstream->tile_count];
+	delay = upstream->latency;
+	if (upstream->jitter > 0)
+		delay += (int)((hash >> 8) % (unsigned int)(upstream->jitter + 1));
+	if (delay > 0)
+		usleep((useconds_t)delay * 1000);
+	__atomic_add_fetch(&upstream->requests, 1ull, __ATOMIC_RELAXED);
+
+	response = MHD_create_response_from_buffer(tile->size, (void*)tile->data, MHD_RESPMEM_PERSISTENT);
+	MHD_add_response_header(response, "Content-Type", "image/jpeg");
+	ret = (int)MHD_queue_response(connection, MHD_HTTP_OK, response);
+	MHD_destroy_response(response);
+
+	return (__MHD_INT_RESULT) ret;
+}
+
+static void print_usage(const char * name)
+{
+	printf("Usage: %s <option(s)>\n"
+		   "Options:\n"
+		   "\t-h,--help\tShow this help message\n"
+		   "\t-p,--port\tPort to listen (default is 8090)\n"
+		   "\t-l,--latency\tResponse latency in milliseconds (default is 20)\n"
+		   "\t-j,--jitter\tMaximum latency addition in milliseconds (default is 0)\n"
+		   "\t-t,--tile\tJPEG file to serve instead of generated tiles\n"
+		, name);
+}
+
+int main(int argc, char const *argv[])
+{
+	struct upstream_t upstream;
+	struct MHD_Daemon * daemon;
+	const char * tile_file = NULL;
+	int port = 8090;
+
+	memset(&upstream, 0, sizeof(upstream));
+	upstream.latency = 20;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char * arg = argv[i];
+		const char * value = (i + 1 < argc) ? argv[i + 1] : NULL;
+		if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0)
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+		if (value == NULL)
+		{
+			printf("Option %s requires a value\n", arg);
+			return 1;
+		}
+		if (strcmp(arg, "-p") == 0 || strcmp(arg, "--port") == 0)
+			port = atoi(value);
+		else if (strcmp(arg, "-l") == 0 || strcmp(arg, "--latency") == 0)
+			upstream.latency = atoi(value);
+		else if (strcmp(arg, "-j") == 0 || strcmp(arg, "--jitter") == 0)
+			upstream.jitter = atoi(value);
+		else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--tile") == 0)
+			tile_file = value;
+		else
+		{
+			printf("Unknown option %s\n", arg);
+			print_usage(argv[0]);
+			return 1;
+		}
+		++i;
+	}
+
+	if (tile_file != NULL)
+	{
+		if (!load_tile(&upstream.tiles[0], tile_file))
+		{
+			printf("Failed to load tile '%s'\n", tile_file);
+			return 1;
+		}
+		upstream.tile_count = 1;
+	}
+	else
+	{
+		for (int i = 0; i < UPSTREAM_TILE_COUNT; ++i)
+			if (!make_tile(&upstream.tiles[i], 256, i))
+			{
+				printf("Failed to make tile\n");
+				return 1;
+			}
+		upstream.tile_count = UPSTREAM_TILE_COUNT;
+	}
+
+	// Thread per connection, so latency sleeps don't block other requests
+	daemon = MHD_start_daemon(
+		MHD_USE_THREAD_PER_CONNECTION | MHD_USE_INTERNAL_POLLING_THREAD | MHD_USE_ERROR_LOG,
+		(unsigned short)port,
+		NULL, NULL,
+		&answer_callback, (void*)&upstream,
+		MHD_OPTION_CONNECTION_LIMIT, (unsigned int)1024,
+		MHD_OPTION_END);
+	if (daemon == NULL)
+	{
+		printf("Failed to start upstream on port %i\n", port);
+		return 1;
+	}
+	printf("Upstream is listening on port %i with latency %i+%i ms\n", port, upstream.latency, upstream.jitter);
+
+	signal(SIGINT, on_terminate);
+	signal(SIGTERM, on_terminate);
+	while (!finishing)
+		usleep(100 * 1000);
+
+	MHD_stop_daemon(daemon);
+	printf("Upstream has served %llu requests\n", upstream.requests);
+	for (int i = 0; i < upstream.tile_count; ++i)
+		free((void*)upstream.tiles[i].data);
+	return 0;
+}
@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "admission.h"
+
+#include "tinycthread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+# include <winsock2.h>
+# include <ws2tcpip.h>
+#else
+# include <sys/socket.h>
+# include <netinet/in.h>
+#endif
+
+#define ADMISSION_BUCKET_COUNT 256
+
+/* Pending requests of a client, exists only while there are any */
+struct client_entry_t {
+	struct admission_client_t client;
+	int pending;
+	struct client_entry_t * next;
+};
+
+struct admission_t {
+	int max_pending;
+	int max_per_client;
+	struct client_entry_t * buckets[ADMISSION_BUCKET_COUNT];
+	struct admission_stats_t stats;
+	mtx_t mutex;
+};
+
+static unsigned int hash_client(const struct admission_client_t * client)
+{
+	// FNV-1a
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < client->length; ++i)
+	{
+		hash ^= client->address[i];
+		hash *= 16777619u;
+	}
+	return hash % ADMISSION_BUCKET_COUNT;
+}
+
+static bool clients_equal(const struct admission_client_t * a, const struct admission_client_t * b)
+{
+	return a->length == b->length && memcmp(a->address, b->address, a->length) == 0;
+}
+
+/* Should be called with mutex locked */
+static struct client_entry_t ** find_client(struct admission_t * admission, const struct admission_client_t * client)
+{
+	struct client_entry_t ** link = &admission->buckets[hash_client(client)];
+
+	while (*link != NULL && !clients_equal(&(*link)->client, client))
+		link = &(*link)->next;
+	return link;
+}
+
+struct admission_t * admission__create(int max_pending, int max_per_client)
+{
+	struct admission_t * admission;
+
+	admission = (struct admission_t *) calloc(1, sizeof(struct admission_t));
+	if (admission == NULL)
+		return NULL;
+	admission->max_pending = (max_pending > 0) ? max_pending : 0;
+	admission->max_per_client = (max_per_client > 0) ? max_per_client : 0;
+	if (mtx_init(&admission->mutex, mtx_plain) == thrd_error)
+	{
+		free((void*)admission);
+		return NULL;
+	}
+	return admission;
+}
+
+void admission__destroy(struct admission_t * admission)
+{
+	struct client_entry_t * entry;
+
+	if (admission == NULL)
+		return;
+	for (int i = 0; i < ADMISSION_BUCKET_COUNT; ++i)
+		while ((entry = admission->buckets[i]) != NULL)
+		{
+			admission->buckets[i] = entry->next;
+			free((void*)entry);
+		}
+	mtx_destroy(&admission->mutex);
+	free((void*)admission);
+}
+
+void admission__get_client(const struct sockaddr * address, struct admission_client_t * client)
+{
+	memset(client, 0, sizeof(struct admission_client_t));
+	if (address == NULL)
+		return;
+	if (address->sa_family == AF_INET)
+	{
+		const struct sockaddr_in * ipv4 = (const struct sockaddr_in *) address;
+		client->length = 4;
+		memcpy(client->address, &ipv4->sin_addr, 4);
+	}
+	else if (address->sa_family == AF_INET6)
+	{
+		const struct sockaddr_in6 * ipv6 = (const struct sockaddr_in6 *) address;
+		client->length = 16;
+		memcpy(client->address, &ipv6->sin6_addr, 16);
+	}
+}
+
+enum admission_result_t admission__enter(struct admission_t * admission, const struct admission_client_t * client)
+{
+	struct client_entry_t ** link;
+	struct client_entry_t * entry;
+	bool per_client;
+
+	// Clients of unknown address aren't told apart
+	per_client = admission->max_per_client != 0 && client->length != 0;
+
+	mtx_lock(&admission->mutex);
+	if (admission->max_pending != 0 && admission->stats.pending >= admission->max_pending)
+	{
+		++admission->stats.queue_full;
+		mtx_unlock(&admission->mutex);
+		return ADMISSION_QUEUE_FULL;
+	}
+	if (per_client)
+	{
+		link = find_client(admission, client);
+		entry = *link;
+		if (entry != NULL && entry->pending >= admission->max_per_client)
+		{
+			++admission->stats.client_busy;
+			mtx_unlock(&admission->mutex);
+			return ADMISSION_CLIENT_BUSY;
+		}
+		if (entry == NULL)
+		{
+			entry = (struct client_entry_t *) calloc(1, sizeof(struct client_entry_t));
+			if (entry == NULL)
+			{
+				++admission->stats.queue_full;
+				mtx_unlock(&admission->mutex);
+				return ADMISSION_QUEUE_FULL;
+			}
+			entry->client = *client;
+			*link = entry;
+		}
+		++entry->pending;
+	}
+	++admission->stats.pending;
+	++admission->stats.admitted;
+	mtx_unlock(&admission->mutex);
+	return ADMISSION_ADMITTED;
+}
+
+void admission__leave(struct admission_t * admission, const struct admission_client_t * client)
+{
+	struct client_entry_t ** link;
+	struct client_entry_t * entry;
+
+	mtx_lock(&admission->mutex);
+	--admission->stats.pending;
+	if (admission->max_per_client != 0 && client->length != 0)
+	{
+		link = find_client(admission, client);
+		entry = *link;
+		if (entry != NULL && --entry->pending == 0)
+		{
+			*link = entry->next;
+			free((void*)entry);
+		}
+	}
+	mtx_unlock(&admission->mutex);
+}
+
+void admission__get_stats(struct admission_t * admission, struct admission_stats_t * stats)
+{
+	mtx_lock(&admission->mutex);
+	*stats = admission->stats;
+	mtx_unlock(&admission->mutex);
+}
@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __ADMISSION_H__
+#define __ADMISSION_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct sockaddr;
+
+/**
+ * Admission control of requests that need a render.
+ * The number of requests rendering or waiting for a render context is bounded,
+ * as well as the number of such requests of a single client address.
+ * Requests over the limits are rejected at once rather than queued.
+ */
+struct admission_t;
+
+/**
+ * Client address without the port, so all connections of a client count together
+ */
+struct admission_client_t {
+	unsigned char address[16];
+	size_t length; // 4 for IPv4, 16 for IPv6, 0 when unknown
+};
+
+enum admission_result_t {
+	ADMISSION_ADMITTED,
+	ADMISSION_QUEUE_FULL, // the server is over capacity
+	ADMISSION_CLIENT_BUSY // the client has too many pending renders
+};
+
+struct admission_stats_t {
+	unsigned long long admitted;
+	unsigned long long queue_full;
+	unsigned long long client_busy;
+	int pending;
+};
+
+/**
+ * Creates admission control.
+ *
+ * @param[in] max_pending     Max number of admitted requests at once, 0 means no limit.
+ * @param[in] max_per_client  Max number of admitted requests of a client at once, 0 means no limit.
+ * @return Admission control or NULL on failure.
+ */
+struct admission_t * admission__create(int max_pending, int max_per_client);
+void admission__destroy(struct admission_t * admission);
+
+/**
+ * Makes client key from the socket address, NULL address gives the unknown client.
+ */
+void admission__get_client(const struct sockaddr * address, struct admission_client_t * client);
+
+/**
+ * Admits the request unless it's over the limits.
+ * Admitted request has to call admission__leave once it's done.
+ */
+enum admission_result_t admission__enter(struct admission_t * admission, const struct admission_client_t * client);
+void admission__leave(struct admission_t * admission, const struct admission_client_t * client);
+
+void admission__get_stats(struct admission_t * admission, struct admission_stats_t * stats);
+
+#endif
@@ -7,19 +7,54 @@
 #include "server.h"
 #include "image_format.h"
 #include "mime_type.h"
+#include "tile_cache.h"
+#include "tile_store.h"
+#include "inflight.h"
+#include "file_cache.h"
+#include "tile_render.h"
+#include "metrics.h"
+#include "batch.h"
+#include "admission.h"
+#include "response_cache.h"
 
-#include "saim_decoder_jpeg.h"
-#include "saim_decoder_png.h"
-
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#if defined(_WIN32)
+# include <io.h>
+#else
+# include <errno.h>
+# include <sys/socket.h>
+# include <unistd.h>
+#endif
+
 typedef struct {
 	int face, lod, x, y;
+	int quality; // 0 when not requested
+	int png_profile; // 0 when not requested
+	bool lossless;
+	int size; // tile width in pixels
 } arguments_t;
 
+typedef struct {
+	struct MHD_Connection * connection;
+	unsigned long long deadline; // time the connection would be timed out at
+} request_state_t;
+
+typedef struct {
+	char etag[96];
+	int max_age;
+	bool vary_accept; // format has been chosen by Accept header
+} cache_headers_t;
+
 static const char* kServerError = "<html><body>An internal server error has occurred!</body></html>";
 static const char* kEmptyPage = "<html><head><title>File not found</title></head><body>File not found</body></html>";
+static const char* kOverloaded = "<html><body>Server is busy, try again later.</body></html>";
+
+/* Request context of the first access handler call */
+static int first_call;
 
 static const char* format_to_mime_type(enum image_format_t format)
 {
@@ -27,36 +62,77 @@ static const char* format_to_mime_type(enum image_format_t format)
 	{
 		case FORMAT_JPEG:
 			return "image/jpeg";
+		case FORMAT_WEBP:
+			return "image/webp";
+		case FORMAT_RAW:
+		case FORMAT_DXT1:
+			return "application/octet-stream";
 		case FORMAT_PNG:
 		default:
 			return "image/png";
 	}
 }
 
-static bool get_image_format(struct MHD_Connection *connection, enum image_format_t * format)
+/**
+ * Checks whether Accept-like header lists the value with non-zero quality
+ */
+static bool is_value_accepted(struct MHD_Connection *connection, const char * header_name, const char * value)
+{
+	const char * header;
+	const char * token;
+	const char * end;
+	const char * quality;
+	size_t length;
+
+	header = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, header_name);
+	if (header == NULL)
+		return false;
+	length = strlen(value);
+	for (token = header; *token != '\0'; token = end)
+	{
+		while (*token == ' ' || *token == ',')
+			++token;
+		end = token + strcspn(token, ",");
+		if (strncmp(token, value, length) != 0
+			|| (token[length] != ';' && token[length] != ' ' && token + length != end))
+			continue;
+		// Explicit zero quality means the value is refused
+		quality = strstr(token + length, "q=");
+		if (quality != NULL && quality < end)
+			return strtod(quality + 2, NULL) > 0.0;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Checks whether Accept-Encoding header lists the encoding with non-zero quality
+ */
+static bool is_encoding_accepted(struct MHD_Connection *connection, const char * encoding)
+{
+	return is_value_accepted(connection, "Accept-Encoding", encoding);
+}
+
+static bool get_image_format(struct MHD_Connection *connection, struct server_t * server,
+	enum image_format_t * format, bool * negotiated)
 {
 	const char *key, *value;
 
 	key = "format";
 	value = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, key);
+	*negotiated = false;
 	if (value == NULL)
 	{
-		// Use JPEG by default
-		*format = FORMAT_JPEG;
-		return true;
-	}
-	if (strcmp(value, "png") == 0 ||
-		strcmp(value, "PNG") == 0)
-	{
-		*format = FORMAT_PNG;
+		// Use WebP when client accepts it and server is allowed to choose, JPEG otherwise
+		*negotiated = server->accept_webp;
+		if (server->accept_webp && is_value_accepted(connection, "Accept", "image/webp"))
+			*format = FORMAT_WEBP;
+		else
+			*format = FORMAT_JPEG;
 		return true;
 	}
-	if (strcmp(value, "jpg") == 0 || strcmp(value, "jpeg") == 0 ||
-		strcmp(value, "JPG") == 0 || strcmp(value, "JPEG") == 0)
-	{
-		*format = FORMAT_JPEG;
+	if (image_format__parse(value, format))
 		return true;
-	}
 	printf("image format '%s' is unknown\n", value);
 	return false;
 }
@@ -104,92 +180,274 @@ static bool get_tile_key(struct MHD_Connection *connection, int * face, int * lo
 	return true;
 }
 
-static bool parse_cube_arguments(struct MHD_Connection *connection, arguments_t * args)
+/**
+ * Gets optional encoder quality argument
+ */
+static bool get_quality(struct MHD_Connection *connection, int * quality)
+{
+	const char *key, *value;
+
+	key = "quality";
+	value = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, key);
+	if (value == NULL)
+	{
+		*quality = 0;
+		return true;
+	}
+	*quality = atoi(value);
+	if (*quality < 1 || *quality > 100)
+	{
+		printf("quality '%s' is out of range 1-100\n", value);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Gets optional PNG profile argument
+ */
+static bool get_png_profile(struct MHD_Connection *connection, int * profile)
+{
+	const char *key, *value;
+	enum png_profile_t parsed;
+
+	key = "profile";
+	value = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, key);
+	if (value == NULL)
+	{
+		*profile = 0;
+		return true;
+	}
+	if (!png_encoder__parse_profile(value, &parsed))
+	{
+		printf("PNG profile '%s' is unknown\n", value);
+		return false;
+	}
+	*profile = (int)parsed;
+	return true;
+}
+
+/**
+ * Gets optional WebP lossless flag
+ */
+static bool get_lossless(struct MHD_Connection *connection, bool * lossless)
+{
+	const char *value;
+
+	value = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "lossless");
+	*lossless = (value != NULL && (strcmp(value, "1") == 0 || strcmp(value, "true") == 0));
+	return true;
+}
+
+/**
+ * Gets scale from the suffix like @2x at the end of the URL, 1 when there is none
+ */
+static int get_url_scale(const char * url)
+{
+	const char * suffix;
+	int scale, length = 0;
+
+	suffix = strrchr(url, '@');
+	if (suffix == NULL || sscanf(suffix, "@%dx%n", &scale, &length) != 1
+		|| length == 0 || suffix[length] != '\0')
+		return 1;
+	return scale;
+}
+
+/**
+ * Gets optional tile size argument, HiDPI tiles may be requested with @2x suffix instead
+ */
+static bool get_tile_size(struct MHD_Connection *connection, const char * url, const struct server_t * server,
+	int * size)
+{
+	const char *key, *value;
+	int scale;
+
+	key = "size";
+	value = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, key);
+	if (value != NULL)
+		*size = atoi(value);
+	else
+		*size = server->width * get_url_scale(url);
+	scale = *size / server->width;
+	if (*size % server->width != 0 || scale < 1 || scale > server->max_scale)
+	{
+		printf("tile size %i isn't served\n", *size);
+		return false;
+	}
+	return true;
+}
+
+static bool parse_cube_arguments(struct MHD_Connection *connection, const char * url, const struct server_t * server,
+	arguments_t * args)
 {
 	// Get tile coordinates
 	if (!get_tile_key(connection, &args->face, &args->lod, &args->x, &args->y))
 		return false;
+	if (!get_tile_size(connection, url, server, &args->size))
+		return false;
+
+	// Get encoder settings
+	if (!get_quality(connection, &args->quality))
+		return false;
+	if (!get_png_profile(connection, &args->png_profile))
+		return false;
+	if (!get_lossless(connection, &args->lossless))
+		return false;
 
 	return true;
 }
 
-static int make_server_error_response(struct MHD_Connection *connection)
+static int make_server_error_response(struct MHD_Connection *connection, struct server_t * server)
 {
-	struct MHD_Response * response;
-	int ret;
+	return response_cache__queue_page(server->responses, connection,
+		RESPONSE_PAGE_SERVER_ERROR, MHD_HTTP_INTERNAL_SERVER_ERROR);
+}
 
-	response = MHD_create_response_from_buffer(strlen(kServerError), (void*)kServerError, MHD_RESPMEM_PERSISTENT);
-	MHD_add_response_header(response, "Content-Type", "text/html");
-	ret = (int)MHD_queue_response(connection, MHD_HTTP_INTERNAL_SERVER_ERROR, response);
-	MHD_destroy_response(response);
+/**
+ * Fast rejection of the request that would wait for a render too long.
+ * Status is 503 when the server is over capacity and 429 when the client is.
+ */
+static int make_overloaded_response(struct MHD_Connection *connection, struct server_t * server,
+	unsigned int status)
+{
+	return response_cache__queue_page(server->responses, connection, RESPONSE_PAGE_OVERLOADED, status);
+}
 
-	return ret;
+static unsigned int get_rejection_status(enum admission_result_t result)
+{
+	return (result == ADMISSION_CLIENT_BUSY) ? MHD_HTTP_TOO_MANY_REQUESTS : MHD_HTTP_SERVICE_UNAVAILABLE;
+}
+
+static void get_client(struct MHD_Connection *connection, struct admission_client_t * client)
+{
+	const union MHD_ConnectionInfo * info;
+
+	info = MHD_get_connection_info(connection, MHD_CONNECTION_INFO_CLIENT_ADDRESS);
+	admission__get_client((info != NULL) ? info->client_addr : NULL, client);
 }
 
 /* Empty page or page not found response */
-static int make_empty_page_response(struct MHD_Connection *connection)
+static int make_empty_page_response(struct MHD_Connection *connection, struct server_t * server)
+{
+	return response_cache__queue_page(server->responses, connection, RESPONSE_PAGE_NOT_FOUND, MHD_HTTP_NOT_FOUND);
+}
+
+static int queue_file_response(struct MHD_Connection *connection, struct server_t * server,
+	struct MHD_Response * response, const char * mime_type, const char * encoding, bool compressible,
+	unsigned int * status)
 {
-	struct MHD_Response * response;
 	int ret;
 
-	response = MHD_create_response_from_buffer(strlen(kEmptyPage), (void*)kEmptyPage, MHD_RESPMEM_PERSISTENT);
-	ret = (int)MHD_queue_response(connection, MHD_HTTP_NOT_FOUND, response);
+	if (response == NULL)
+	{
+		*status = MHD_HTTP_INTERNAL_SERVER_ERROR;
+		return make_server_error_response(connection, server);
+	}
+	*status = MHD_HTTP_OK;
+	MHD_add_response_header(response, "Content-Type", mime_type);
+	if (encoding != NULL)
+		MHD_add_response_header(response, "Content-Encoding", encoding);
+	if (compressible)
+		MHD_add_response_header(response, "Vary", "Accept-Encoding");
+	ret = (int)MHD_queue_response(connection, MHD_HTTP_OK, response);
 	MHD_destroy_response(response);
 
 	return ret;
 }
 
 /**
- * Returns file presented in the current directory (help.html for example)
+ * Tries to respond with precompressed sibling of the file, like script.js.br for script.js
  */
-static int make_local_file_response(struct MHD_Connection *connection, const char* path)
+static bool try_precompressed_file_response(struct MHD_Connection *connection, const char* path, struct server_t * server,
+	const char * encoding, const char * extension, const char * mime_type, int * ret, unsigned int * status)
+{
+	struct MHD_Response * response;
+	char sibling[1024];
+	size_t size;
+	time_t mtime;
+	int fd;
+
+	if (!is_encoding_accepted(connection, encoding))
+		return false;
+	if ((size_t)snprintf(sibling, sizeof(sibling), "%s%s", path, extension) >= sizeof(sibling))
+		return false;
+	if (!file_cache__open(server->files, sibling, &fd, &size, &mtime))
+		return false;
+
+	response = MHD_create_response_from_fd(size, fd);
+	if (response == NULL)
+		close(fd);
+	*ret = queue_file_response(connection, server, response, mime_type, encoding, true, status);
+	return true;
+}
+
+/**
+ * Returns file presented in the current directory (help.html for example).
+ * File contents are sent by MHD straight from the descriptor.
+ * Compressible files are sent precompressed when the client accepts that.
+ */
+static int respond_local_file(struct MHD_Connection *connection, const char* path, struct server_t * server,
+	unsigned int * status)
 {
 	char mime_type[64];
 	struct MHD_Response * response;
-	FILE * f;
-	size_t ret_count;
+	struct tile_buffer_t * gzip;
+	size_t size;
+	time_t mtime;
+	bool compressible;
+	int fd;
 	int ret;
 
-	// Open file
-	f = fopen(path, "rb");
-	if (f == NULL)
-	{
-		printf("file \'%s\' hasn't been found\n", path);
-		return make_empty_page_response(connection);
-	}
+	translate_url_to_mime_type(path, mime_type, sizeof(mime_type)/sizeof(mime_type[0]));
+	compressible = is_mime_type_compressible(mime_type);
 
-	// Read file
-	fseek(f, 0, SEEK_END);
-	long fsize = ftell(f);
-	if (fsize <= 0)
+	if (compressible)
 	{
-		fclose(f);
-		return make_server_error_response(connection);
+		// Files compressed at deploy time are preferred
+		if (try_precompressed_file_response(connection, path, server, "br", ".br", mime_type, &ret, status))
+			return ret;
+		if (try_precompressed_file_response(connection, path, server, "gzip", ".gz", mime_type, &ret, status))
+			return ret;
 	}
-	fseek(f, 0, SEEK_SET);
-	char *string = malloc(fsize + 1);
-	if (string == NULL)
+
+	if (!file_cache__open(server->files, path, &fd, &size, &mtime))
 	{
-		fclose(f);
-		printf("malloc failed\n");
-		return make_server_error_response(connection);
+		printf("file \'%s\' hasn't been found\n", path);
+		*status = MHD_HTTP_NOT_FOUND;
+		return make_empty_page_response(connection, server);
 	}
-	ret_count = fread(string, fsize, 1, f);
-	if (ret_count == 0 || (ret_count == 1 && ferror(f) != 0))
+
+	// Otherwise file is compressed once and kept in memory
+	if (compressible && is_encoding_accepted(connection, "gzip")
+		&& file_cache__get_gzip(server->files, path, &gzip))
 	{
-		fclose(f);
-		free(string);
-		return make_server_error_response(connection);
+		close(fd);
+		// Response takes the reference, compressed contents are shared and not copied
+		response = MHD_create_response_from_buffer_with_free_callback(gzip->size,
+			(void*)tile_buffer__data(gzip), tile_buffer__free_callback);
+		if (response == NULL)
+			tile_buffer__release(gzip);
+		return queue_file_response(connection, server, response, mime_type, "gzip", true, status);
 	}
-	fclose(f);
-	string[fsize] = '\0';
 
-	translate_url_to_mime_type(path, mime_type, sizeof(mime_type)/sizeof(mime_type[0]));
+	// Response owns the descriptor
+	response = MHD_create_response_from_fd(size, fd);
+	if (response == NULL)
+		close(fd);
+	return queue_file_response(connection, server, response, mime_type, NULL, compressible, status);
+}
 
-	response = MHD_create_response_from_buffer((size_t)fsize, (void*)string, MHD_RESPMEM_MUST_FREE);
-	MHD_add_response_header(response, "Content-Type", mime_type);
-	ret = (int)MHD_queue_response(connection, MHD_HTTP_OK, response);
-	MHD_destroy_response(response);
+static int make_local_file_response(struct MHD_Connection *connection, const char* path, struct server_t * server)
+{
+	unsigned long long start;
+	unsigned int status;
+	int ret;
+
+	start = metrics__now();
+	ret = respond_local_file(connection, path, server, &status);
+	metrics__count_file_request(server->metrics, status);
+	metrics__observe(server->metrics, METRICS_STAGE_FILE, metrics__now() - start);
 
 	return ret;
 }
@@ -205,20 +463,39 @@ static int make_server_file_response(struct MHD_Connection *connection, const ch
 	file_len = file_root_len + strlen(url);
 	path = (char*) malloc((file_len+1)*sizeof(char));
 	if (path == NULL)
-		return make_server_error_response(connection);
+		return make_server_error_response(connection, server);
 	strcpy(path, server->file_root);
 	strcpy(path + file_root_len, url);
 	path[file_len] = '\0';
 
-	ret = make_local_file_response(connection, path);
+	ret = make_local_file_response(connection, path, server);
 
 	free(path);
 	return ret;
 }
 
-static int make_help_response(struct MHD_Connection *connection)
+/*
+Help page is prebuilt when the server is created,
+it's read from the file per request only when it hasn't been there.
+*/
+static int make_help_response(struct MHD_Connection *connection, struct server_t * server)
 {
-	return make_local_file_response(connection, "help.html");
+	enum response_page_t page;
+	unsigned long long start;
+	int ret;
+
+	if (!response_cache__has_page(server->responses, RESPONSE_PAGE_HELP))
+		return make_local_file_response(connection, "help.html", server);
+
+	start = metrics__now();
+	page = RESPONSE_PAGE_HELP;
+	if (response_cache__has_page(server->responses, RESPONSE_PAGE_HELP_GZIP) && is_encoding_accepted(connection, "gzip"))
+		page = RESPONSE_PAGE_HELP_GZIP;
+	ret = response_cache__queue_page(server->responses, connection, page, MHD_HTTP_OK);
+	metrics__count_file_request(server->metrics, MHD_HTTP_OK);
+	metrics__observe(server->metrics, METRICS_STAGE_FILE, metrics__now() - start);
+
+	return ret;
 }
 
 static int make_index_file_response(struct MHD_Connection *connection, struct server_t * server)
@@ -229,134 +506,714 @@ static int make_index_file_response(struct MHD_Connection *connection, struct se
 		return make_server_file_response(connection, server->index_file, server);
 }
 
-static int make_image_response(struct MHD_Connection *connection, saim_string * data, enum image_format_t format)
+static void add_cache_headers(struct MHD_Response * response, const cache_headers_t * headers)
+{
+	char value[64];
+
+	MHD_add_response_header(response, "ETag", headers->etag);
+	snprintf(value, sizeof(value), "public, max-age=%i", headers->max_age);
+	MHD_add_response_header(response, "Cache-Control", value);
+	if (headers->vary_accept)
+		MHD_add_response_header(response, "Vary", "Accept");
+}
+
+/**
+ * Responds with the tile. Response of the hot tile is kept in the response cache,
+ * so next requests of the tile are answered with it as is.
+ *
+ * @param[in] hot_key  Key of the hot tile or NULL.
+ */
+static int make_image_response(struct MHD_Connection *connection, struct server_t * server,
+	struct tile_buffer_t * buffer, enum image_format_t format, const cache_headers_t * headers,
+	const struct tile_key_t * hot_key)
 {
 	struct MHD_Response * response;
+	unsigned long long start;
+	size_t size = tile_buffer__footprint(buffer);
 	int ret;
 	const char* mime_type;
 
+	// Response takes the buffer reference and sends the data without copying,
+	// the reference is released once the response is sent
 	mime_type = format_to_mime_type(format);
-	response = MHD_create_response_from_buffer((size_t)data->length, (void*)data->data, MHD_RESPMEM_PERSISTENT);
+	response = MHD_create_response_from_buffer_with_free_callback(buffer->size,
+		(void*)tile_buffer__data(buffer), tile_buffer__free_callback);
+	if (response == NULL)
+	{
+		tile_buffer__release(buffer);
+		return (int) MHD_NO;
+	}
 	MHD_add_response_header(response, "Content-Type", mime_type);
 	MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+	add_cache_headers(response, headers);
+	start = metrics__now();
 	ret = (int)MHD_queue_response(connection, MHD_HTTP_OK, response);
+	metrics__observe(server->metrics, METRICS_STAGE_QUEUE, metrics__now() - start);
+	if (hot_key != NULL)
+		response_cache__put_tile(server->responses, hot_key, headers->vary_accept, response, size);
+	else
+		MHD_destroy_response(response);
+
+	return ret;
+}
+
+static int make_not_modified_response(struct MHD_Connection *connection, const cache_headers_t * headers)
+{
+	struct MHD_Response * response;
+	int ret;
+
+	response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+	MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+	add_cache_headers(response, headers);
+	ret = (int)MHD_queue_response(connection, MHD_HTTP_NOT_MODIFIED, response);
 	MHD_destroy_response(response);
 
 	return ret;
 }
 
-static int make_jpeg_response(struct MHD_Connection *connection, struct server_t * server)
+static int make_stats_response(struct MHD_Connection *connection, struct server_t * server)
 {
-	saim_bitmap bitmap;
-	saim_string data;
-	unsigned char* dest_ptr = NULL;
-	unsigned long dest_size = 0;
+	struct MHD_Response * response;
+	struct tile_cache_stats_t stats;
+	struct tile_store_stats_t store_stats;
+	struct prefetch_stats_t prefetch_stats;
+	struct admission_stats_t admission_stats;
+	struct response_cache_stats_t response_stats;
+	unsigned long long coalesced;
+	char text[2048];
+	int length;
 	int ret;
 
-	// Make buffer string
-	bitmap.data = server->buffer;
-	/* 
-	Quality 100 causes first image to have wrong header.
-	So that's a library bug. We should either try to update to the latest libjpeg 
-	or use lesser quality. Now I set it to 95.
-	*/
-	if (!saim_decoder_jpeg__save_to_buffer(&bitmap, 95, false,
-		server->width, server->height, server->bytes_per_pixel, &dest_ptr, &dest_size))
-	{
-		if (dest_ptr != NULL)
-			free(dest_ptr);
-		return make_server_error_response(connection);
-	}
-	if (dest_ptr == NULL)
-		return make_server_error_response(connection);
-	data.data = (char*)dest_ptr;
-	data.length = (unsigned int)dest_size;
-	ret = make_image_response(connection, &data, FORMAT_JPEG);
-	free(dest_ptr);
+	if (server->cache != NULL)
+		tile_cache__get_stats(server->cache, &stats);
+	else
+		memset(&stats, 0, sizeof(stats));
+	if (server->store != NULL)
+		tile_store__get_stats(server->store, &store_stats);
+	else
+		memset(&store_stats, 0, sizeof(store_stats));
+	if (server->prefetch != NULL)
+		prefetch__get_stats(server->prefetch, &prefetch_stats);
+	else
+		memset(&prefetch_stats, 0, sizeof(prefetch_stats));
+	admission__get_stats(server->admission, &admission_stats);
+	response_cache__get_stats(server->responses, &response_stats);
+	coalesced = inflight_table__get_coalesced(server->inflight);
+	length = snprintf(text, sizeof(text),
+		"cache_hits %llu\n"
+		"cache_misses %llu\n"
+		"cache_evictions %llu\n"
+		"cache_entries %llu\n"
+		"cache_bytes %llu\n"
+		"cache_max_bytes %llu\n"
+		"store_hits %llu\n"
+		"store_misses %llu\n"
+		"store_writes %llu\n"
+		"store_dropped %llu\n"
+		"store_evictions %llu\n"
+		"store_entries %llu\n"
+		"store_bytes %llu\n"
+		"store_max_bytes %llu\n"
+		"coalesced %llu\n"
+		"prefetch_queued %llu\n"
+		"prefetch_rendered %llu\n"
+		"prefetch_dropped %llu\n"
+		"render_pending %i\n"
+		"render_admitted %llu\n"
+		"render_rejected_queue_full %llu\n"
+		"render_rejected_client_busy %llu\n"
+		"hot_tile_hits %llu\n"
+		"hot_tile_entries %llu\n"
+		"hot_tile_bytes %llu\n"
+		"hot_tile_max_bytes %llu\n",
+		stats.hits, stats.misses, stats.evictions,
+		stats.entries, stats.bytes, stats.max_bytes,
+		store_stats.hits, store_stats.misses, store_stats.writes,
+		store_stats.dropped, store_stats.evictions,
+		store_stats.entries, store_stats.bytes, store_stats.max_bytes,
+		coalesced,
+		prefetch_stats.queued, prefetch_stats.rendered, prefetch_stats.dropped,
+		admission_stats.pending, admission_stats.admitted,
+		admission_stats.queue_full, admission_stats.client_busy,
+		response_stats.hits, response_stats.entries, response_stats.bytes, response_stats.max_bytes);
+	if (length < 0 || (size_t)length >= sizeof(text))
+		return make_server_error_response(connection, server);
+
+	response = MHD_create_response_from_buffer((size_t)length, (void*)text, MHD_RESPMEM_MUST_COPY);
+	MHD_add_response_header(response, "Content-Type", "text/plain");
+	ret = (int)MHD_queue_response(connection, MHD_HTTP_OK, response);
+	MHD_destroy_response(response);
+
 	return ret;
 }
 
-static int make_png_response(struct MHD_Connection *connection, struct server_t * server)
+/**
+ * Returns metrics in Prometheus text exposition format.
+ * Every value of /stats is exported along with latency histograms,
+ * monotonic ones as counters and the rest as gauges.
+ */
+static int make_metrics_response(struct MHD_Connection *connection, struct server_t * server)
 {
-	saim_bitmap bitmap;
-	saim_string data;
+	struct MHD_Response * response;
+	struct tile_cache_stats_t stats;
+	struct tile_store_stats_t store_stats;
+	struct prefetch_stats_t prefetch_stats;
+	struct admission_stats_t admission_stats;
+	struct response_cache_stats_t response_stats;
+	const size_t max = 32 * 1024;
+	char * text;
+	int length, tail;
 	int ret;
 
-	// Make buffer string
-	bitmap.data = server->buffer;
-	saim_string_create(&data);
-	if (!saim_decoder_png__save_to_buffer(&bitmap, false,
-		server->width, server->height, server->bytes_per_pixel, &data))
+	text = (char *) malloc(max);
+	if (text == NULL)
+		return make_server_error_response(connection, server);
+	length = metrics__format(server->metrics, text, max);
+	if (length < 0)
 	{
-		saim_string_destroy(&data);
-		return make_server_error_response(connection);
+		free((void*)text);
+		return make_server_error_response(connection, server);
 	}
-	ret = make_image_response(connection, &data, FORMAT_PNG);
-	saim_string_destroy(&data);
+
+	if (server->cache != NULL)
+		tile_cache__get_stats(server->cache, &stats);
+	else
+		memset(&stats, 0, sizeof(stats));
+	if (server->store != NULL)
+		tile_store__get_stats(server->store, &store_stats);
+	else
+		memset(&store_stats, 0, sizeof(store_stats));
+	if (server->prefetch != NULL)
+		prefetch__get_stats(server->prefetch, &prefetch_stats);
+	else
+		memset(&prefetch_stats, 0, sizeof(prefetch_stats));
+	admission__get_stats(server->admission, &admission_stats);
+	response_cache__get_stats(server->responses, &response_stats);
+	tail = snprintf(text + length, max - (size_t)length,
+		"# TYPE tileserver_cache_hits_total counter\n"
+		"tileserver_cache_hits_total %llu\n"
+		"# TYPE tileserver_cache_misses_total counter\n"
+		"tileserver_cache_misses_total %llu\n"
+		"# TYPE tileserver_cache_evictions_total counter\n"
+		"tileserver_cache_evictions_total %llu\n"
+		"# TYPE tileserver_cache_entries gauge\n"
+		"tileserver_cache_entries %llu\n"
+		"# TYPE tileserver_cache_bytes gauge\n"
+		"tileserver_cache_bytes %llu\n"
+		"# TYPE tileserver_cache_max_bytes gauge\n"
+		"tileserver_cache_max_bytes %llu\n"
+		"# TYPE tileserver_store_hits_total counter\n"
+		"tileserver_store_hits_total %llu\n"
+		"# TYPE tileserver_store_misses_total counter\n"
+		"tileserver_store_misses_total %llu\n"
+		"# TYPE tileserver_store_writes_total counter\n"
+		"tileserver_store_writes_total %llu\n"
+		"# TYPE tileserver_store_dropped_total counter\n"
+		"tileserver_store_dropped_total %llu\n"
+		"# TYPE tileserver_store_evictions_total counter\n"
+		"tileserver_store_evictions_total %llu\n"
+		"# TYPE tileserver_store_entries gauge\n"
+		"tileserver_store_entries %llu\n"
+		"# TYPE tileserver_store_bytes gauge\n"
+		"tileserver_store_bytes %llu\n"
+		"# TYPE tileserver_store_max_bytes gauge\n"
+		"tileserver_store_max_bytes %llu\n"
+		"# TYPE tileserver_coalesced_total counter\n"
+		"tileserver_coalesced_total %llu\n"
+		"# TYPE tileserver_prefetch_queued_total counter\n"
+		"tileserver_prefetch_queued_total %llu\n"
+		"# TYPE tileserver_prefetch_rendered_total counter\n"
+		"tileserver_prefetch_rendered_total %llu\n"
+		"# TYPE tileserver_prefetch_dropped_total counter\n"
+		"tileserver_prefetch_dropped_total %llu\n"
+		"# TYPE tileserver_render_pending gauge\n"
+		"tileserver_render_pending %i\n"
+		"# TYPE tileserver_render_admitted_total counter\n"
+		"tileserver_render_admitted_total %llu\n"
+		"# TYPE tileserver_render_rejected_total counter\n"
+		"tileserver_render_rejected_total{reason=\"queue_full\"} %llu\n"
+		"tileserver_render_rejected_total{reason=\"client_busy\"} %llu\n"
+		"# TYPE tileserver_hot_tile_hits_total counter\n"
+		"tileserver_hot_tile_hits_total %llu\n"
+		"# TYPE tileserver_hot_tile_entries gauge\n"
+		"tileserver_hot_tile_entries %llu\n"
+		"# TYPE tileserver_hot_tile_bytes gauge\n"
+		"tileserver_hot_tile_bytes %llu\n"
+		"# TYPE tileserver_hot_tile_max_bytes gauge\n"
+		"tileserver_hot_tile_max_bytes %llu\n",
+		stats.hits, stats.misses, stats.evictions,
+		stats.entries, stats.bytes, stats.max_bytes,
+		store_stats.hits, store_stats.misses, store_stats.writes,
+		store_stats.dropped, store_stats.evictions,
+		store_stats.entries, store_stats.bytes, store_stats.max_bytes,
+		inflight_table__get_coalesced(server->inflight),
+		prefetch_stats.queued, prefetch_stats.rendered, prefetch_stats.dropped,
+		admission_stats.pending, admission_stats.admitted,
+		admission_stats.queue_full, admission_stats.client_busy,
+		response_stats.hits, response_stats.entries, response_stats.bytes, response_stats.max_bytes);
+	if (tail < 0 || (size_t)tail >= max - (size_t)length)
+	{
+		free((void*)text);
+		return make_server_error_response(connection, server);
+	}
+
+	// Response takes ownership of the text
+	response = MHD_create_response_from_buffer((size_t)(length + tail), (void*)text, MHD_RESPMEM_MUST_FREE);
+	MHD_add_response_header(response, "Content-Type", "text/plain; version=0.0.4");
+	ret = (int)MHD_queue_response(connection, MHD_HTTP_OK, response);
+	MHD_destroy_response(response);
+
 	return ret;
 }
 
-static bool render_mapped_cube(struct MHD_Connection *connection, const arguments_t * args, struct server_t * server)
+static void make_tile_key(const arguments_t * args, enum image_format_t format,
+	const struct server_t * server, struct tile_key_t * key)
+{
+	key->face = args->face;
+	key->lod = args->lod;
+	key->x = args->x;
+	key->y = args->y;
+	key->format = (int)format;
+	key->size = args->size;
+	// Requested settings apply to their formats only
+	key->quality = tile_render__default_quality(server, format, args->lod);
+	if (format == FORMAT_JPEG && args->quality != 0)
+		key->quality = args->quality;
+	else if (format == FORMAT_PNG && args->png_profile != 0)
+		key->quality = args->png_profile;
+	else if (format == FORMAT_WEBP && args->lossless)
+		key->quality = 0; // lossless
+	else if (format == FORMAT_WEBP && args->quality != 0)
+		key->quality = args->quality;
+}
+
+/**
+ * ETag depends only on the tile key and the imagery version,
+ * so it's known before the tile is rendered.
+ */
+static void make_cache_headers(const struct tile_key_t * key, struct server_t * server, cache_headers_t * headers)
+{
+	snprintf(headers->etag, sizeof(headers->etag), "\"%s-%i-%i-%i-%i-%i-%i-%i\"",
+		server->source_version, key->face, key->lod, key->x, key->y, key->format, key->quality, key->size);
+	headers->max_age = server__get_max_age(server, key->lod);
+}
+
+static bool is_etag_matched(struct MHD_Connection *connection, const char * etag)
+{
+	const char * value;
+
+	value = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "If-None-Match");
+	if (value == NULL)
+		return false;
+	// Quoted tags can't overlap, so substring search is enough for a list
+	return strcmp(value, "*") == 0 || strstr(value, etag) != NULL;
+}
+
+/**
+ * Checks whether the client has closed the connection while its request is being processed.
+ * Pending pipelined request or no data at all means the client is still there.
+ */
+static bool is_client_gone(struct MHD_Connection *connection)
+{
+#if defined(_WIN32)
+	(void) connection;
+	return false;
+#else
+	const union MHD_ConnectionInfo * info;
+	ssize_t result;
+	char byte;
+
+	info = MHD_get_connection_info(connection, MHD_CONNECTION_INFO_CONNECTION_FD);
+	if (info == NULL)
+		return false;
+	result = recv(info->connect_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+	if (result == 0)
+		return true; // orderly shutdown
+	return result < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+#endif
+}
+
+static bool is_request_abandoned(void * arg)
+{
+	request_state_t * request = (request_state_t *) arg;
+
+	return metrics__now() > request->deadline || is_client_gone(request->connection);
+}
+
+/**
+ * Tile render running on the executor while the connection is suspended.
+ * Job lives in the connection request context until the request is completed.
+ */
+typedef struct {
+	struct executor_task_t task; // should be the first member
+	struct inflight_waiter_t waiter; // waits for the tile rendered by another request
+	struct server_t * server;
+	request_state_t request;
+	struct admission_client_t client;
+	struct tile_key_t key;
+	enum image_format_t format;
+	cache_headers_t headers;
+	unsigned long long start; // time the request has come
+	struct tile_buffer_t * buffer;
+	bool rendered;
+	bool cancelled; // render has been abandoned, connection is to be closed
+} tile_job_t;
+
+static bool is_job_abandoned(void * arg)
+{
+	tile_job_t * job = (tile_job_t *) arg;
+
+	return executor__is_stopping(job->server->executor) || is_request_abandoned(&job->request);
+}
+
+/* Runs on the thread of the request that has rendered the tile */
+static void notify_tile_job(struct inflight_waiter_t * waiter, struct tile_buffer_t * buffer)
+{
+	tile_job_t * job = (tile_job_t *)((char *)waiter - offsetof(tile_job_t, waiter));
+
+	job->buffer = buffer;
+	job->rendered = buffer != NULL;
+	executor__resume(job->server->executor, job->request.connection);
+}
+
+/* Runs on the executor thread */
+static void run_tile_job(struct executor_task_t * task, bool stopping)
+{
+	tile_job_t * job = (tile_job_t *) task;
+	struct server_t * server = job->server;
+	struct admission_client_t client = job->client;
+	struct tile_render_cancel_t cancel;
+
+	// Client may have gone while the job has been queued
+	if (stopping || is_job_abandoned((void*)job))
+		job->cancelled = true;
+	else
+	{
+		cancel.is_cancelled = is_job_abandoned;
+		cancel.arg = (void*)job;
+		switch (tile_render__get_rendered(server, &job->key, &cancel, &job->waiter, &job->buffer))
+		{
+		case TILE_RENDER_DONE:
+			job->rendered = true;
+			break;
+		case TILE_RENDER_FAILED:
+			job->cancelled = cancel.cancelled;
+			break;
+		default:
+			// Waiting job doesn't hold a render context, so it leaves admission at once,
+			// and it may be resumed and freed already
+			admission__leave(server->admission, &client);
+			return;
+		}
+	}
+	admission__leave(server->admission, &client);
+
+	// Job belongs to the connection once it's resumed
+	executor__resume(server->executor, job->request.connection);
+}
+
+static void free_tile_job(tile_job_t * job)
+{
+	if (job->rendered)
+		tile_buffer__release(job->buffer);
+	free((void*)job);
+}
+
+static void count_tile_request(struct server_t * server, int format, unsigned int status, unsigned long long start)
 {
-	int tiles_left;
+	metrics__count_tile_request(server->metrics, format, status);
+	metrics__observe(server->metrics, METRICS_STAGE_TILE, metrics__now() - start);
+}
+
+/**
+ * Answers the tile request once its render job is done.
+ */
+static int respond_tile_job(struct MHD_Connection *connection, tile_job_t * job)
+{
+	struct server_t * server = job->server;
 
-	mtx_lock(&server->mutex);
-	do
+	if (job->cancelled)
+	{
+		count_tile_request(server, (int)job->format, MHD_HTTP_INTERNAL_SERVER_ERROR, job->start);
+		return (int) MHD_NO; // close the connection
+	}
+	if (!job->rendered)
 	{
-		tiles_left = saim_render_mapped_cube(server->saim, args->face, args->lod, args->x, args->y);
-		thrd_yield();
+		count_tile_request(server, (int)job->format, MHD_HTTP_INTERNAL_SERVER_ERROR, job->start);
+		return make_server_error_response(connection, server);
 	}
-	while (tiles_left > 0);
-	mtx_unlock(&server->mutex);
+	count_tile_request(server, (int)job->format, MHD_HTTP_OK, job->start);
+
+	// Next tiles of panning and zooming are rendered meanwhile
+	if (server->prefetch != NULL)
+		prefetch__request(server->prefetch, &job->key);
 
-	// -1 means that inner error has occured
-	return tiles_left == 0;
+	// Response takes the buffer reference
+	job->rendered = false;
+	return make_image_response(connection, server, job->buffer, job->format, &job->headers, NULL);
 }
 
-static bool process_cube_request(struct MHD_Connection *connection, struct server_t * server)
+/**
+ * Answers the tile request at once when the tile is cached,
+ * otherwise suspends the connection and hands the render to the executor.
+ */
+static int respond_tile(struct MHD_Connection *connection, const char * url, struct server_t * server,
+	unsigned long long start, void ** ptr, int * format_index, unsigned int * status)
 {
+	enum image_format_t format;
 	arguments_t args;
+	struct tile_key_t key;
+	cache_headers_t headers;
+	struct admission_client_t client;
+	enum admission_result_t admission;
+	tile_job_t * job;
+	struct tile_buffer_t * buffer;
+	bool negotiated;
+	bool parsed;
+	int ret;
 
-	// Parse request arguments
-	if (!parse_cube_arguments(connection, &args))
+	// Get image format and parse request arguments
+	if (!get_image_format(connection, server, &format, &negotiated))
+	{
+		*status = MHD_HTTP_BAD_REQUEST;
+		return (int) MHD_NO;
+	}
+	*format_index = (int)format;
+	parsed = parse_cube_arguments(connection, url, server, &args);
+	metrics__observe(server->metrics, METRICS_STAGE_PARSE, metrics__now() - start);
+	*status = MHD_HTTP_INTERNAL_SERVER_ERROR;
+	if (!parsed)
+		return make_server_error_response(connection, server);
+
+	// Revalidation is answered before any render or encode
+	make_tile_key(&args, format, server, &key);
+	make_cache_headers(&key, server, &headers);
+	headers.vary_accept = negotiated;
+	if (is_etag_matched(connection, headers.etag))
+	{
+		*status = MHD_HTTP_NOT_MODIFIED;
+		if (server->prefetch != NULL)
+			prefetch__request(server->prefetch, &key);
+		return make_not_modified_response(connection, &headers);
+	}
+
+	// Hot tiles are answered with their prebuilt responses
+	if (response_cache__queue_tile(server->responses, connection, &key, headers.vary_accept, &ret))
+	{
+		*status = MHD_HTTP_OK;
+		if (server->prefetch != NULL)
+			prefetch__request(server->prefetch, &key);
+		return ret;
+	}
+
+	// Cached tiles are served regardless of the load, they're hot once served from the cache
+	if (tile_render__get_cached(server, &key, &buffer))
+	{
+		*status = MHD_HTTP_OK;
+		if (server->prefetch != NULL)
+			prefetch__request(server->prefetch, &key);
+		return make_image_response(connection, server, buffer, format, &headers, &key);
+	}
+
+	// Render is admitted only while the wait for a render context is bounded
+	get_client(connection, &client);
+	admission = admission__enter(server->admission, &client);
+	if (admission != ADMISSION_ADMITTED)
+	{
+		*status = get_rejection_status(admission);
+		return make_overloaded_response(connection, server, *status);
+	}
+	job = (tile_job_t *) calloc(1, sizeof(tile_job_t));
+	if (job == NULL)
+	{
+		admission__leave(server->admission, &client);
+		return make_server_error_response(connection, server);
+	}
+	job->task.run = run_tile_job;
+	job->waiter.notify = notify_tile_job;
+	job->server = server;
+	job->request.connection = connection;
+	job->request.deadline = start + (unsigned long long)SERVER_CONNECTION_TIMEOUT * 1000000ull;
+	job->client = client;
+	job->key = key;
+	job->format = format;
+	job->headers = headers;
+	job->start = start;
+
+	// Request is answered when the connection is resumed by the job
+	*ptr = (void*)job;
+	executor__suspend(server->executor, connection);
+	executor__submit(server->executor, &job->task);
+	return (int) MHD_YES;
+}
+
+static int process_tile_request(struct MHD_Connection *connection, const char * url, struct server_t * server,
+	void ** ptr)
+{
+	unsigned long long start;
+	unsigned int status;
+	int format = -1;
+	int ret;
+
+	start = metrics__now();
+	ret = respond_tile(connection, url, server, start, ptr, &format, &status);
+	if (*ptr == NULL) // suspended request is counted when it's answered
+		count_tile_request(server, format, status, start);
+
+	return ret;
+}
+
+/**
+ * Gets batch tile keys either from the list like tiles=0/2/1/1,0/2/1/2
+ * or from the rectangle given by face, lod, x, y, width and height.
+ */
+static bool get_batch_keys(struct MHD_Connection *connection, const char * url, struct server_t * server,
+	enum image_format_t format, arguments_t * args, struct tile_key_t * keys, int * count)
+{
+	const char *value, *token;
+	int width, height, length;
+
+	// Tile size and encoder settings are shared by all tiles
+	if (!get_tile_size(connection, url, server, &args->size))
+		return false;
+	if (!get_quality(connection, &args->quality))
 		return false;
+	if (!get_png_profile(connection, &args->png_profile))
+		return false;
+	if (!get_lossless(connection, &args->lossless))
+		return false;
+
+	*count = 0;
+	value = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "tiles");
+	if (value != NULL)
+	{
+		for (token = value; *token != '\0'; token += length)
+		{
+			if (*count == BATCH_MAX_TILES)
+			{
+				printf("batch has more than %i tiles\n", BATCH_MAX_TILES);
+				return false;
+			}
+			if (sscanf(token, "%d/%d/%d/%d%n", &args->face, &args->lod, &args->x, &args->y, &length) != 4)
+			{
+				printf("tile '%s' is malformed\n", token);
+				return false;
+			}
+			if (token[length] == ',')
+				++length;
+			make_tile_key(args, format, server, &keys[(*count)++]);
+		}
+		return *count != 0;
+	}
 
-	// Render to buffer
-	return render_mapped_cube(connection, &args, server);
+	if (!get_tile_key(connection, &args->face, &args->lod, &args->x, &args->y))
+		return false;
+	value = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "width");
+	width = (value != NULL) ? atoi(value) : 1;
+	value = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "height");
+	height = (value != NULL) ? atoi(value) : 1;
+	// Product is checked by division, so huge sides can't overflow it
+	if (width < 1 || height < 1 || width > BATCH_MAX_TILES / height)
+	{
+		printf("batch rectangle %ix%i is out of range\n", width, height);
+		return false;
+	}
+	// Rectangle lies within the face, so tile coordinates can't overflow either
+	if (args->lod < 0 || args->lod > 30 || args->x < 0 || args->y < 0
+		|| (long long)args->x + width > (1LL << args->lod)
+		|| (long long)args->y + height > (1LL << args->lod))
+	{
+		printf("batch rectangle %ix%i at %i,%i is outside of lod %i\n", width, height, args->x, args->y, args->lod);
+		return false;
+	}
+	for (int j = 0; j < height && *count < BATCH_MAX_TILES; ++j)
+		for (int i = 0; i < width && *count < BATCH_MAX_TILES; ++i)
+		{
+			arguments_t tile = *args;
+			tile.x = args->x + i;
+			tile.y = args->y + j;
+			make_tile_key(&tile, format, server, &keys[(*count)++]);
+		}
+	return true;
 }
 
-static int process_tile_request(struct MHD_Connection *connection, struct server_t * server)
+/**
+ * Responds with tiles streamed as soon as each one is ready.
+ * Tiles order in the response is the order of completion.
+ */
+static int respond_batch(struct MHD_Connection *connection, const char * url, struct server_t * server)
 {
+	struct tile_key_t keys[BATCH_MAX_TILES];
+	struct MHD_Response * response;
+	struct batch_t * batch;
+	struct admission_client_t client;
+	enum admission_result_t admission;
 	enum image_format_t format;
+	arguments_t args;
+	bool negotiated;
+	int count;
+	int ret;
 
-	// Get image format
-	if (!get_image_format(connection, &format))
+	if (!get_image_format(connection, server, &format, &negotiated))
 		return (int) MHD_NO;
+	if (!get_batch_keys(connection, url, server, format, &args, keys, &count))
+		return make_server_error_response(connection, server);
 
-	// Process request
-	if (!process_cube_request(connection, server))
-		return make_server_error_response(connection);
-
-	// Make response depending on requested image format
-	switch (format)
+	// First lane of the batch takes this admission, other lanes are admitted by the batch
+	get_client(connection, &client);
+	admission = admission__enter(server->admission, &client);
+	if (admission != ADMISSION_ADMITTED)
+		return make_overloaded_response(connection, server, get_rejection_status(admission));
+	batch = batch__create(server, connection, keys, count, &client);
+	if (batch == NULL)
 	{
-	case FORMAT_JPEG:
-		return make_jpeg_response(connection, server);
-	case FORMAT_PNG:
-		return make_png_response(connection, server);
-	default:
-		return make_server_error_response(connection);
+		admission__leave(server->admission, &client);
+		return make_server_error_response(connection, server);
 	}
+	response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 32 * 1024,
+		batch__read, (void*)batch, batch__free);
+	if (response == NULL)
+	{
+		batch__free((void*)batch);
+		return make_server_error_response(connection, server);
+	}
+	MHD_add_response_header(response, "Content-Type", "application/octet-stream");
+	MHD_add_response_header(response, "X-Tile-Type", format_to_mime_type(format));
+	MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+	MHD_add_response_header(response, "Cache-Control", "no-store");
+	if (negotiated)
+		MHD_add_response_header(response, "Vary", "Accept");
+	ret = (int)MHD_queue_response(connection, MHD_HTTP_OK, response);
+	MHD_destroy_response(response);
+
+	return ret;
 }
 
-static int process_request(struct MHD_Connection *connection, const char* url, struct server_t * server)
+/**
+ * Checks whether URL is the endpoint path, optionally followed by scale suffix like /tile@2x
+ */
+static bool is_endpoint(const char * url, const char * path)
+{
+	size_t length = strlen(path);
+
+	return strncmp(url, path, length) == 0 && (url[length] == '\0' || url[length] == '@');
+}
+
+static int process_request(struct MHD_Connection *connection, const char* url, struct server_t * server,
+	void ** ptr)
 {
 	if (strcmp(url, "/help") == 0)
-		return make_help_response(connection);
+		return make_help_response(connection, server);
+	else if (strcmp(url, "/stats") == 0)
+		return make_stats_response(connection, server);
+	else if (strcmp(url, "/metrics") == 0)
+		return make_metrics_response(connection, server);
+	else if (is_endpoint(url, "/tiles"))
+		return respond_batch(connection, url, server);
 	else if (server->file_root != NULL)
 	{
-		if (strcmp(url, "/tile") == 0)
-			return process_tile_request(connection, server);
+		if (is_endpoint(url, "/tile"))
+			return process_tile_request(connection, url, server, ptr);
 		else if (strcmp(url, "") == 0 || strcmp(url, "/") == 0)
 			return make_index_file_response(connection, server);
 		else
@@ -364,16 +1221,113 @@ static int process_request(struct MHD_Connection *connection, const char* url, s
 	}
 	else // file root is null
 	{
-		return process_tile_request(connection, server);
+		return process_tile_request(connection, url, server, ptr);
 	}
 }
 
+/**
+ * Reads the help page and its gzip compressed copy into prebuilt responses.
+ */
+static void prepare_help_pages(struct server_t * server)
+{
+	const char * path = "help.html";
+	char mime_type[64];
+	struct MHD_Response * response;
+	struct tile_buffer_t * gzip;
+	unsigned char * data;
+	size_t size, offset;
+	time_t mtime;
+	bool compressible;
+	ssize_t length;
+	int fd;
+
+	if (!file_cache__open(server->files, path, &fd, &size, &mtime))
+	{
+		printf("Help page isn't prebuilt, since \'%s\' hasn't been found\n", path);
+		return;
+	}
+	data = (unsigned char *) malloc((size != 0) ? size : 1);
+	if (data == NULL)
+	{
+		close(fd);
+		return;
+	}
+	for (offset = 0; offset < size; offset += (size_t)length)
+	{
+		length = read(fd, data + offset, (unsigned int)(size - offset));
+		if (length <= 0)
+			break;
+	}
+	close(fd);
+	if (offset != size)
+	{
+		free((void*)data);
+		return;
+	}
+
+	translate_url_to_mime_type(path, mime_type, sizeof(mime_type)/sizeof(mime_type[0]));
+	compressible = is_mime_type_compressible(mime_type);
+	response = MHD_create_response_from_buffer(size, (void*)data, MHD_RESPMEM_MUST_FREE);
+	if (response == NULL)
+	{
+		free((void*)data);
+		return;
+	}
+	MHD_add_response_header(response, "Content-Type", mime_type);
+	if (compressible)
+		MHD_add_response_header(response, "Vary", "Accept-Encoding");
+	response_cache__set_page(server->responses, RESPONSE_PAGE_HELP, response);
+
+	if (!compressible || !file_cache__get_gzip(server->files, path, &gzip))
+		return;
+	response = MHD_create_response_from_buffer_with_free_callback(gzip->size,
+		(void*)tile_buffer__data(gzip), tile_buffer__free_callback);
+	if (response == NULL)
+	{
+		tile_buffer__release(gzip);
+		return;
+	}
+	MHD_add_response_header(response, "Content-Type", mime_type);
+	MHD_add_response_header(response, "Content-Encoding", "gzip");
+	MHD_add_response_header(response, "Vary", "Accept-Encoding");
+	response_cache__set_page(server->responses, RESPONSE_PAGE_HELP_GZIP, response);
+}
+
+bool answer__prepare_pages(struct server_t * server)
+{
+	struct MHD_Response * response;
+	char value[16];
+
+	response = MHD_create_response_from_buffer(strlen(kServerError), (void*)kServerError, MHD_RESPMEM_PERSISTENT);
+	if (response == NULL)
+		return false;
+	MHD_add_response_header(response, "Content-Type", "text/html");
+	response_cache__set_page(server->responses, RESPONSE_PAGE_SERVER_ERROR, response);
+
+	response = MHD_create_response_from_buffer(strlen(kEmptyPage), (void*)kEmptyPage, MHD_RESPMEM_PERSISTENT);
+	if (response == NULL)
+		return false;
+	response_cache__set_page(server->responses, RESPONSE_PAGE_NOT_FOUND, response);
+
+	// Both 503 and 429 rejections are made of the same response
+	response = MHD_create_response_from_buffer(strlen(kOverloaded), (void*)kOverloaded, MHD_RESPMEM_PERSISTENT);
+	if (response == NULL)
+		return false;
+	MHD_add_response_header(response, "Content-Type", "text/html");
+	MHD_add_response_header(response, "Access-Control-Allow-Origin", "*");
+	snprintf(value, sizeof(value), "%i", server->retry_after);
+	MHD_add_response_header(response, "Retry-After", value);
+	response_cache__set_page(server->responses, RESPONSE_PAGE_OVERLOADED, response);
+
+	prepare_help_pages(server);
+	return true;
+}
+
 __MHD_INT_RESULT
 answer_callback(void *cls, struct MHD_Connection *connection,
 	const char *url, const char *method, const char *version,
 	const char *upload_data, size_t *upload_data_size, void **ptr)
 {
-	static int aptr;
 	struct server_t * server = (struct server_t *) cls;
 
 	(void) url;               /* Unused. Silent compiler warning. */
@@ -384,13 +1338,45 @@ answer_callback(void *cls, struct MHD_Connection *connection,
 	if (0 != strcmp(method, "GET"))
 		return MHD_NO;              /* unexpected method */
 
-	if (&aptr != *ptr)
+	if (NULL == *ptr)
 	{
 		/* do never respond on first call */
-		*ptr = &aptr;
+		*ptr = &first_call;
 		return MHD_YES;
 	}
+	if (&first_call != *ptr)
+	{
+		/* resumed by the render job, the job is freed on completion */
+		return (__MHD_INT_RESULT) respond_tile_job(connection, (tile_job_t *) *ptr);
+	}
 	*ptr = NULL;                  /* reset when done */
 
-	return (__MHD_INT_RESULT) process_request(connection, url, server);
+	return (__MHD_INT_RESULT) process_request(connection, url, server, ptr);
+}
+
+void
+completed_callback(void *cls, struct MHD_Connection *connection,
+	void **ptr, enum MHD_RequestTerminationCode toe)
+{
+	struct server_t * server = (struct server_t *) cls;
+
+	(void) connection; /* Unused. Silent compiler warning. */
+
+	if (*ptr != NULL && *ptr != &first_call)
+	{
+		free_tile_job((tile_job_t *) *ptr);
+		*ptr = NULL;
+	}
+
+	switch (toe)
+	{
+		case MHD_REQUEST_TERMINATED_WITH_ERROR:
+		case MHD_REQUEST_TERMINATED_TIMEOUT_REACHED:
+		case MHD_REQUEST_TERMINATED_READ_ERROR:
+		case MHD_REQUEST_TERMINATED_CLIENT_ABORT:
+			metrics__count_aborted_request(server->metrics);
+			break;
+		default:
+			break;
+	}
 }
\ No newline at end of file
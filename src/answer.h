@@ -7,8 +7,11 @@
 #define __ANSWER_H__
 
 #include <microhttpd.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
+struct server_t;
+
 /* Older microhttpd library versions use int instead of enum. */
 #if defined(_MHD_FIXED_ENUM)
 # define __MHD_INT_RESULT enum MHD_Result
@@ -16,9 +19,23 @@
 # define __MHD_INT_RESULT int
 #endif
 
+/**
+ * Builds prebuilt responses of fixed pages, help page is read once here.
+ *
+ * @return False on failure.
+ */
+bool answer__prepare_pages(struct server_t * server);
+
 __MHD_INT_RESULT
 answer_callback(void *cls, struct MHD_Connection *connection,
 	const char *url, const char *method, const char *version,
 	const char *upload_data, size_t *upload_data_size, void **ptr);
 
+/**
+ * Called by MHD when a request is finished, counts requests aborted by clients.
+ */
+void
+completed_callback(void *cls, struct MHD_Connection *connection,
+	void **ptr, enum MHD_RequestTerminationCode toe);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,438 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "bake.h"
+#include "tile_render.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BAKE_MAX_DEPTH 32
+
+enum bake_cursor_t
+{
+	BAKE_CURSOR_TILE,
+	BAKE_CURSOR_WAIT, // every tile left waits for its children
+	BAKE_CURSOR_END
+};
+
+/**
+ * Tile of the pyramid order traversal, its children are handed out before the tile itself
+ */
+struct bake_frame_t
+{
+	int face;
+	int lod;
+	int x;
+	int y;
+	int next_child;
+};
+
+/**
+ * Parent tile waiting for its children to be baked
+ */
+struct bake_parent_t
+{
+	struct tile_key_t key;
+	int children_left;
+	bool queued; // every child has been handed out
+};
+
+struct bake_state_t
+{
+	struct server_t * server;
+	const struct bake_options_t * options;
+	mtx_t mutex;
+	cnd_t condition;
+	// Cursor of the next tile
+	int face_index;
+	int lod;
+	int x;
+	int y;
+	bool cursor_end;
+	// Pyramid order, lower lods are downsampled from cached children rasters
+	bool pyramid;
+	struct bake_frame_t stack[BAKE_MAX_DEPTH];
+	int depth;
+	struct bake_parent_t * parents;
+	int parent_count;
+	cnd_t parent_ready;
+	// Progress
+	unsigned long long total;
+	unsigned long long rendered;
+	unsigned long long skipped;
+	unsigned long long failed;
+	int running_workers;
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+static double get_time(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void make_key(const struct bake_state_t * state, int face, int lod, int x, int y, struct tile_key_t * key)
+{
+	key->face = face;
+	key->lod = lod;
+	key->x = x;
+	key->y = y;
+	key->format = (int)state->options->format;
+	key->quality = tile_render__default_quality(state->server, state->options->format, lod);
+	key->size = state->server->width;
+}
+
+/* Should be called with state mutex locked */
+static bool next_tile(struct bake_state_t * state, struct tile_key_t * key)
+{
+	const struct bake_options_t * options = state->options;
+	int tiles_per_side;
+
+	if (state->cursor_end)
+		return false;
+
+	make_key(state, options->faces[state->face_index], state->lod, state->x, state->y, key);
+
+	// Advance cursor: x, then y, then face, then lod
+	tiles_per_side = (int)(1u << state->lod);
+	if (++state->x < tiles_per_side)
+		return true;
+	state->x = 0;
+	if (++state->y < tiles_per_side)
+		return true;
+	state->y = 0;
+	if (++state->face_index < options->face_count)
+		return true;
+	state->face_index = 0;
+	if (++state->lod <= options->max_lod)
+		return true;
+	state->cursor_end = true;
+	return true;
+}
+
+static struct bake_parent_t * find_parent(struct bake_state_t * state, int face, int lod, int x, int y)
+{
+	for (int i = 0; i < state->parent_count; ++i)
+	{
+		struct tile_key_t * key = &state->parents[i].key;
+		if (key->face == face && key->lod == lod && key->x == x && key->y == y)
+			return &state->parents[i];
+	}
+	return NULL;
+}
+
+static void take_parent(struct bake_state_t * state, struct bake_parent_t * parent, struct tile_key_t * key)
+{
+	*key = parent->key;
+	*parent = state->parents[--state->parent_count];
+}
+
+/*
+Pyramid order cursor. Tiles of the max lod are handed out in depth-first order,
+a parent is handed out once all of its children are baked, so their rasters
+are still in the raster cache. Should be called with state mutex locked.
+*/
+static enum bake_cursor_t next_pyramid_tile(struct bake_state_t * state, struct tile_key_t * key)
+{
+	const struct bake_options_t * options = state->options;
+	struct bake_frame_t * frame;
+	struct bake_frame_t * child;
+	struct bake_parent_t * parent;
+	int tiles_per_side;
+
+	// Ready parents go first
+	for (int i = 0; i < state->parent_count; ++i)
+		if (state->parents[i].queued && state->parents[i].children_left == 0)
+		{
+			take_parent(state, &state->parents[i], key);
+			return BAKE_CURSOR_TILE;
+		}
+
+	for (;;)
+	{
+		if (state->depth == 0)
+		{
+			if (state->cursor_end)
+				return (state->parent_count == 0) ? BAKE_CURSOR_END : BAKE_CURSOR_WAIT;
+
+			// Next tile of the min lod
+			frame = &state->stack[state->depth++];
+			frame->face = options->faces[state->face_index];
+			frame->lod = options->min_lod;
+			frame->x = state->x;
+			frame->y = state->y;
+			frame->next_child = 0;
+			tiles_per_side = (int)(1u << options->min_lod);
+			if (++state->x == tiles_per_side)
+			{
+				state->x = 0;
+				if (++state->y == tiles_per_side)
+				{
+					state->y = 0;
+					if (++state->face_index == options->face_count)
+						state->cursor_end = true;
+				}
+			}
+		}
+
+		frame = &state->stack[state->depth - 1];
+		if (frame->lod == options->max_lod)
+		{
+			--state->depth;
+			make_key(state, frame->face, frame->lod, frame->x, frame->y, key);
+			return BAKE_CURSOR_TILE;
+		}
+		if (frame->next_child == 0)
+		{
+			parent = &state->parents[state->parent_count++];
+			make_key(state, frame->face, frame->lod, frame->x, frame->y, &parent->key);
+			parent->children_left = 4;
+			parent->queued = false;
+		}
+		if (frame->next_child < 4)
+		{
+			child = &state->stack[state->depth++];
+			child->face = frame->face;
+			child->lod = frame->lod + 1;
+			child->x = 2 * frame->x + (frame->next_child & 1);
+			child->y = 2 * frame->y + (frame->next_child >> 1);
+			child->next_child = 0;
+			++frame->next_child;
+			continue;
+		}
+
+		// Every child has been handed out
+		--state->depth;
+		parent = find_parent(state, frame->face, frame->lod, frame->x, frame->y);
+		parent->queued = true;
+		if (parent->children_left == 0)
+		{
+			take_parent(state, parent, key);
+			return BAKE_CURSOR_TILE;
+		}
+	}
+}
+
+/* Should be called with state mutex locked */
+static bool take_tile(struct bake_state_t * state, struct tile_key_t * key)
+{
+	if (!state->pyramid)
+		return (interrupted == 0) && next_tile(state, key);
+
+	while (interrupted == 0)
+	{
+		switch (next_pyramid_tile(state, key))
+		{
+		case BAKE_CURSOR_TILE:
+			return true;
+		case BAKE_CURSOR_END:
+			return false;
+		case BAKE_CURSOR_WAIT:
+			cnd_wait(&state->parent_ready, &state->mutex);
+			break;
+		}
+	}
+	return false;
+}
+
+/* Should be called with state mutex locked */
+static void finish_tile(struct bake_state_t * state, const struct tile_key_t * key)
+{
+	struct bake_parent_t * parent;
+
+	if (!state->pyramid)
+		return;
+	if (key->lod > state->options->min_lod)
+	{
+		parent = find_parent(state, key->face, key->lod - 1, key->x / 2, key->y / 2);
+		if (parent != NULL)
+			--parent->children_left;
+	}
+	// Waiting workers also check for interruption
+	cnd_broadcast(&state->parent_ready);
+}
+
+static int worker_thread_func(void * arg)
+{
+	struct bake_state_t * state = (struct bake_state_t *) arg;
+	struct server_t * server = state->server;
+	struct tile_key_t key;
+	struct tile_buffer_t * buffer;
+	bool has_tile;
+
+	for (;;)
+	{
+		mtx_lock(&state->mutex);
+		has_tile = take_tile(state, &key);
+		mtx_unlock(&state->mutex);
+		if (!has_tile)
+			break;
+
+		if (tile_store__contains(server->store, &key))
+		{
+			mtx_lock(&state->mutex);
+			++state->skipped;
+			finish_tile(state, &key);
+			mtx_unlock(&state->mutex);
+			continue;
+		}
+		if (tile_render__render(server, &key, &buffer))
+		{
+			tile_store__put(server->store, &key, buffer);
+			tile_buffer__release(buffer);
+			mtx_lock(&state->mutex);
+			++state->rendered;
+			finish_tile(state, &key);
+			mtx_unlock(&state->mutex);
+		}
+		else
+		{
+			printf("Failed to render tile face=%i lod=%i x=%i y=%i\n", key.face, key.lod, key.x, key.y);
+			mtx_lock(&state->mutex);
+			++state->failed;
+			finish_tile(state, &key);
+			mtx_unlock(&state->mutex);
+		}
+	}
+
+	mtx_lock(&state->mutex);
+	--state->running_workers;
+	cnd_signal(&state->condition);
+	if (state->pyramid)
+		cnd_broadcast(&state->parent_ready);
+	mtx_unlock(&state->mutex);
+
+	return 0;
+}
+
+int bake__run(struct server_t * server, const struct bake_options_t * options)
+{
+	struct bake_state_t state;
+	struct timespec deadline;
+	thrd_t * threads;
+	double start_time, elapsed;
+	int thread_count;
+	unsigned long long done;
+
+	if (server->store == NULL)
+	{
+		printf("Bake requires tile store to be set\n");
+		return 1;
+	}
+	if (options->face_count <= 0 || options->min_lod < 0 || options->max_lod < options->min_lod
+		|| options->max_lod > BAKE_MAX_LOD)
+	{
+		printf("Bake tiles set is empty\n");
+		return 1;
+	}
+
+	state.server = server;
+	state.options = options;
+	state.face_index = 0;
+	state.lod = options->min_lod;
+	state.x = 0;
+	state.y = 0;
+	state.cursor_end = false;
+	state.total = 0;
+	for (int lod = options->min_lod; lod <= options->max_lod; ++lod)
+		state.total += (unsigned long long)options->face_count << (2 * lod);
+	state.rendered = 0;
+	state.skipped = 0;
+	state.failed = 0;
+	state.pyramid = server->rasters != NULL && options->max_lod - options->min_lod < BAKE_MAX_DEPTH;
+	state.depth = 0;
+	state.parents = NULL;
+	state.parent_count = 0;
+	if (mtx_init(&state.mutex, mtx_plain) == thrd_error)
+		return 2;
+	if (cnd_init(&state.condition) == thrd_error)
+	{
+		mtx_destroy(&state.mutex);
+		return 2;
+	}
+	if (cnd_init(&state.parent_ready) == thrd_error)
+	{
+		cnd_destroy(&state.condition);
+		mtx_destroy(&state.mutex);
+		return 2;
+	}
+
+	// One worker per render context keeps every context busy
+	thread_count = server->pool->size;
+	threads = (thrd_t *) malloc(sizeof(thrd_t) * (size_t)thread_count);
+	// Waiting parents are the traversal path and ancestors of tiles being baked
+	if (state.pyramid)
+		state.parents = (struct bake_parent_t *) malloc(sizeof(struct bake_parent_t)
+			* (size_t)(thread_count + 1) * BAKE_MAX_DEPTH);
+	if (threads == NULL || (state.pyramid && state.parents == NULL))
+	{
+		free((void*)threads);
+		cnd_destroy(&state.parent_ready);
+		cnd_destroy(&state.condition);
+		mtx_destroy(&state.mutex);
+		return 2;
+	}
+	printf("Baking %llu tiles of lods %i-%i on %i workers%s\n",
+		state.total, options->min_lod, options->max_lod, thread_count,
+		state.pyramid ? " in pyramid order" : "");
+
+	start_time = get_time();
+	state.running_workers = thread_count;
+	for (int i = 0; i < thread_count; ++i)
+	{
+		if (thrd_create(&threads[i], worker_thread_func, (void*)&state) != thrd_success)
+		{
+			mtx_lock(&state.mutex);
+			state.running_workers -= thread_count - i;
+			mtx_unlock(&state.mutex);
+			thread_count = i;
+			break;
+		}
+	}
+
+	// Report progress while workers are running
+	mtx_lock(&state.mutex);
+	while (state.running_workers > 0)
+	{
+		timespec_get(&deadline, TIME_UTC);
+		deadline.tv_sec += 2;
+		cnd_timedwait(&state.condition, &state.mutex, &deadline);
+		done = state.rendered + state.skipped + state.failed;
+		elapsed = get_time() - start_time;
+		printf("Baked %llu/%llu tiles (%llu skipped), %.1f tiles/s\n",
+			done, state.total, state.skipped,
+			(elapsed > 0.0) ? (double)state.rendered / elapsed : 0.0);
+	}
+	mtx_unlock(&state.mutex);
+
+	for (int i = 0; i < thread_count; ++i)
+		thrd_join(threads[i], NULL);
+	free((void*)threads);
+
+	// Make sure every rendered tile is on disk before reporting
+	tile_store__flush(server->store);
+	elapsed = get_time() - start_time;
+	printf("Bake %s: %llu rendered, %llu skipped, %llu failed in %.1f s (%.1f tiles/s)\n",
+		interrupted ? "interrupted" : "finished",
+		state.rendered, state.skipped, state.failed, elapsed,
+		(elapsed > 0.0) ? (double)state.rendered / elapsed : 0.0);
+
+	free((void*)state.parents);
+	cnd_destroy(&state.parent_ready);
+	cnd_destroy(&state.condition);
+	mtx_destroy(&state.mutex);
+
+	return (interrupted || state.failed != 0) ? 3 : 0;
+}
+
+void bake__interrupt(void)
+{
+	interrupted = 1;
+}
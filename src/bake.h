@@ -0,0 +1,43 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __BAKE_H__
+#define __BAKE_H__
+
+#include "server.h"
+#include "image_format.h"
+
+/* Largest lod to bake, tiles per side of greater lods don't fit in int */
+#define BAKE_MAX_LOD 30
+
+/**
+ * Describes set of tiles to bake
+ */
+struct bake_options_t
+{
+	int faces[6];
+	int face_count;
+	int min_lod;
+	int max_lod;
+	enum image_format_t format;
+};
+
+/**
+ * Renders and encodes every tile of the set into the server tile store
+ * on all render contexts in parallel, without starting the daemon.
+ * Tiles already in the store are skipped, so an interrupted bake resumes.
+ *
+ * @param[in] server   Initialized server with tile store.
+ * @param[in] options  Set of tiles to bake.
+ * @return Zero on success and non-zero otherwise.
+ */
+int bake__run(struct server_t * server, const struct bake_options_t * options);
+
+/**
+ * Asks running bake to stop, safe to call from a signal handler.
+ */
+void bake__interrupt(void);
+
+#endif
@@ -0,0 +1,328 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "batch.h"
+#include "tile_render.h"
+
+#include "tinycthread.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct batch_tile_t {
+	struct tile_buffer_t * buffer; // NULL when failed
+};
+
+/**
+ * Lane renders tiles of the batch one by one as executor tasks,
+ * each lane holds an admission of its own while it renders.
+ */
+struct batch_lane_t {
+	struct executor_task_t task; // first member, tasks are cast to lanes
+	struct inflight_waiter_t waiter; // waits for the tile rendered by another request
+	struct batch_t * batch;
+	int index; // tile being rendered
+	bool admitted; // false once the lane has left admission to wait for a tile
+};
+
+struct batch_t {
+	struct server_t * server;
+	struct MHD_Connection * connection;
+	struct admission_client_t client;
+	struct tile_key_t * keys;
+	struct batch_tile_t * tiles;
+	int * order; // tile indices in order of completion
+	int count;
+	int next; // next tile to render
+	int finished; // number of rendered tiles
+	int sent; // number of entirely sent tiles
+	size_t offset; // sent bytes of the current record
+	unsigned char header[BATCH_RECORD_HEADER_SIZE];
+	bool cancelled;
+	bool suspended; // connection waits for the next tile
+	int running; // number of running lanes
+	int references; // response and running lanes
+	mtx_t mutex;
+	struct batch_lane_t * lanes;
+	int lane_count;
+};
+
+static void put_uint32(unsigned char * data, unsigned long value)
+{
+	data[0] = (unsigned char)(value);
+	data[1] = (unsigned char)(value >> 8);
+	data[2] = (unsigned char)(value >> 16);
+	data[3] = (unsigned char)(value >> 24);
+}
+
+static bool is_batch_cancelled(void * arg)
+{
+	struct batch_t * batch = (struct batch_t *) arg;
+	bool cancelled;
+
+	mtx_lock(&batch->mutex);
+	cancelled = batch->cancelled;
+	mtx_unlock(&batch->mutex);
+	return cancelled || executor__is_stopping(batch->server->executor);
+}
+
+/* Should be called with mutex locked */
+static void resume(struct batch_t * batch)
+{
+	if (batch->suspended)
+	{
+		batch->suspended = false;
+		executor__resume(batch->server->executor, batch->connection);
+	}
+}
+
+static void destroy(struct batch_t * batch)
+{
+	if (batch->tiles != NULL)
+		for (int i = 0; i < batch->count; ++i)
+			tile_buffer__release(batch->tiles[i].buffer);
+	free((void*)batch->lanes);
+	free((void*)batch->order);
+	free((void*)batch->tiles);
+	free((void*)batch->keys);
+	free((void*)batch);
+}
+
+/* Should be called with mutex locked, unlocks it */
+static void release(struct batch_t * batch)
+{
+	bool last = --batch->references == 0;
+
+	mtx_unlock(&batch->mutex);
+	if (last)
+	{
+		mtx_destroy(&batch->mutex);
+		destroy(batch);
+	}
+}
+
+/* Stores the tile and queues the lane for the next one */
+static void finish_tile(struct batch_lane_t * lane, struct tile_buffer_t * buffer)
+{
+	struct batch_t * batch = lane->batch;
+
+	mtx_lock(&batch->mutex);
+	batch->tiles[lane->index].buffer = buffer;
+	batch->order[batch->finished++] = lane->index;
+	resume(batch);
+	mtx_unlock(&batch->mutex);
+
+	// Other requests are served between tiles of the batch
+	executor__submit(batch->server->executor, &lane->task);
+}
+
+/* Runs on the thread of the request that has rendered the tile */
+static void notify_lane(struct inflight_waiter_t * waiter, struct tile_buffer_t * buffer)
+{
+	struct batch_lane_t * lane = (struct batch_lane_t *)((char *)waiter - offsetof(struct batch_lane_t, waiter));
+
+	// Waiting lane has given its admission back
+	lane->admitted = false;
+	finish_tile(lane, buffer);
+}
+
+/* Should be called with mutex locked */
+static bool take_admission(struct batch_lane_t * lane)
+{
+	struct batch_t * batch = lane->batch;
+
+	if (!lane->admitted)
+		lane->admitted = admission__enter(batch->server->admission, &batch->client) == ADMISSION_ADMITTED;
+	// The last lane goes on anyway, since the batch itself has been admitted
+	return lane->admitted || batch->running == 1;
+}
+
+/* Runs on the executor thread, renders a single tile and queues the lane again */
+static void run_lane(struct executor_task_t * task, bool stopping)
+{
+	struct batch_lane_t * lane = (struct batch_lane_t *) task;
+	struct batch_t * batch = lane->batch;
+	struct server_t * server = batch->server;
+	struct admission_client_t client = batch->client;
+	struct tile_render_cancel_t cancel;
+	struct tile_buffer_t * buffer;
+
+	mtx_lock(&batch->mutex);
+	if (stopping || batch->cancelled || batch->next == batch->count || !take_admission(lane))
+	{
+		// The rest tiles won't come from this lane, the reader has to see that
+		if (lane->admitted)
+			admission__leave(server->admission, &client);
+		if (--batch->running == 0)
+			resume(batch);
+		release(batch);
+		return;
+	}
+	lane->index = batch->next++;
+	mtx_unlock(&batch->mutex);
+
+	if (tile_render__get_cached(batch->server, &batch->keys[lane->index], &buffer))
+	{
+		finish_tile(lane, buffer);
+		return;
+	}
+	// Renders are dropped once the response is gone
+	cancel.is_cancelled = is_batch_cancelled;
+	cancel.arg = (void*)batch;
+	switch (tile_render__get_rendered(batch->server, &batch->keys[lane->index], &cancel, &lane->waiter, &buffer))
+	{
+	case TILE_RENDER_DONE:
+		finish_tile(lane, buffer);
+		break;
+	case TILE_RENDER_FAILED:
+		finish_tile(lane, NULL);
+		break;
+	default:
+		// Waiting lane doesn't hold a render context, so it leaves admission like single tiles do.
+		// It goes on once the tile is rendered by another request and may be running already
+		admission__leave(server->admission, &client);
+		break;
+	}
+}
+
+struct batch_t * batch__create(struct server_t * server, struct MHD_Connection * connection,
+	const struct tile_key_t * keys, int count, const struct admission_client_t * client)
+{
+	struct batch_t * batch;
+	int lane_count;
+
+	if (count < 1 || count > BATCH_MAX_TILES)
+		return NULL;
+	batch = (struct batch_t *) calloc(1, sizeof(struct batch_t));
+	if (batch == NULL)
+		return NULL;
+	batch->server = server;
+	batch->connection = connection;
+	batch->client = *client;
+	batch->count = count;
+	// No more lanes than render contexts, since each one holds a context while rendering
+	lane_count = (count < server->pool->size) ? count : server->pool->size;
+	batch->keys = (struct tile_key_t *) malloc(sizeof(struct tile_key_t) * (size_t)count);
+	batch->tiles = (struct batch_tile_t *) calloc((size_t)count, sizeof(struct batch_tile_t));
+	batch->order = (int *) malloc(sizeof(int) * (size_t)count);
+	batch->lanes = (struct batch_lane_t *) calloc((size_t)lane_count, sizeof(struct batch_lane_t));
+	if (batch->keys == NULL || batch->tiles == NULL || batch->order == NULL || batch->lanes == NULL)
+	{
+		destroy(batch);
+		return NULL;
+	}
+	memcpy(batch->keys, keys, sizeof(struct tile_key_t) * (size_t)count);
+
+	if (mtx_init(&batch->mutex, mtx_plain) == thrd_error)
+	{
+		destroy(batch);
+		return NULL;
+	}
+	// The first lane takes the admission of the request, others are admitted on their own,
+	// so a batch renders no more tiles at once than the admission allows
+	batch->lane_count = 1;
+	while (batch->lane_count < lane_count
+		&& admission__enter(server->admission, client) == ADMISSION_ADMITTED)
+		++batch->lane_count;
+	batch->running = batch->lane_count;
+	batch->references = batch->lane_count + 1;
+	for (int i = 0; i < batch->lane_count; ++i)
+	{
+		batch->lanes[i].task.run = run_lane;
+		batch->lanes[i].waiter.notify = notify_lane;
+		batch->lanes[i].batch = batch;
+		batch->lanes[i].admitted = true;
+		executor__submit(server->executor, &batch->lanes[i].task);
+	}
+	return batch;
+}
+
+ssize_t batch__read(void * cls, uint64_t pos, char * buffer, size_t max)
+{
+	struct batch_t * batch = (struct batch_t *) cls;
+	struct batch_tile_t * tile;
+	struct tile_key_t * key;
+	size_t written = 0;
+	size_t size;
+	size_t part;
+	int index;
+
+	(void) pos; // records are sent sequentially
+
+	mtx_lock(&batch->mutex);
+	while (batch->sent < batch->count && written < max)
+	{
+		if (batch->sent == batch->finished)
+		{
+			// Send what is ready rather than holding it until the next tile
+			if (written != 0)
+				break;
+			if (batch->running == 0)
+			{
+				// Workers have been stopped before the rest tiles
+				mtx_unlock(&batch->mutex);
+				return MHD_CONTENT_READER_END_WITH_ERROR;
+			}
+			// Connection waits for the next tile without holding the MHD thread
+			batch->suspended = true;
+			executor__suspend(batch->server->executor, batch->connection);
+			mtx_unlock(&batch->mutex);
+			return 0;
+		}
+		index = batch->order[batch->sent];
+		tile = &batch->tiles[index];
+		size = (tile->buffer != NULL) ? tile->buffer->size : 0;
+		if (batch->offset == 0)
+		{
+			key = &batch->keys[index];
+			put_uint32(batch->header, (unsigned long)key->face);
+			put_uint32(batch->header + 4, (unsigned long)key->lod);
+			put_uint32(batch->header + 8, (unsigned long)key->x);
+			put_uint32(batch->header + 12, (unsigned long)key->y);
+			put_uint32(batch->header + 16, (unsigned long)size);
+		}
+		if (batch->offset < BATCH_RECORD_HEADER_SIZE)
+		{
+			part = BATCH_RECORD_HEADER_SIZE - batch->offset;
+			if (part > max - written)
+				part = max - written;
+			memcpy(buffer + written, batch->header + batch->offset, part);
+		}
+		else
+		{
+			part = BATCH_RECORD_HEADER_SIZE + size - batch->offset;
+			if (part > max - written)
+				part = max - written;
+			memcpy(buffer + written, tile_buffer__data(tile->buffer) + (batch->offset - BATCH_RECORD_HEADER_SIZE), part);
+		}
+		written += part;
+		batch->offset += part;
+		if (batch->offset == BATCH_RECORD_HEADER_SIZE + size)
+		{
+			// Sent tile data isn't needed anymore
+			tile_buffer__release(tile->buffer);
+			tile->buffer = NULL;
+			batch->offset = 0;
+			++batch->sent;
+		}
+	}
+	mtx_unlock(&batch->mutex);
+
+	if (written == 0)
+		return MHD_CONTENT_READER_END_OF_STREAM;
+	return (ssize_t) written;
+}
+
+void batch__free(void * cls)
+{
+	struct batch_t * batch = (struct batch_t *) cls;
+
+	// Tiles being rendered are abandoned unless other requests wait for them,
+	// lanes leave their admissions and the last one destroys the batch
+	mtx_lock(&batch->mutex);
+	batch->cancelled = true;
+	release(batch);
+}
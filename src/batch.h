@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "server.h"
+#include "tile_key.h"
+
+#include <microhttpd.h>
+#include <stdint.h>
+
+/* Maximum number of tiles in a single batch request */
+#define BATCH_MAX_TILES 256
+
+/* Size of a record header: face, lod, x, y and data size as little-endian 32-bit integers */
+#define BATCH_RECORD_HEADER_SIZE 20
+
+/**
+ * Batch of tiles rendered in parallel on the render executor and streamed back in order of completion.
+ * Every tile is sent as a record header followed by encoded tile data,
+ * failed tiles have zero data size.
+ */
+struct batch_t;
+
+/**
+ * Creates the batch and starts rendering its tiles.
+ *
+ * @param[in] server      The server.
+ * @param[in] connection  Connection of the request, it's suspended while no tile is ready.
+ * @param[in] keys        Tile keys, copied.
+ * @param[in] count       Number of keys in range 1..BATCH_MAX_TILES.
+ * @param[in] client      Admitted client, the batch takes over its admission on success.
+ * @return The batch or NULL on failure.
+ */
+struct batch_t * batch__create(struct server_t * server, struct MHD_Connection * connection,
+	const struct tile_key_t * keys, int count, const struct admission_client_t * client);
+
+/**
+ * MHD content reader callback. Suspends the connection until a tile is ready.
+ */
+ssize_t batch__read(void * cls, uint64_t pos, char * buffer, size_t max);
+
+/**
+ * MHD content reader free callback. Stops rendering of the rest tiles without waiting for them,
+ * the batch is destroyed once its running tiles are done.
+ */
+void batch__free(void * cls);
+
+#endif
@@ -0,0 +1,98 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "cube.h"
+
+#include <math.h>
+
+/*
+Face texture coordinates sc, tc in range -1..1 to direction and back,
+as in cube map lookup: face is chosen by the major axis of the direction.
+*/
+static void face_to_direction(int face, double sc, double tc, double direction[3])
+{
+	switch (face)
+	{
+	case 0: // +X
+		direction[0] = 1.0; direction[1] = -tc; direction[2] = -sc;
+		break;
+	case 1: // -X
+		direction[0] = -1.0; direction[1] = -tc; direction[2] = sc;
+		break;
+	case 2: // +Y
+		direction[0] = sc; direction[1] = 1.0; direction[2] = tc;
+		break;
+	case 3: // -Y
+		direction[0] = sc; direction[1] = -1.0; direction[2] = -tc;
+		break;
+	case 4: // +Z
+		direction[0] = sc; direction[1] = -tc; direction[2] = 1.0;
+		break;
+	default: // -Z
+		direction[0] = -sc; direction[1] = -tc; direction[2] = -1.0;
+		break;
+	}
+}
+
+static void direction_to_face(const double direction[3], int * face, double * sc, double * tc)
+{
+	double ax = fabs(direction[0]);
+	double ay = fabs(direction[1]);
+	double az = fabs(direction[2]);
+
+	if (ax >= ay && ax >= az)
+	{
+		*face = (direction[0] > 0.0) ? 0 : 1;
+		*sc = ((direction[0] > 0.0) ? -direction[2] : direction[2]) / ax;
+		*tc = -direction[1] / ax;
+	}
+	else if (ay >= az)
+	{
+		*face = (direction[1] > 0.0) ? 2 : 3;
+		*sc = direction[0] / ay;
+		*tc = ((direction[1] > 0.0) ? direction[2] : -direction[2]) / ay;
+	}
+	else
+	{
+		*face = (direction[2] > 0.0) ? 4 : 5;
+		*sc = ((direction[2] > 0.0) ? direction[0] : -direction[0]) / az;
+		*tc = -direction[1] / az;
+	}
+}
+
+static int to_tile(double coordinate, int tiles_per_side)
+{
+	int tile = (int)floor((coordinate + 1.0) * 0.5 * (double)tiles_per_side);
+
+	if (tile < 0)
+		return 0;
+	if (tile >= tiles_per_side)
+		return tiles_per_side - 1;
+	return tile;
+}
+
+void cube__get_neighbor(int face, int lod, int x, int y, int dx, int dy,
+	int * neighbor_face, int * neighbor_x, int * neighbor_y)
+{
+	int tiles_per_side = 1 << lod;
+	double direction[3];
+	double sc, tc;
+
+	if (x + dx >= 0 && x + dx < tiles_per_side && y + dy >= 0 && y + dy < tiles_per_side)
+	{
+		*neighbor_face = face;
+		*neighbor_x = x + dx;
+		*neighbor_y = y + dy;
+		return;
+	}
+	// Center of the neighbor lies on the face plane extended beyond the edge,
+	// its projection onto the cube falls into the first tile of the adjacent face
+	sc = ((double)(x + dx) + 0.5) * 2.0 / (double)tiles_per_side - 1.0;
+	tc = ((double)(y + dy) + 0.5) * 2.0 / (double)tiles_per_side - 1.0;
+	face_to_direction(face, sc, tc, direction);
+	direction_to_face(direction, neighbor_face, &sc, &tc);
+	*neighbor_x = to_tile(sc, tiles_per_side);
+	*neighbor_y = to_tile(tc, tiles_per_side);
+}
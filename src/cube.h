@@ -0,0 +1,31 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __CUBE_H__
+#define __CUBE_H__
+
+/**
+ * Tile addressing on the mapped cube.
+ * Faces follow the cube map convention: +X, -X, +Y, -Y, +Z, -Z,
+ * tile x and y go along the face s and t texture coordinates.
+ */
+
+/**
+ * Finds the tile next to the given one, crossing over to the adjacent face at face edges.
+ *
+ * @param[in] face   Tile face.
+ * @param[in] lod    Tile lod.
+ * @param[in] x      Tile x.
+ * @param[in] y      Tile y.
+ * @param[in] dx     Step along x: -1, 0 or 1.
+ * @param[in] dy     Step along y: -1, 0 or 1.
+ * @param[out] neighbor_face  Face of the neighbor.
+ * @param[out] neighbor_x     X of the neighbor.
+ * @param[out] neighbor_y     Y of the neighbor.
+ */
+void cube__get_neighbor(int face, int lod, int x, int y, int dx, int dy,
+	int * neighbor_face, int * neighbor_x, int * neighbor_y);
+
+#endif
@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "executor.h"
+
+#include "tinycthread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+struct executor_t {
+	struct executor_task_t * head; // FIFO of queued tasks
+	struct executor_task_t * tail;
+	int suspended; // number of suspended connections
+	bool stopping;
+	mtx_t mutex;
+	cnd_t condition; // signaled on new task or stop
+	cnd_t resumed; // signaled when the last suspended connection is resumed
+	thrd_t * threads;
+	int thread_count;
+};
+
+/* Should be called with mutex locked */
+static struct executor_task_t * pop(struct executor_t * executor)
+{
+	struct executor_task_t * task = executor->head;
+
+	executor->head = task->next;
+	if (executor->head == NULL)
+		executor->tail = NULL;
+	task->next = NULL;
+	return task;
+}
+
+static int thread_func(void * arg)
+{
+	struct executor_t * executor = (struct executor_t *) arg;
+	struct executor_task_t * task;
+
+	for (;;)
+	{
+		mtx_lock(&executor->mutex);
+		while (!executor->stopping && executor->head == NULL)
+			cnd_wait(&executor->condition, &executor->mutex);
+		if (executor->stopping)
+		{
+			mtx_unlock(&executor->mutex);
+			break;
+		}
+		task = pop(executor);
+		mtx_unlock(&executor->mutex);
+
+		task->run(task, false);
+	}
+	return 0;
+}
+
+struct executor_t * executor__create(int thread_count)
+{
+	struct executor_t * executor;
+
+	if (thread_count < 1)
+		return NULL;
+	executor = (struct executor_t *) calloc(1, sizeof(struct executor_t));
+	if (executor == NULL)
+		return NULL;
+	executor->threads = (thrd_t *) malloc(sizeof(thrd_t) * (size_t)thread_count);
+	if (executor->threads == NULL)
+	{
+		free((void*)executor);
+		return NULL;
+	}
+	if (mtx_init(&executor->mutex, mtx_plain) == thrd_error)
+	{
+		free((void*)executor->threads);
+		free((void*)executor);
+		return NULL;
+	}
+	if (cnd_init(&executor->condition) == thrd_error)
+	{
+		mtx_destroy(&executor->mutex);
+		free((void*)executor->threads);
+		free((void*)executor);
+		return NULL;
+	}
+	if (cnd_init(&executor->resumed) == thrd_error)
+	{
+		cnd_destroy(&executor->condition);
+		mtx_destroy(&executor->mutex);
+		free((void*)executor->threads);
+		free((void*)executor);
+		return NULL;
+	}
+	for (int i = 0; i < thread_count; ++i)
+	{
+		if (thrd_create(&executor->threads[i], thread_func, (void*)executor) != thrd_success)
+		{
+			printf("Executor thread creation has failed\n");
+			break;
+		}
+		++executor->thread_count;
+	}
+	if (executor->thread_count == 0)
+	{
+		executor__destroy(executor);
+		return NULL;
+	}
+	return executor;
+}
+
+void executor__stop(struct executor_t * executor)
+{
+	struct executor_task_t * task;
+
+	mtx_lock(&executor->mutex);
+	if (executor->stopping)
+	{
+		mtx_unlock(&executor->mutex);
+		return;
+	}
+	executor->stopping = true;
+	cnd_broadcast(&executor->condition);
+	mtx_unlock(&executor->mutex);
+	for (int i = 0; i < executor->thread_count; ++i)
+		thrd_join(executor->threads[i], NULL);
+	executor->thread_count = 0;
+
+	// Tasks left in the queue are dropped, their connections get resumed
+	for (;;)
+	{
+		mtx_lock(&executor->mutex);
+		task = (executor->head != NULL) ? pop(executor) : NULL;
+		mtx_unlock(&executor->mutex);
+		if (task == NULL)
+			break;
+		task->run(task, true);
+	}
+
+	// Batches resume their connections once their workers see the stop
+	mtx_lock(&executor->mutex);
+	while (executor->suspended != 0)
+		cnd_wait(&executor->resumed, &executor->mutex);
+	mtx_unlock(&executor->mutex);
+}
+
+void executor__destroy(struct executor_t * executor)
+{
+	if (executor == NULL)
+		return;
+	executor__stop(executor);
+	cnd_destroy(&executor->resumed);
+	cnd_destroy(&executor->condition);
+	mtx_destroy(&executor->mutex);
+	free((void*)executor->threads);
+	free((void*)executor);
+}
+
+void executor__submit(struct executor_t * executor, struct executor_task_t * task)
+{
+	task->next = NULL;
+	mtx_lock(&executor->mutex);
+	if (executor->stopping)
+	{
+		mtx_unlock(&executor->mutex);
+		task->run(task, true);
+		return;
+	}
+	if (executor->tail != NULL)
+		executor->tail->next = task;
+	else
+		executor->head = task;
+	executor->tail = task;
+	cnd_signal(&executor->condition);
+	mtx_unlock(&executor->mutex);
+}
+
+bool executor__is_stopping(struct executor_t * executor)
+{
+	bool stopping;
+
+	mtx_lock(&executor->mutex);
+	stopping = executor->stopping;
+	mtx_unlock(&executor->mutex);
+	return stopping;
+}
+
+void executor__suspend(struct executor_t * executor, struct MHD_Connection * connection)
+{
+	mtx_lock(&executor->mutex);
+	++executor->suspended;
+	mtx_unlock(&executor->mutex);
+	MHD_suspend_connection(connection);
+}
+
+void executor__resume(struct executor_t * executor, struct MHD_Connection * connection)
+{
+	MHD_resume_connection(connection);
+	mtx_lock(&executor->mutex);
+	if (--executor->suspended == 0)
+		cnd_broadcast(&executor->resumed);
+	mtx_unlock(&executor->mutex);
+}
@@ -0,0 +1,50 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __EXECUTOR_H__
+#define __EXECUTOR_H__
+
+#include <microhttpd.h>
+#include <stdbool.h>
+
+/**
+ * Render executor: threads running tile renders off the MHD threads.
+ * Connection of a request is suspended while its render runs and resumed once it's done,
+ * so MHD threads keep serving other connections meanwhile.
+ */
+struct executor_t;
+
+/**
+ * Task to be embedded into a request job.
+ * Task run with stopping flag set has to finish at once and resume its connection.
+ */
+struct executor_task_t {
+	void (*run)(struct executor_task_t * task, bool stopping);
+	struct executor_task_t * next;
+};
+
+struct executor_t * executor__create(int thread_count);
+
+/**
+ * Stops the threads, tasks still queued run with stopping flag set.
+ * Waits until every suspended connection is resumed, so the daemon can be stopped then.
+ */
+void executor__stop(struct executor_t * executor);
+void executor__destroy(struct executor_t * executor);
+
+/**
+ * Queues the task, it runs on the caller thread with stopping flag when the executor is stopped.
+ */
+void executor__submit(struct executor_t * executor, struct executor_task_t * task);
+
+bool executor__is_stopping(struct executor_t * executor);
+
+/**
+ * Suspends or resumes the connection keeping count of suspended connections.
+ */
+void executor__suspend(struct executor_t * executor, struct MHD_Connection * connection);
+void executor__resume(struct executor_t * executor, struct MHD_Connection * connection);
+
+#endif
@@ -0,0 +1,372 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#if !defined(_WIN32) && !defined(_XOPEN_SOURCE)
+# define _XOPEN_SOURCE 500 // dup, fstat
+#endif
+
+#include "file_cache.h"
+#include "lru_table.h"
+
+#include "tinycthread.h"
+
+#include <zlib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+# include <io.h>
+#else
+# include <unistd.h>
+# define O_BINARY 0
+#endif
+
+#define FILE_CACHE_BUCKET_COUNT 256
+#define FILE_CACHE_REVALIDATE_PERIOD 1 // seconds
+#define FILE_CACHE_MAX_GZIP_FILE_SIZE (16 * 1024 * 1024)
+#define FILE_CACHE_MAX_GZIP_BYTES (64 * 1024 * 1024)
+
+struct file_cache_entry_t {
+	struct lru_node_t node; // first, entries are cast from nodes
+	char * path;
+	int fd;              // -1 when there is no such file
+	size_t size;
+	time_t mtime;
+	time_t validated;
+	struct tile_buffer_t * gzip; // compressed contents, NULL until requested
+	bool gzip_failed;
+};
+
+struct file_cache_t {
+	mtx_t mutex;
+	struct lru_table_t table;
+	struct tile_buffer_pool_t * buffers;
+	int count;
+	int capacity;
+	size_t gzip_bytes;
+};
+
+static unsigned int hash_path(const char * path)
+{
+	unsigned int hash = 2166136261u;
+	while (*path != '\0')
+	{
+		hash ^= (unsigned char) *path++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static bool match_path(const struct lru_node_t * node, const void * path)
+{
+	return strcmp(((const struct file_cache_entry_t *) node)->path, (const char *) path) == 0;
+}
+
+static struct file_cache_entry_t * find_entry(struct file_cache_t * cache, const char * path, unsigned int hash)
+{
+	return (struct file_cache_entry_t *) lru_table__find(&cache->table, hash, match_path, path);
+}
+
+static void remove_entry(struct file_cache_t * cache, struct file_cache_entry_t * entry)
+{
+	lru_table__remove(&cache->table, &entry->node);
+	--cache->count;
+	if (entry->gzip != NULL)
+		cache->gzip_bytes -= tile_buffer__footprint(entry->gzip);
+	if (entry->fd >= 0)
+		close(entry->fd);
+	// Responses still sending the contents keep them alive
+	tile_buffer__release(entry->gzip);
+	free((void*)entry->path);
+	free((void*)entry);
+}
+
+/* Opens regular file and fills its stat results */
+static bool open_file(const char * path, int * fd, size_t * size, time_t * mtime)
+{
+	struct stat info;
+
+	*fd = open(path, O_RDONLY | O_BINARY);
+	if (*fd < 0)
+		return false;
+	if (fstat(*fd, &info) != 0 || !S_ISREG(info.st_mode))
+	{
+		close(*fd);
+		return false;
+	}
+	*size = (size_t) info.st_size;
+	*mtime = info.st_mtime;
+	return true;
+}
+
+struct file_cache_t * file_cache__create(int capacity, struct tile_buffer_pool_t * buffers)
+{
+	struct file_cache_t * cache;
+
+	cache = (struct file_cache_t *) calloc(1, sizeof(struct file_cache_t));
+	if (cache == NULL)
+		return NULL;
+	cache->capacity = (capacity > 0) ? capacity : 1;
+	cache->buffers = buffers;
+	if (!lru_table__init(&cache->table, FILE_CACHE_BUCKET_COUNT))
+	{
+		free((void*)cache);
+		return NULL;
+	}
+	if (mtx_init(&cache->mutex, mtx_plain) == thrd_error)
+	{
+		lru_table__free(&cache->table);
+		free((void*)cache);
+		return NULL;
+	}
+	return cache;
+}
+
+void file_cache__destroy(struct file_cache_t * cache)
+{
+	if (cache == NULL)
+		return;
+	while (lru_table__oldest(&cache->table) != NULL)
+		remove_entry(cache, (struct file_cache_entry_t *) lru_table__oldest(&cache->table));
+	mtx_destroy(&cache->mutex);
+	lru_table__free(&cache->table);
+	free((void*)cache);
+}
+
+bool file_cache__open(struct file_cache_t * cache, const char * path, int * fd, size_t * size, time_t * mtime)
+{
+	struct file_cache_entry_t * entry;
+	struct stat info;
+	unsigned int hash;
+	time_t now;
+	size_t path_length;
+
+	hash = hash_path(path);
+	now = time(NULL);
+
+	mtx_lock(&cache->mutex);
+	entry = find_entry(cache, path, hash);
+	if (entry != NULL && now - entry->validated >= FILE_CACHE_REVALIDATE_PERIOD)
+	{
+		// Drop the entry if file has been changed, removed or created
+		bool exists = stat(path, &info) == 0;
+		if (exists != (entry->fd >= 0)
+			|| (exists && ((size_t) info.st_size != entry->size || info.st_mtime != entry->mtime)))
+		{
+			remove_entry(cache, entry);
+			entry = NULL;
+		}
+		else
+			entry->validated = now;
+	}
+	if (entry != NULL)
+	{
+		lru_table__touch(&cache->table, &entry->node);
+		if (entry->fd < 0)
+		{
+			mtx_unlock(&cache->mutex);
+			return false;
+		}
+		// Descriptor duplicates share the file but MHD reads with explicit offsets
+		*fd = dup(entry->fd);
+		*size = entry->size;
+		*mtime = entry->mtime;
+		mtx_unlock(&cache->mutex);
+		return *fd >= 0;
+	}
+	mtx_unlock(&cache->mutex);
+
+	// Open the file outside of the lock
+	entry = (struct file_cache_entry_t *) calloc(1, sizeof(struct file_cache_entry_t));
+	if (entry == NULL)
+		return open_file(path, fd, size, mtime);
+	path_length = strlen(path);
+	entry->path = (char *) malloc(path_length + 1);
+	if (entry->path == NULL)
+	{
+		free((void*)entry);
+		return open_file(path, fd, size, mtime);
+	}
+	memcpy(entry->path, path, path_length + 1);
+	entry->node.hash = hash;
+	entry->validated = now;
+	if (open_file(path, &entry->fd, &entry->size, &entry->mtime))
+	{
+		*fd = dup(entry->fd);
+		*size = entry->size;
+		*mtime = entry->mtime;
+	}
+	else
+	{
+		// Remember that there is no such file
+		entry->fd = -1;
+		*fd = -1;
+	}
+
+	mtx_lock(&cache->mutex);
+	if (find_entry(cache, path, hash) != NULL)
+	{
+		// Another request has opened the same file meanwhile
+		mtx_unlock(&cache->mutex);
+		if (entry->fd >= 0)
+			close(entry->fd);
+		free((void*)entry->path);
+		free((void*)entry);
+		return *fd >= 0;
+	}
+	if (cache->count == cache->capacity)
+		remove_entry(cache, (struct file_cache_entry_t *) lru_table__oldest(&cache->table));
+	lru_table__insert(&cache->table, &entry->node);
+	++cache->count;
+	mtx_unlock(&cache->mutex);
+
+	return *fd >= 0;
+}
+
+/* Compresses the whole file with gzip header */
+static bool compress_file(const char * path, size_t size, unsigned char ** data, size_t * compressed_size)
+{
+	unsigned char * contents;
+	unsigned char * buffer;
+	z_stream stream;
+	FILE * file;
+	size_t bound;
+	bool result;
+
+	contents = (unsigned char *) malloc(size);
+	if (contents == NULL)
+		return false;
+	file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		free((void*)contents);
+		return false;
+	}
+	result = fread(contents, 1, size, file) == size;
+	fclose(file);
+	if (!result)
+	{
+		free((void*)contents);
+		return false;
+	}
+
+	memset(&stream, 0, sizeof(stream));
+	// 16 added to window bits makes zlib write gzip header
+	if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		free((void*)contents);
+		return false;
+	}
+	bound = (size_t) deflateBound(&stream, (uLong) size);
+	buffer = (unsigned char *) malloc(bound);
+	if (buffer == NULL)
+	{
+		deflateEnd(&stream);
+		free((void*)contents);
+		return false;
+	}
+	stream.next_in = contents;
+	stream.avail_in = (uInt) size;
+	stream.next_out = buffer;
+	stream.avail_out = (uInt) bound;
+	result = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+	*compressed_size = (size_t) stream.total_out;
+	deflateEnd(&stream);
+	free((void*)contents);
+
+	if (!result)
+	{
+		free((void*)buffer);
+		return false;
+	}
+	*data = buffer;
+	return true;
+}
+
+bool file_cache__get_gzip(struct file_cache_t * cache, const char * path, struct tile_buffer_t ** buffer)
+{
+	struct file_cache_entry_t * entry;
+	struct tile_buffer_t * gzip;
+	unsigned char * compressed;
+	size_t compressed_size, file_size;
+	time_t mtime;
+	unsigned int hash;
+
+	hash = hash_path(path);
+
+	mtx_lock(&cache->mutex);
+	entry = find_entry(cache, path, hash);
+	if (entry == NULL || entry->fd < 0 || entry->gzip_failed
+		|| entry->size == 0 || entry->size > FILE_CACHE_MAX_GZIP_FILE_SIZE)
+	{
+		mtx_unlock(&cache->mutex);
+		return false;
+	}
+	if (entry->gzip == NULL && cache->gzip_bytes >= FILE_CACHE_MAX_GZIP_BYTES)
+	{
+		mtx_unlock(&cache->mutex);
+		return false;
+	}
+	if (entry->gzip == NULL)
+	{
+		file_size = entry->size;
+		mtime = entry->mtime;
+		mtx_unlock(&cache->mutex);
+
+		// Compress outside of the lock, only the first request pays for that
+		if (!compress_file(path, file_size, &compressed, &compressed_size))
+		{
+			compressed = NULL;
+			compressed_size = 0;
+		}
+		else if (compressed_size + compressed_size / 8 >= file_size)
+		{
+			// Not worth it
+			free((void*)compressed);
+			compressed = NULL;
+			compressed_size = 0;
+		}
+		gzip = NULL;
+		if (compressed != NULL)
+		{
+			gzip = tile_buffer__copy(cache->buffers, compressed, compressed_size);
+			free((void*)compressed);
+			if (gzip == NULL)
+			{
+				// Out of memory now doesn't mean the file can't be compressed later
+				return false;
+			}
+		}
+
+		mtx_lock(&cache->mutex);
+		entry = find_entry(cache, path, hash);
+		if (entry == NULL || entry->mtime != mtime || entry->size != file_size || entry->gzip != NULL)
+		{
+			// Entry has changed meanwhile
+			mtx_unlock(&cache->mutex);
+			tile_buffer__release(gzip);
+			return false;
+		}
+		if (gzip == NULL)
+		{
+			entry->gzip_failed = true;
+			mtx_unlock(&cache->mutex);
+			return false;
+		}
+		entry->gzip = gzip;
+		cache->gzip_bytes += tile_buffer__footprint(gzip);
+	}
+
+	tile_buffer__retain(entry->gzip);
+	*buffer = entry->gzip;
+	mtx_unlock(&cache->mutex);
+
+	return true;
+}
@@ -0,0 +1,56 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __FILE_CACHE_H__
+#define __FILE_CACHE_H__
+
+#include "tile_buffer.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/**
+ * Cache of open file descriptors and stat results keyed by path.
+ * Missing files are cached too, so probing for precompressed siblings is cheap.
+ * Entries are revalidated with stat once per second, so changed files are reopened.
+ */
+struct file_cache_t;
+
+/**
+ * Creates the cache.
+ *
+ * @param[in] capacity  Max number of cached paths.
+ * @param[in] buffers   Pool of buffers compressed contents are kept in.
+ * @return The cache or NULL on failure.
+ */
+struct file_cache_t * file_cache__create(int capacity, struct tile_buffer_pool_t * buffers);
+void file_cache__destroy(struct file_cache_t * cache);
+
+/**
+ * Returns a new descriptor of the regular file, ready to be handed to MHD.
+ *
+ * @param[in] cache   The cache.
+ * @param[in] path    File path.
+ * @param[out] fd     Descriptor owned by the caller.
+ * @param[out] size   File size.
+ * @param[out] mtime  File modification time.
+ * @return True on success and false if there is no such regular file.
+ */
+bool file_cache__open(struct file_cache_t * cache, const char * path, int * fd, size_t * size, time_t * mtime);
+
+/**
+ * Returns gzip compressed contents of the file opened before.
+ * The file is compressed once and the result is kept in memory with the entry,
+ * every request shares it by reference.
+ *
+ * @param[in] cache    The cache.
+ * @param[in] path     File path.
+ * @param[out] buffer  Reference to compressed contents, released by the caller.
+ * @return True on success and false if the file doesn't worth or can't be compressed.
+ */
+bool file_cache__get_gzip(struct file_cache_t * cache, const char * path, struct tile_buffer_t ** buffer);
+
+#endif
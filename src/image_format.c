@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "image_format.h"
+
+#include <string.h>
+
+bool image_format__parse(const char * name, enum image_format_t * format)
+{
+	if (strcmp(name, "png") == 0 ||
+		strcmp(name, "PNG") == 0)
+	{
+		*format = FORMAT_PNG;
+		return true;
+	}
+	if (strcmp(name, "jpg") == 0 || strcmp(name, "jpeg") == 0 ||
+		strcmp(name, "JPG") == 0 || strcmp(name, "JPEG") == 0)
+	{
+		*format = FORMAT_JPEG;
+		return true;
+	}
+	if (strcmp(name, "raw") == 0 ||
+		strcmp(name, "RAW") == 0)
+	{
+		*format = FORMAT_RAW;
+		return true;
+	}
+	if (strcmp(name, "dxt1") == 0 || strcmp(name, "bc1") == 0 ||
+		strcmp(name, "DXT1") == 0 || strcmp(name, "BC1") == 0)
+	{
+		*format = FORMAT_DXT1;
+		return true;
+	}
+#if defined(HAVE_WEBP)
+	if (strcmp(name, "webp") == 0 ||
+		strcmp(name, "WEBP") == 0)
+	{
+		*format = FORMAT_WEBP;
+		return true;
+	}
+#endif
+	return false;
+}
+
+const char * image_format__get_name(enum image_format_t format)
+{
+	switch (format)
+	{
+	case FORMAT_JPEG:
+		return "jpeg";
+	case FORMAT_PNG:
+		return "png";
+	case FORMAT_WEBP:
+		return "webp";
+	case FORMAT_RAW:
+		return "raw";
+	case FORMAT_DXT1:
+		return "dxt1";
+	default:
+		return NULL;
+	}
+}
@@ -6,12 +6,32 @@
 #ifndef __IMAGE_FORMAT_H__
 #define __IMAGE_FORMAT_H__
 
+#include <stdbool.h>
+
 /**
  * Describes image format
  */
 enum image_format_t {
 	FORMAT_JPEG,
-	FORMAT_PNG
+	FORMAT_PNG,
+	FORMAT_WEBP,
+	FORMAT_RAW, // rendered pixels with a header, for texture upload without decoding
+	FORMAT_DXT1 // DXT1 texture blocks with a header
 };
 
+/**
+ * Parses image format name like "jpeg", "png", "webp", "raw" or "dxt1".
+ * WebP is known only when the server is built with it.
+ *
+ * @param[in] name     Format name.
+ * @param[out] format  Parsed format.
+ * @return True on success and false if the name is unknown.
+ */
+bool image_format__parse(const char * name, enum image_format_t * format);
+
+/**
+ * Returns canonical format name or NULL for unknown format.
+ */
+const char * image_format__get_name(enum image_format_t format);
+
 #endif
\ No newline at end of file
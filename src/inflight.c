@@ -0,0 +1,177 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "inflight.h"
+
+#include "tinycthread.h"
+
+#include <stdlib.h>
+
+#define INFLIGHT_BUCKET_COUNT 256
+
+struct inflight_entry_t {
+	struct tile_key_t key;
+	unsigned int hash;
+	struct inflight_waiter_t * waiters;
+	struct inflight_entry_t * chain_next;
+};
+
+struct inflight_table_t {
+	mtx_t mutex;
+	struct inflight_entry_t * buckets[INFLIGHT_BUCKET_COUNT];
+	unsigned long long coalesced;
+};
+
+static struct inflight_entry_t ** find_slot(struct inflight_table_t * table, const struct tile_key_t * key, unsigned int hash)
+{
+	struct inflight_entry_t ** slot = &table->buckets[hash % INFLIGHT_BUCKET_COUNT];
+	while (*slot != NULL)
+	{
+		if ((*slot)->hash == hash && tile_key__equal(&(*slot)->key, key))
+			break;
+		slot = &(*slot)->chain_next;
+	}
+	return slot;
+}
+
+/* Should be called with table mutex locked */
+static struct inflight_entry_t * insert_entry(struct inflight_entry_t ** slot, const struct tile_key_t * key, unsigned int hash)
+{
+	struct inflight_entry_t * entry;
+
+	entry = (struct inflight_entry_t *) calloc(1, sizeof(struct inflight_entry_t));
+	if (entry == NULL)
+		return NULL; // render without coalescing
+	entry->key = *key;
+	entry->hash = hash;
+	*slot = entry;
+	return entry;
+}
+
+struct inflight_table_t * inflight_table__create(void)
+{
+	struct inflight_table_t * table;
+
+	table = (struct inflight_table_t *) calloc(1, sizeof(struct inflight_table_t));
+	if (table == NULL)
+		return NULL;
+	if (mtx_init(&table->mutex, mtx_plain) == thrd_error)
+	{
+		free((void*)table);
+		return NULL;
+	}
+	return table;
+}
+
+void inflight_table__destroy(struct inflight_table_t * table)
+{
+	if (table == NULL)
+		return;
+	// All requests have been finished by the time daemon is stopped
+	mtx_destroy(&table->mutex);
+	free((void*)table);
+}
+
+bool inflight_table__begin(struct inflight_table_t * table, const struct tile_key_t * key,
+	struct inflight_entry_t ** entry, struct inflight_waiter_t * waiter)
+{
+	struct inflight_entry_t ** slot;
+	struct inflight_entry_t * found;
+	unsigned int hash;
+
+	hash = tile_key__hash(key);
+
+	mtx_lock(&table->mutex);
+	slot = find_slot(table, key, hash);
+	found = *slot;
+	if (found == NULL)
+	{
+		// Become the leader
+		*entry = insert_entry(slot, key, hash);
+		mtx_unlock(&table->mutex);
+		return true;
+	}
+
+	// Wait for the leader without holding the thread
+	waiter->next = found->waiters;
+	found->waiters = waiter;
+	++table->coalesced;
+	mtx_unlock(&table->mutex);
+
+	*entry = NULL;
+	return false;
+}
+
+bool inflight_table__try_begin(struct inflight_table_t * table, const struct tile_key_t * key,
+	struct inflight_entry_t ** entry)
+{
+	struct inflight_entry_t ** slot;
+	unsigned int hash;
+
+	hash = tile_key__hash(key);
+	*entry = NULL;
+
+	mtx_lock(&table->mutex);
+	slot = find_slot(table, key, hash);
+	if (*slot != NULL)
+	{
+		mtx_unlock(&table->mutex);
+		return false;
+	}
+	*entry = insert_entry(slot, key, hash);
+	mtx_unlock(&table->mutex);
+	return true;
+}
+
+void inflight_table__finish(struct inflight_table_t * table, struct inflight_entry_t * entry,
+	struct tile_buffer_t * buffer)
+{
+	struct inflight_waiter_t * waiter;
+	struct inflight_waiter_t * next;
+
+	if (entry == NULL)
+		return;
+
+	mtx_lock(&table->mutex);
+	// Later requests go to the cache, not to this entry
+	*find_slot(table, &entry->key, entry->hash) = entry->chain_next;
+	waiter = entry->waiters;
+	mtx_unlock(&table->mutex);
+	free((void*)entry);
+
+	// Notified job may be freed right away, so the next waiter is taken first
+	for (; waiter != NULL; waiter = next)
+	{
+		next = waiter->next;
+		if (buffer != NULL)
+			tile_buffer__retain(buffer);
+		waiter->notify(waiter, buffer);
+	}
+}
+
+bool inflight_table__try_abandon(struct inflight_table_t * table, struct inflight_entry_t * entry)
+{
+	mtx_lock(&table->mutex);
+	if (entry->waiters != NULL)
+	{
+		mtx_unlock(&table->mutex);
+		return false;
+	}
+	*find_slot(table, &entry->key, entry->hash) = entry->chain_next;
+	mtx_unlock(&table->mutex);
+	free((void*)entry);
+	return true;
+}
+
+unsigned long long inflight_table__get_coalesced(struct inflight_table_t * table)
+{
+	unsigned long long coalesced;
+
+	mtx_lock(&table->mutex);
+	coalesced = table->coalesced;
+	mtx_unlock(&table->mutex);
+
+	return coalesced;
+}
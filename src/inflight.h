@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __INFLIGHT_H__
+#define __INFLIGHT_H__
+
+#include "tile_key.h"
+#include "tile_buffer.h"
+
+#include <stddef.h>
+
+/**
+ * Table of tiles being rendered right now.
+ * Only the first request for a tile renders it, concurrent duplicates
+ * register waiters and share its encoded result without holding a thread.
+ */
+struct inflight_table_t;
+struct inflight_entry_t;
+
+/**
+ * Request waiting for the tile rendered by another request, to be embedded into a request job
+ */
+struct inflight_waiter_t {
+	/* Called on the leader thread once the tile is done. Buffer is NULL when the leader has failed,
+	   otherwise a reference is taken for the waiter. */
+	void (*notify)(struct inflight_waiter_t * waiter, struct tile_buffer_t * buffer);
+	struct inflight_waiter_t * next;
+};
+
+struct inflight_table_t * inflight_table__create(void);
+void inflight_table__destroy(struct inflight_table_t * table);
+
+/**
+ * Joins the tile render.
+ * The follower waiter may be notified before this function returns,
+ * so the follower job belongs to the notification from then on.
+ *
+ * @param[in] table   The table.
+ * @param[in] key     Tile key.
+ * @param[out] entry  Set for the leader, who has to call inflight_table__finish.
+ * @param[in] waiter  Notified with the leader result when the caller is a follower.
+ * @return True if the caller is the leader and should render the tile,
+ *         false if the waiter has been registered.
+ */
+bool inflight_table__begin(struct inflight_table_t * table, const struct tile_key_t * key,
+	struct inflight_entry_t ** entry, struct inflight_waiter_t * waiter);
+
+/**
+ * Becomes the leader of the tile render unless the tile is being rendered already.
+ * Never waits, so it's used for background renders.
+ *
+ * @param[in] table   The table.
+ * @param[in] key     Tile key.
+ * @param[out] entry  Set for the leader, who has to call inflight_table__finish.
+ * @return True if the caller is the leader and false if the tile is in flight.
+ */
+bool inflight_table__try_begin(struct inflight_table_t * table, const struct tile_key_t * key,
+	struct inflight_entry_t ** entry);
+
+/**
+ * Gives up the leader render unless waiters wait for it.
+ * Abandoned entry is finished, so the leader doesn't call inflight_table__finish.
+ *
+ * @return True if the render has been abandoned and false if it's awaited.
+ */
+bool inflight_table__try_abandon(struct inflight_table_t * table, struct inflight_entry_t * entry);
+
+/**
+ * Notifies waiters with the leader result on the caller thread. NULL buffer means failure.
+ */
+void inflight_table__finish(struct inflight_table_t * table, struct inflight_entry_t * entry,
+	struct tile_buffer_t * buffer);
+
+/**
+ * Returns number of requests that have been served by another request render.
+ */
+unsigned long long inflight_table__get_coalesced(struct inflight_table_t * table);
+
+#endif
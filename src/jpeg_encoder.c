@@ -0,0 +1,216 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "jpeg_encoder.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jpeglib.h> // needs stdio.h
+#include <jerror.h>
+
+/* Initial output buffer size, it grows to fit the largest tile and stays so */
+static const size_t kInitialCapacity = 64 * 1024;
+
+struct jpeg_encoder_t {
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr error_manager;
+	struct jpeg_destination_mgr destination;
+	jmp_buf jump;
+	unsigned char * buffer;
+	size_t capacity;
+};
+
+static void error_exit(j_common_ptr cinfo)
+{
+	struct jpeg_encoder_t * encoder = (struct jpeg_encoder_t *) cinfo->client_data;
+
+	(*cinfo->err->output_message)(cinfo);
+	longjmp(encoder->jump, 1);
+}
+
+static void init_destination(j_compress_ptr cinfo)
+{
+	struct jpeg_encoder_t * encoder = (struct jpeg_encoder_t *) cinfo->client_data;
+
+	encoder->destination.next_output_byte = encoder->buffer;
+	encoder->destination.free_in_buffer = encoder->capacity;
+}
+
+static boolean empty_output_buffer(j_compress_ptr cinfo)
+{
+	struct jpeg_encoder_t * encoder = (struct jpeg_encoder_t *) cinfo->client_data;
+	size_t capacity = encoder->capacity * 2;
+	unsigned char * buffer;
+
+	// Whole buffer is full when libjpeg calls this
+	buffer = (unsigned char *) realloc(encoder->buffer, capacity);
+	if (buffer == NULL)
+		ERREXIT(cinfo, JERR_OUT_OF_MEMORY);
+	encoder->destination.next_output_byte = buffer + encoder->capacity;
+	encoder->destination.free_in_buffer = capacity - encoder->capacity;
+	encoder->buffer = buffer;
+	encoder->capacity = capacity;
+	return TRUE;
+}
+
+static void term_destination(j_compress_ptr cinfo)
+{
+	(void) cinfo;
+}
+
+static bool create_compressor(struct jpeg_encoder_t * encoder)
+{
+	encoder->cinfo.err = jpeg_std_error(&encoder->error_manager);
+	encoder->error_manager.error_exit = error_exit;
+	encoder->cinfo.client_data = (void*)encoder;
+	if (setjmp(encoder->jump))
+	{
+		jpeg_destroy_compress(&encoder->cinfo);
+		return false;
+	}
+	jpeg_create_compress(&encoder->cinfo);
+	return true;
+}
+
+struct jpeg_encoder_t * jpeg_encoder__create(void)
+{
+	struct jpeg_encoder_t * encoder;
+
+	encoder = (struct jpeg_encoder_t *) calloc(1, sizeof(struct jpeg_encoder_t));
+	if (encoder == NULL)
+		return NULL;
+	encoder->buffer = (unsigned char *) malloc(kInitialCapacity);
+	if (encoder->buffer == NULL)
+	{
+		free((void*)encoder);
+		return NULL;
+	}
+	encoder->capacity = kInitialCapacity;
+
+	if (!create_compressor(encoder))
+	{
+		free((void*)encoder->buffer);
+		free((void*)encoder);
+		return NULL;
+	}
+
+	encoder->destination.init_destination = init_destination;
+	encoder->destination.empty_output_buffer = empty_output_buffer;
+	encoder->destination.term_destination = term_destination;
+	encoder->cinfo.dest = &encoder->destination;
+
+	return encoder;
+}
+
+void jpeg_encoder__destroy(struct jpeg_encoder_t * encoder)
+{
+	if (encoder == NULL)
+		return;
+	jpeg_destroy_compress(&encoder->cinfo);
+	free((void*)encoder->buffer);
+	free((void*)encoder);
+}
+
+static void set_subsampling(j_compress_ptr cinfo, enum jpeg_subsampling_t subsampling)
+{
+	if (cinfo->num_components < 3)
+		return;
+	switch (subsampling)
+	{
+	case JPEG_SUBSAMPLING_444:
+		cinfo->comp_info[0].h_samp_factor = 1;
+		cinfo->comp_info[0].v_samp_factor = 1;
+		break;
+	case JPEG_SUBSAMPLING_422:
+		cinfo->comp_info[0].h_samp_factor = 2;
+		cinfo->comp_info[0].v_samp_factor = 1;
+		break;
+	case JPEG_SUBSAMPLING_420:
+	default:
+		cinfo->comp_info[0].h_samp_factor = 2;
+		cinfo->comp_info[0].v_samp_factor = 2;
+		break;
+	}
+	// Chroma components are always sampled once per block
+	for (int i = 1; i < cinfo->num_components; ++i)
+	{
+		cinfo->comp_info[i].h_samp_factor = 1;
+		cinfo->comp_info[i].v_samp_factor = 1;
+	}
+}
+
+bool jpeg_encoder__encode(struct jpeg_encoder_t * encoder, const unsigned char * pixels,
+	int width, int height, int bytes_per_pixel, int quality, enum jpeg_subsampling_t subsampling,
+	const unsigned char ** data, size_t * size)
+{
+	j_compress_ptr cinfo = &encoder->cinfo;
+	JSAMPROW rows[16];
+	size_t stride = (size_t)width * (size_t)bytes_per_pixel;
+
+	switch (bytes_per_pixel)
+	{
+	case 1:
+		cinfo->in_color_space = JCS_GRAYSCALE;
+		break;
+	case 3:
+		cinfo->in_color_space = JCS_RGB;
+		break;
+#if defined(JCS_EXTENSIONS)
+	case 4:
+		cinfo->in_color_space = JCS_EXT_RGBX;
+		break;
+#endif
+	default:
+		return false;
+	}
+
+	if (setjmp(encoder->jump))
+	{
+		// Compressor stays usable for the next tile
+		jpeg_abort_compress(cinfo);
+		return false;
+	}
+	cinfo->image_width = (JDIMENSION)width;
+	cinfo->image_height = (JDIMENSION)height;
+	cinfo->input_components = bytes_per_pixel;
+	jpeg_set_defaults(cinfo);
+	jpeg_set_quality(cinfo, quality, TRUE);
+	set_subsampling(cinfo, subsampling);
+
+	// Rows are fed in batches to cut per call overhead
+	jpeg_start_compress(cinfo, TRUE);
+	while (cinfo->next_scanline < cinfo->image_height)
+	{
+		JDIMENSION count = 0;
+		while (count < 16 && cinfo->next_scanline + count < cinfo->image_height)
+		{
+			rows[count] = (JSAMPROW)(pixels + (size_t)(cinfo->next_scanline + count) * stride);
+			++count;
+		}
+		jpeg_write_scanlines(cinfo, rows, count);
+	}
+	jpeg_finish_compress(cinfo);
+
+	// Caller copies the result out before the buffer is reused by the next tile
+	*data = encoder->buffer;
+	*size = encoder->capacity - encoder->destination.free_in_buffer;
+	return true;
+}
+
+bool jpeg_encoder__parse_subsampling(const char * name, enum jpeg_subsampling_t * subsampling)
+{
+	if (strcmp(name, "444") == 0)
+		*subsampling = JPEG_SUBSAMPLING_444;
+	else if (strcmp(name, "422") == 0)
+		*subsampling = JPEG_SUBSAMPLING_422;
+	else if (strcmp(name, "420") == 0)
+		*subsampling = JPEG_SUBSAMPLING_420;
+	else
+		return false;
+	return true;
+}
@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __JPEG_ENCODER_H__
+#define __JPEG_ENCODER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Chroma subsampling of encoded JPEG images
+ */
+enum jpeg_subsampling_t {
+	JPEG_SUBSAMPLING_444,
+	JPEG_SUBSAMPLING_422,
+	JPEG_SUBSAMPLING_420
+};
+
+/**
+ * Long-lived JPEG compressor with its own growing output buffer.
+ * Each render context owns one, so nothing is set up per tile.
+ * Not thread safe.
+ */
+struct jpeg_encoder_t;
+
+struct jpeg_encoder_t * jpeg_encoder__create(void);
+void jpeg_encoder__destroy(struct jpeg_encoder_t * encoder);
+
+/**
+ * Encodes top-down RGB (or RGBA, or grayscale) pixels.
+ *
+ * @param[in] encoder          The encoder.
+ * @param[in] pixels           Source pixels.
+ * @param[in] width            Image width.
+ * @param[in] height           Image height.
+ * @param[in] bytes_per_pixel  1, 3 or 4.
+ * @param[in] quality          Quality in range 1..100.
+ * @param[in] subsampling      Chroma subsampling.
+ * @param[out] data            Encoded image in the encoder buffer, valid until the next call.
+ * @param[out] size            Encoded image size.
+ * @return True on success and false otherwise.
+ */
+bool jpeg_encoder__encode(struct jpeg_encoder_t * encoder, const unsigned char * pixels,
+	int width, int height, int bytes_per_pixel, int quality, enum jpeg_subsampling_t subsampling,
+	const unsigned char ** data, size_t * size);
+
+/**
+ * Parses subsampling name like "444", "422" or "420".
+ *
+ * @param[in] name          Subsampling name.
+ * @param[out] subsampling  Parsed subsampling.
+ * @return True on success and false if the name is unknown.
+ */
+bool jpeg_encoder__parse_subsampling(const char * name, enum jpeg_subsampling_t * subsampling);
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "lru_table.h"
+
+#include <stdlib.h>
+
+static void lru_unlink(struct lru_table_t * table, struct lru_node_t * node)
+{
+	if (node->lru_prev != NULL)
+		node->lru_prev->lru_next = node->lru_next;
+	else
+		table->lru_head = node->lru_next;
+	if (node->lru_next != NULL)
+		node->lru_next->lru_prev = node->lru_prev;
+	else
+		table->lru_tail = node->lru_prev;
+	node->lru_prev = NULL;
+	node->lru_next = NULL;
+}
+
+static void lru_push_front(struct lru_table_t * table, struct lru_node_t * node)
+{
+	node->lru_prev = NULL;
+	node->lru_next = table->lru_head;
+	if (table->lru_head != NULL)
+		table->lru_head->lru_prev = node;
+	table->lru_head = node;
+	if (table->lru_tail == NULL)
+		table->lru_tail = node;
+}
+
+static struct lru_node_t ** get_bucket(struct lru_table_t * table, unsigned int hash)
+{
+	return &table->buckets[hash & table->bucket_mask];
+}
+
+bool lru_table__init(struct lru_table_t * table, unsigned int bucket_count)
+{
+	table->buckets = (struct lru_node_t **) calloc(bucket_count, sizeof(struct lru_node_t *));
+	if (table->buckets == NULL)
+		return false;
+	table->bucket_mask = bucket_count - 1;
+	table->lru_head = NULL;
+	table->lru_tail = NULL;
+	return true;
+}
+
+void lru_table__free(struct lru_table_t * table)
+{
+	free((void*)table->buckets);
+	table->buckets = NULL;
+}
+
+struct lru_node_t * lru_table__find(struct lru_table_t * table, unsigned int hash, lru_match_t match, const void * key)
+{
+	struct lru_node_t * node;
+
+	for (node = *get_bucket(table, hash); node != NULL; node = node->chain_next)
+		if (node->hash == hash && match(node, key))
+			break;
+	return node;
+}
+
+void lru_table__insert(struct lru_table_t * table, struct lru_node_t * node)
+{
+	struct lru_node_t ** bucket = get_bucket(table, node->hash);
+
+	node->chain_next = *bucket;
+	*bucket = node;
+	lru_push_front(table, node);
+}
+
+void lru_table__remove(struct lru_table_t * table, struct lru_node_t * node)
+{
+	struct lru_node_t ** slot = get_bucket(table, node->hash);
+
+	while (*slot != node)
+		slot = &(*slot)->chain_next;
+	*slot = node->chain_next;
+	node->chain_next = NULL;
+	lru_unlink(table, node);
+}
+
+void lru_table__touch(struct lru_table_t * table, struct lru_node_t * node)
+{
+	lru_unlink(table, node);
+	lru_push_front(table, node);
+}
+
+struct lru_node_t * lru_table__oldest(struct lru_table_t * table)
+{
+	return table->lru_tail;
+}
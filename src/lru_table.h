@@ -0,0 +1,72 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __LRU_TABLE_H__
+#define __LRU_TABLE_H__
+
+#include <stdbool.h>
+
+/**
+ * Intrusive hash table with LRU order, shared by the caches.
+ * Entries embed the node as their first member and are cast from it.
+ * The table doesn't allocate entries and isn't thread safe,
+ * owners lock it and account their budgets themselves.
+ */
+struct lru_node_t {
+	struct lru_node_t * chain_next; // next in hash bucket
+	struct lru_node_t * lru_prev;   // more recently used
+	struct lru_node_t * lru_next;   // less recently used
+	unsigned int hash;
+};
+
+struct lru_table_t {
+	struct lru_node_t ** buckets;
+	unsigned int bucket_mask;
+	struct lru_node_t * lru_head; // most recently used
+	struct lru_node_t * lru_tail; // least recently used
+};
+
+/**
+ * Tells whether the entry of the node has the key, called for nodes of equal hash only.
+ */
+typedef bool (*lru_match_t)(const struct lru_node_t * node, const void * key);
+
+/**
+ * Initializes empty table.
+ *
+ * @param[in] table         The table.
+ * @param[in] bucket_count  Number of buckets, power of two.
+ * @return True on success and false otherwise.
+ */
+bool lru_table__init(struct lru_table_t * table, unsigned int bucket_count);
+
+/**
+ * Frees buckets, entries should be removed by then.
+ */
+void lru_table__free(struct lru_table_t * table);
+
+/**
+ * Returns node of the key or NULL, LRU order isn't changed.
+ */
+struct lru_node_t * lru_table__find(struct lru_table_t * table, unsigned int hash, lru_match_t match, const void * key);
+
+/**
+ * Inserts node with its hash set as the most recently used.
+ */
+void lru_table__insert(struct lru_table_t * table, struct lru_node_t * node);
+
+void lru_table__remove(struct lru_table_t * table, struct lru_node_t * node);
+
+/**
+ * Makes the node the most recently used.
+ */
+void lru_table__touch(struct lru_table_t * table, struct lru_node_t * node);
+
+/**
+ * Returns the least recently used node or NULL when the table is empty.
+ */
+struct lru_node_t * lru_table__oldest(struct lru_table_t * table);
+
+#endif
@@ -4,12 +4,18 @@
  */
 
 #include "server.h"
+#include "bake.h"
+#include "webp_encoder.h"
 
 #include "tinycthread.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
 
 static mtx_t mutex;
 static cnd_t condition_variable;
@@ -32,11 +38,20 @@ void on_terminate(int func)
 	mtx_unlock(&mutex);
 }
 
+void on_bake_terminate(int func)
+{
+	// Let workers finish their tiles, server is freed by main
+	bake__interrupt();
+}
+
 struct arguments_t {
 	const char * file_root;
 	const char * index_file;
 	int port;
 	int help;
+	int bake;
+	struct server_options_t options;
+	struct bake_options_t bake_options;
 };
 
 void print_usage(const char * name)
@@ -47,9 +62,177 @@ void print_usage(const char * name)
 		   "\t-p,--port\tPort to listen (default is 80)\n"
 		   "\t-r,--root\tRoot directory for files (by default it's disabled)\n"
 		   "\t-i,--index\tIndex file (default is index.html)\n"
+		   "\t-c,--cache\tEncoded tiles cache size in megabytes, 0 disables it (default is 64)\n"
+		   "\t--raster-cache\tRendered rasters cache size in megabytes for building lower lods, 0 disables it (default is 32)\n"
+		   "\t--buffer-pool\tFree tile buffers kept for reuse in megabytes (default is 16)\n"
+		   "\t--hot-tiles\tHot tiles kept with prebuilt responses in megabytes, 0 disables them (default is 16)\n"
+		   "\t--overzoom\tMagnify parent raster for tiles without source imagery\n"
+		   "\t--prefetch\tNumber of threads prefetching neighbors and children of served tiles into the tile cache (default is 0)\n"
+		   "\t--prefetch-max-lod\tMaximum lod of prefetched children (default is 18)\n"
+		   "\t-w,--workers\tNumber of render contexts (default is number of processors)\n"
+		   "\t--tile-size\tTile width and height in pixels (default is 256)\n"
+		   "\t--max-scale\tMaximum tile size multiplier for HiDPI tiles, 1 or 2 (default is 2)\n"
+		   "\t--render-queue\tMaximum number of requests waiting for a render context, others get 503 (default is 64)\n"
+		   "\t--client-renders\tMaximum number of renders of a single client address, others get 429, 0 means no limit (default is 0)\n"
+		   "\t--max-connections\tMaximum number of connections (default is 1024)\n"
+		   "\t--retry-after\tRetry-After seconds of rejected requests (default is 1)\n"
+		   "\t-s,--store\tPersistent tile store directory (by default it's disabled)\n"
+		   "\t--store-size\tPersistent tile store size in megabytes (default is 1024)\n"
+		   "\t--source-version\tImagery version used in tile ETags (default is 1)\n"
+		   "\t--max-age\tTile cache lifetime in seconds (default is 86400)\n"
+		   "\t--max-age-lods\tTile cache lifetime for lods range, like 0-5=604800\n"
+		   "\t--jpeg-quality\tJPEG quality in range 1-100 (default is 95)\n"
+		   "\t--jpeg-subsampling\tJPEG chroma subsampling, 444, 422 or 420 (default is 420)\n"
+		   "\t--jpeg-lods\tJPEG quality and optional subsampling for lods range, like 10-18=80:420\n"
+		   "\t--png-profile\tPNG encoding profile, fast, balanced or small (default is fast)\n"
+		   "\t--webp-quality\tWebP quality in range 1-100 (default is 80)\n"
+		   "\t--webp-lossless\tEncode WebP losslessly unless quality is requested\n"
+		   "\t--accept-webp\tServe WebP to clients accepting it when format isn't given\n"
+		   "\t-b,--bake\tBake tiles into the store and exit instead of listening\n"
+		   "\t--faces\t\tFaces to bake, like 0-5 or 0,2,4 (default is 0-5)\n"
+		   "\t--lods\t\tLevels of detail to bake up to 30, like 0-6 (default is 0-4)\n"
+		   "\t--format\tImage format to bake, jpeg, png, webp, raw or dxt1 (default is jpeg)\n"
 		, name);
 }
 
+/**
+ * Parses nonnegative size in megabytes into bytes
+ */
+int parse_megabytes(const char * string, size_t * bytes)
+{
+	char * end;
+	long megabytes;
+
+	errno = 0;
+	megabytes = strtol(string, &end, 10);
+	if (end == string || *end != '\0' || errno == ERANGE || megabytes < 0
+		|| (unsigned long)megabytes > SIZE_MAX / (1024 * 1024))
+		return 1;
+	*bytes = (size_t)megabytes * 1024 * 1024;
+	return 0;
+}
+
+/**
+ * Parses integer not less than the minimum
+ */
+int parse_integer(const char * string, int min, int * value)
+{
+	char * end;
+	long number;
+
+	errno = 0;
+	number = strtol(string, &end, 10);
+	if (end == string || *end != '\0' || errno == ERANGE || number < min || number > INT_MAX)
+		return 1;
+	*value = (int)number;
+	return 0;
+}
+
+/**
+ * Parses integer range like "2-5" or single integer like "3"
+ */
+int parse_range(const char * string, int * first, int * last)
+{
+	char * end;
+
+	*first = (int) strtol(string, &end, 10);
+	if (end == string)
+		return 1;
+	if (*end == '\0')
+	{
+		*last = *first;
+		return 0;
+	}
+	if (*end != '-')
+		return 1;
+	string = end + 1;
+	*last = (int) strtol(string, &end, 10);
+	if (end == string || *end != '\0' || *last < *first)
+		return 1;
+	return 0;
+}
+
+/**
+ * Parses max age rule like "0-5=604800"
+ */
+int parse_max_age_rule(const char * string, struct max_age_rule_t * rule)
+{
+	char range[32];
+	const char * equals;
+	char * end;
+
+	equals = strchr(string, '=');
+	if (equals == NULL || (size_t)(equals - string) >= sizeof(range))
+		return 1;
+	memcpy(range, string, (size_t)(equals - string));
+	range[equals - string] = '\0';
+	if (parse_range(range, &rule->min_lod, &rule->max_lod) != 0)
+		return 1;
+	rule->seconds = (int) strtol(equals + 1, &end, 10);
+	if (end == equals + 1 || *end != '\0' || rule->seconds < 0)
+		return 1;
+	return 0;
+}
+
+/**
+ * Parses JPEG rule like "10-18=80" or "10-18=80:420"
+ */
+int parse_jpeg_rule(const char * string, const struct server_options_t * options, struct jpeg_rule_t * rule)
+{
+	char range[32];
+	const char * equals;
+	char * end;
+
+	equals = strchr(string, '=');
+	if (equals == NULL || (size_t)(equals - string) >= sizeof(range))
+		return 1;
+	memcpy(range, string, (size_t)(equals - string));
+	range[equals - string] = '\0';
+	if (parse_range(range, &rule->min_lod, &rule->max_lod) != 0)
+		return 1;
+	rule->quality = (int) strtol(equals + 1, &end, 10);
+	if (end == equals + 1 || rule->quality < 1 || rule->quality > 100)
+		return 1;
+	rule->subsampling = options->jpeg_subsampling;
+	if (*end == ':')
+		return jpeg_encoder__parse_subsampling(end + 1, &rule->subsampling) ? 0 : 1;
+	return (*end == '\0') ? 0 : 1;
+}
+
+/**
+ * Parses faces list like "0-5" or "0,2,4"
+ */
+int parse_faces(const char * string, struct bake_options_t * options)
+{
+	char item[16];
+	const char * comma;
+	size_t length;
+	int first, last;
+
+	options->face_count = 0;
+	while (*string != '\0')
+	{
+		comma = strchr(string, ',');
+		length = (comma != NULL) ? (size_t)(comma - string) : strlen(string);
+		if (length == 0 || length >= sizeof(item))
+			return 1;
+		memcpy(item, string, length);
+		item[length] = '\0';
+		if (parse_range(item, &first, &last) != 0 || first < 0 || last > 5)
+			return 1;
+		for (int face = first; face <= last; ++face)
+		{
+			if (options->face_count == 6)
+				return 1;
+			options->faces[options->face_count++] = face;
+		}
+		string += length;
+		if (*string == ',')
+			++string;
+	}
+	return (options->face_count > 0) ? 0 : 1;
+}
+
 /**
  * Parses arguments
  * 
@@ -99,6 +282,407 @@ int parse_arguments(int argc, char *const *argv, struct arguments_t * arguments)
 				return 1;
 			}
 		}
+		else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--cache") == 0)
+		{
+			if (i+1 < argc)
+			{
+				if (parse_megabytes(argv[++i], &arguments->options.cache_size) != 0)
+				{
+					printf("wrong size %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--raster-cache") == 0)
+		{
+			if (i+1 < argc)
+			{
+				if (parse_megabytes(argv[++i], &arguments->options.raster_cache_size) != 0)
+				{
+					printf("wrong size %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--buffer-pool") == 0)
+		{
+			if (i+1 < argc)
+			{
+				if (parse_megabytes(argv[++i], &arguments->options.buffer_pool_size) != 0)
+				{
+					printf("wrong size %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--hot-tiles") == 0)
+		{
+			if (i+1 < argc)
+			{
+				if (parse_megabytes(argv[++i], &arguments->options.hot_tiles_size) != 0)
+				{
+					printf("wrong size %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--overzoom") == 0)
+		{
+			arguments->options.overzoom = true;
+		}
+		else if (strcmp(argv[i], "--prefetch") == 0)
+		{
+			if (i+1 < argc)
+				arguments->options.prefetch_threads = atoi(argv[++i]);
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--prefetch-max-lod") == 0)
+		{
+			if (i+1 < argc)
+				arguments->options.prefetch_max_lod = atoi(argv[++i]);
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--workers") == 0)
+		{
+			if (i+1 < argc)
+				arguments->options.pool_size = atoi(argv[++i]);
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--tile-size") == 0)
+		{
+			if (i+1 < argc)
+			{
+				arguments->options.width = atoi(argv[++i]);
+				arguments->options.height = arguments->options.width;
+				if (arguments->options.width < 1)
+				{
+					printf("wrong tile size %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--max-scale") == 0)
+		{
+			if (i+1 < argc)
+				arguments->options.max_scale = atoi(argv[++i]);
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--render-queue") == 0)
+		{
+			if (i+1 < argc)
+				arguments->options.render_queue = atoi(argv[++i]);
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--client-renders") == 0)
+		{
+			if (i+1 < argc)
+				arguments->options.client_renders = atoi(argv[++i]);
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--max-connections") == 0)
+		{
+			if (i+1 < argc)
+			{
+				if (parse_integer(argv[++i], 1, &arguments->options.max_connections) != 0)
+				{
+					printf("wrong connections limit %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--retry-after") == 0)
+		{
+			if (i+1 < argc)
+			{
+				if (parse_integer(argv[++i], 0, &arguments->options.retry_after) != 0)
+				{
+					printf("wrong retry delay %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--store") == 0)
+		{
+			if (i+1 < argc)
+				arguments->options.store_path = argv[++i];
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--store-size") == 0)
+		{
+			if (i+1 < argc)
+			{
+				if (parse_megabytes(argv[++i], &arguments->options.store_size) != 0)
+				{
+					printf("wrong size %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--source-version") == 0)
+		{
+			if (i+1 < argc)
+			{
+				arguments->options.source_version = argv[++i];
+				if (strchr(argv[i], '"') != NULL || strlen(argv[i]) >= SERVER_SOURCE_VERSION_LENGTH)
+				{
+					printf("wrong source version %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--max-age") == 0)
+		{
+			if (i+1 < argc)
+				arguments->options.max_age = atoi(argv[++i]);
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--max-age-lods") == 0)
+		{
+			if (i+1 < argc)
+			{
+				struct server_options_t * options = &arguments->options;
+				if (options->max_age_rule_count == SERVER_MAX_AGE_RULE_COUNT
+					|| parse_max_age_rule(argv[++i], &options->max_age_rules[options->max_age_rule_count]) != 0)
+				{
+					printf("wrong max age rule %s\n", argv[i]);
+					return 1;
+				}
+				++options->max_age_rule_count;
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--jpeg-quality") == 0)
+		{
+			if (i+1 < argc)
+			{
+				arguments->options.jpeg_quality = atoi(argv[++i]);
+				if (arguments->options.jpeg_quality < 1 || arguments->options.jpeg_quality > 100)
+				{
+					printf("wrong JPEG quality %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--jpeg-subsampling") == 0)
+		{
+			if (i+1 < argc)
+			{
+				if (!jpeg_encoder__parse_subsampling(argv[++i], &arguments->options.jpeg_subsampling))
+				{
+					printf("wrong JPEG subsampling %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--jpeg-lods") == 0)
+		{
+			if (i+1 < argc)
+			{
+				struct server_options_t * options = &arguments->options;
+				if (options->jpeg_rule_count == SERVER_JPEG_RULE_COUNT
+					|| parse_jpeg_rule(argv[++i], options, &options->jpeg_rules[options->jpeg_rule_count]) != 0)
+				{
+					printf("wrong JPEG rule %s\n", argv[i]);
+					return 1;
+				}
+				++options->jpeg_rule_count;
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--png-profile") == 0)
+		{
+			if (i+1 < argc)
+			{
+				if (!png_encoder__parse_profile(argv[++i], &arguments->options.png_profile))
+				{
+					printf("wrong PNG profile %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--webp-quality") == 0)
+		{
+			if (i+1 < argc)
+			{
+				arguments->options.webp_quality = atoi(argv[++i]);
+				if (arguments->options.webp_quality < 1 || arguments->options.webp_quality > 100)
+				{
+					printf("wrong WebP quality %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--webp-lossless") == 0)
+		{
+			arguments->options.webp_lossless = true;
+		}
+		else if (strcmp(argv[i], "--accept-webp") == 0)
+		{
+			if (!webp_encoder__is_available())
+			{
+				printf("%s option requires the server built with WEBP=1\n", argv[i]);
+				return 1;
+			}
+			arguments->options.accept_webp = true;
+		}
+		else if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--bake") == 0)
+		{
+			arguments->bake = 1;
+		}
+		else if (strcmp(argv[i], "--faces") == 0)
+		{
+			if (i+1 < argc)
+			{
+				if (parse_faces(argv[++i], &arguments->bake_options) != 0)
+				{
+					printf("wrong faces list %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--lods") == 0)
+		{
+			if (i+1 < argc)
+			{
+				if (parse_range(argv[++i], &arguments->bake_options.min_lod, &arguments->bake_options.max_lod) != 0
+					|| arguments->bake_options.min_lod < 0 || arguments->bake_options.max_lod > BAKE_MAX_LOD)
+				{
+					printf("wrong lods range %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--format") == 0)
+		{
+			if (i+1 < argc)
+			{
+				if (!image_format__parse(argv[++i], &arguments->bake_options.format))
+				{
+					printf("unknown image format %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				printf("%s option requires an argument\n", argv[i]);
+				return 1;
+			}
+		}
 		else
 		{
 			printf("unknown argument %s\n", argv[i]);
@@ -116,6 +700,14 @@ int main(int argc, char *const *argv)
 	arguments.file_root = NULL;
 	arguments.index_file = NULL;
 	arguments.port = 80; // default port
+	arguments.bake = 0;
+	server_options__set_defaults(&arguments.options);
+	arguments.bake_options.face_count = 6;
+	for (int face = 0; face < 6; ++face)
+		arguments.bake_options.faces[face] = face;
+	arguments.bake_options.min_lod = 0;
+	arguments.bake_options.max_lod = 4;
+	arguments.bake_options.format = FORMAT_JPEG;
 
 	// Parse arguments
 	if (parse_arguments(argc, argv, &arguments) != 0)
@@ -137,7 +729,7 @@ int main(int argc, char *const *argv)
 	}
 
 	// Init a server
-	server = server__init(256, 256, 3);
+	server = server__init(&arguments.options);
 	if (server == NULL)
 	{
 		printf("Server init failed\n");
@@ -146,6 +738,18 @@ int main(int argc, char *const *argv)
 		return 4;
 	}
 
+	// Bake tiles instead of serving them
+	if (arguments.bake == 1)
+	{
+		signal(SIGINT, on_bake_terminate);
+		signal(SIGTERM, on_bake_terminate);
+		ret = bake__run(server, &arguments.bake_options);
+		server__free(server);
+		cnd_destroy(&condition_variable);
+		mtx_destroy(&mutex);
+		return (ret == 0) ? 0 : 6;
+	}
+
 	// Start the server
 	ret = server__start(server, arguments.port, arguments.file_root, arguments.index_file);
 	if (ret != 0)
@@ -0,0 +1,262 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#if !defined(_WIN32) && !defined(_XOPEN_SOURCE)
+# define _XOPEN_SOURCE 500 // clock_gettime
+#endif
+
+#include "metrics.h"
+#include "image_format.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <time.h>
+#endif
+
+#define METRICS_BUCKET_COUNT 16
+#define METRICS_MAX_FORMATS 8
+#define METRICS_STATUS_COUNT 8
+
+/* Relaxed ordering is enough for independent counters */
+#define ATOMIC_ADD(counter, value) __atomic_fetch_add(&(counter), (value), __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+/* Upper bounds of histogram buckets in microseconds, the last bucket is +Inf */
+static const unsigned long long kBucketBounds[METRICS_BUCKET_COUNT] = {
+	50, 100, 250, 500,
+	1000, 2500, 5000, 10000,
+	25000, 50000, 100000, 250000,
+	500000, 1000000, 2500000, 5000000
+};
+
+static const unsigned int kStatuses[METRICS_STATUS_COUNT] = {
+	200, 304, 400, 404, 429, 500, 503, 0 // 0 is for the rest
+};
+
+static const char * kStageNames[METRICS_STAGE_COUNT] = {
+	"parse",
+	"context_wait",
+	"render",
+	"source_wait",
+	"encode",
+	"queue",
+	"tile",
+	"file"
+};
+
+struct metrics_histogram_t {
+	unsigned long long buckets[METRICS_BUCKET_COUNT + 1];
+	unsigned long long sum;
+	unsigned long long count;
+};
+
+struct metrics_t {
+	struct metrics_histogram_t stages[METRICS_STAGE_COUNT];
+	unsigned long long tile_requests[METRICS_MAX_FORMATS][METRICS_STATUS_COUNT];
+	unsigned long long file_requests[METRICS_STATUS_COUNT];
+	unsigned long long render_iterations;
+	unsigned long long downsampled_tiles;
+	unsigned long long overzoomed_tiles;
+	unsigned long long cancelled_renders;
+	unsigned long long aborted_requests;
+};
+
+static int status_index(unsigned int status)
+{
+	for (int i = 0; i < METRICS_STATUS_COUNT - 1; ++i)
+		if (kStatuses[i] == status)
+			return i;
+	return METRICS_STATUS_COUNT - 1;
+}
+
+/* Appends formatted text, keeps track of the overflow */
+static void append(char * buffer, size_t max, size_t * length, bool * overflow, const char * format, ...)
+{
+	va_list args;
+	int count;
+
+	if (*overflow)
+		return;
+	va_start(args, format);
+	count = vsnprintf(buffer + *length, max - *length, format, args);
+	va_end(args);
+	if (count < 0 || (size_t)count >= max - *length)
+		*overflow = true;
+	else
+		*length += (size_t)count;
+}
+
+struct metrics_t * metrics__create(void)
+{
+	return (struct metrics_t *) calloc(1, sizeof(struct metrics_t));
+}
+
+void metrics__destroy(struct metrics_t * metrics)
+{
+	free((void*)metrics);
+}
+
+unsigned long long metrics__now(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (unsigned long long)(counter.QuadPart / (frequency.QuadPart / 1000000));
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ull + (unsigned long long)ts.tv_nsec / 1000ull;
+#endif
+}
+
+void metrics__observe(struct metrics_t * metrics, enum metrics_stage_t stage, unsigned long long microseconds)
+{
+	struct metrics_histogram_t * histogram = &metrics->stages[stage];
+	int bucket = 0;
+
+	while (bucket < METRICS_BUCKET_COUNT && microseconds > kBucketBounds[bucket])
+		++bucket;
+	ATOMIC_ADD(histogram->buckets[bucket], 1ull);
+	ATOMIC_ADD(histogram->sum, microseconds);
+	ATOMIC_ADD(histogram->count, 1ull);
+}
+
+void metrics__count_tile_request(struct metrics_t * metrics, int format, unsigned int status)
+{
+	if (format < 0 || format >= METRICS_MAX_FORMATS)
+		return;
+	ATOMIC_ADD(metrics->tile_requests[format][status_index(status)], 1ull);
+}
+
+void metrics__count_file_request(struct metrics_t * metrics, unsigned int status)
+{
+	ATOMIC_ADD(metrics->file_requests[status_index(status)], 1ull);
+}
+
+void metrics__count_render_iterations(struct metrics_t * metrics, unsigned int iterations)
+{
+	ATOMIC_ADD(metrics->render_iterations, (unsigned long long)iterations);
+}
+
+void metrics__count_cancelled_render(struct metrics_t * metrics)
+{
+	ATOMIC_ADD(metrics->cancelled_renders, 1ull);
+}
+
+void metrics__count_aborted_request(struct metrics_t * metrics)
+{
+	ATOMIC_ADD(metrics->aborted_requests, 1ull);
+}
+
+void metrics__count_pyramid_tile(struct metrics_t * metrics, bool overzoomed)
+{
+	if (overzoomed)
+		ATOMIC_ADD(metrics->overzoomed_tiles, 1ull);
+	else
+		ATOMIC_ADD(metrics->downsampled_tiles, 1ull);
+}
+
+int metrics__format(struct metrics_t * metrics, char * buffer, size_t max)
+{
+	size_t length = 0;
+	bool overflow = false;
+
+	append(buffer, max, &length, &overflow,
+		"# HELP tileserver_stage_duration_seconds Duration of request processing stages.\n"
+		"# TYPE tileserver_stage_duration_seconds histogram\n");
+	for (int stage = 0; stage < METRICS_STAGE_COUNT; ++stage)
+	{
+		struct metrics_histogram_t * histogram = &metrics->stages[stage];
+		unsigned long long cumulative = 0;
+
+		for (int bucket = 0; bucket < METRICS_BUCKET_COUNT; ++bucket)
+		{
+			cumulative += ATOMIC_LOAD(histogram->buckets[bucket]);
+			append(buffer, max, &length, &overflow,
+				"tileserver_stage_duration_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+				kStageNames[stage], (double)kBucketBounds[bucket] * 1e-6, cumulative);
+		}
+		cumulative += ATOMIC_LOAD(histogram->buckets[METRICS_BUCKET_COUNT]);
+		append(buffer, max, &length, &overflow,
+			"tileserver_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+			"tileserver_stage_duration_seconds_sum{stage=\"%s\"} %.6f\n"
+			"tileserver_stage_duration_seconds_count{stage=\"%s\"} %llu\n",
+			kStageNames[stage], cumulative,
+			kStageNames[stage], (double)ATOMIC_LOAD(histogram->sum) * 1e-6,
+			kStageNames[stage], ATOMIC_LOAD(histogram->count));
+	}
+
+	append(buffer, max, &length, &overflow,
+		"# HELP tileserver_tile_requests_total Tile requests by format and status.\n"
+		"# TYPE tileserver_tile_requests_total counter\n");
+	for (int format = 0; format < METRICS_MAX_FORMATS; ++format)
+	{
+		const char * name = image_format__get_name((enum image_format_t)format);
+		if (name == NULL)
+			continue;
+		for (int status = 0; status < METRICS_STATUS_COUNT; ++status)
+		{
+			unsigned long long count = ATOMIC_LOAD(metrics->tile_requests[format][status]);
+			if (count == 0)
+				continue;
+			if (kStatuses[status] != 0)
+				append(buffer, max, &length, &overflow,
+					"tileserver_tile_requests_total{format=\"%s\",status=\"%u\"} %llu\n",
+					name, kStatuses[status], count);
+			else
+				append(buffer, max, &length, &overflow,
+					"tileserver_tile_requests_total{format=\"%s\",status=\"other\"} %llu\n",
+					name, count);
+		}
+	}
+
+	append(buffer, max, &length, &overflow,
+		"# HELP tileserver_file_requests_total Static file requests by status.\n"
+		"# TYPE tileserver_file_requests_total counter\n");
+	for (int status = 0; status < METRICS_STATUS_COUNT; ++status)
+	{
+		unsigned long long count = ATOMIC_LOAD(metrics->file_requests[status]);
+		if (count == 0)
+			continue;
+		if (kStatuses[status] != 0)
+			append(buffer, max, &length, &overflow,
+				"tileserver_file_requests_total{status=\"%u\"} %llu\n", kStatuses[status], count);
+		else
+			append(buffer, max, &length, &overflow,
+				"tileserver_file_requests_total{status=\"other\"} %llu\n", count);
+	}
+
+	append(buffer, max, &length, &overflow,
+		"# HELP tileserver_render_iterations_total Calls of saim_render_mapped_cube.\n"
+		"# TYPE tileserver_render_iterations_total counter\n"
+		"tileserver_render_iterations_total %llu\n",
+		ATOMIC_LOAD(metrics->render_iterations));
+
+	append(buffer, max, &length, &overflow,
+		"# HELP tileserver_pyramid_tiles_total Tiles built from cached rasters of another lod.\n"
+		"# TYPE tileserver_pyramid_tiles_total counter\n"
+		"tileserver_pyramid_tiles_total{source=\"children\"} %llu\n"
+		"tileserver_pyramid_tiles_total{source=\"parent\"} %llu\n",
+		ATOMIC_LOAD(metrics->downsampled_tiles),
+		ATOMIC_LOAD(metrics->overzoomed_tiles));
+
+	append(buffer, max, &length, &overflow,
+		"# HELP tileserver_cancelled_renders_total Renders abandoned since nobody waits for the tile.\n"
+		"# TYPE tileserver_cancelled_renders_total counter\n"
+		"tileserver_cancelled_renders_total %llu\n"
+		"# HELP tileserver_aborted_requests_total Requests terminated before the response has been sent.\n"
+		"# TYPE tileserver_aborted_requests_total counter\n"
+		"tileserver_aborted_requests_total %llu\n",
+		ATOMIC_LOAD(metrics->cancelled_renders),
+		ATOMIC_LOAD(metrics->aborted_requests));
+
+	return overflow ? -1 : (int)length;
+}
@@ -0,0 +1,71 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Stages of request processing with latency histograms
+ */
+enum metrics_stage_t {
+	METRICS_STAGE_PARSE,        // tile request arguments parsing
+	METRICS_STAGE_CONTEXT_WAIT, // waiting for a free render context
+	METRICS_STAGE_RENDER,       // saim_render_mapped_cube calls
+	METRICS_STAGE_SOURCE_WAIT,  // sleeping while source tiles are downloaded
+	METRICS_STAGE_ENCODE,       // JPEG/PNG encoding
+	METRICS_STAGE_QUEUE,        // MHD_queue_response call
+	METRICS_STAGE_TILE,         // whole tile request
+	METRICS_STAGE_FILE,         // whole static file request
+	METRICS_STAGE_COUNT
+};
+
+/**
+ * Request counters and latency histograms.
+ * All updates are lock-free, so they are cheap to do on every request.
+ */
+struct metrics_t;
+
+struct metrics_t * metrics__create(void);
+void metrics__destroy(struct metrics_t * metrics);
+
+/**
+ * Returns monotonic time in microseconds.
+ */
+unsigned long long metrics__now(void);
+
+void metrics__observe(struct metrics_t * metrics, enum metrics_stage_t stage, unsigned long long microseconds);
+void metrics__count_tile_request(struct metrics_t * metrics, int format, unsigned int status);
+void metrics__count_file_request(struct metrics_t * metrics, unsigned int status);
+void metrics__count_render_iterations(struct metrics_t * metrics, unsigned int iterations);
+
+/**
+ * Counts render abandoned since its client has gone away or the request has expired.
+ */
+void metrics__count_cancelled_render(struct metrics_t * metrics);
+
+/**
+ * Counts request terminated before its response has been sent completely.
+ */
+void metrics__count_aborted_request(struct metrics_t * metrics);
+
+/**
+ * Counts the tile raster built from cached rasters of children or, when overzoomed, of the parent.
+ */
+void metrics__count_pyramid_tile(struct metrics_t * metrics, bool overzoomed);
+
+/**
+ * Writes metrics in Prometheus text format.
+ *
+ * @param[in] metrics  The metrics.
+ * @param[out] buffer  Output buffer.
+ * @param[in] max      Output buffer size.
+ * @return Number of written characters or -1 if the buffer is too small.
+ */
+int metrics__format(struct metrics_t * metrics, char * buffer, size_t max);
+
+#endif
@@ -30,8 +30,38 @@ void translate_url_to_mime_type(const char * url, char * mime_type, size_t max)
 		_strncpy(mime_type, "text/html", max);
 	else if (strcmp(ptr, "css") == 0)
 		_strncpy(mime_type, "text/css", max);
-	else if (strcmp(ptr, "js") == 0)
+	else if (strcmp(ptr, "js") == 0 || strcmp(ptr, "mjs") == 0)
 		_strncpy(mime_type, "application/javascript", max);
+	else if (strcmp(ptr, "json") == 0)
+		_strncpy(mime_type, "application/json", max);
+	else if (strcmp(ptr, "wasm") == 0)
+		_strncpy(mime_type, "application/wasm", max);
+	else if (strcmp(ptr, "png") == 0)
+		_strncpy(mime_type, "image/png", max);
+	else if (strcmp(ptr, "jpg") == 0 || strcmp(ptr, "jpeg") == 0)
+		_strncpy(mime_type, "image/jpeg", max);
+	else if (strcmp(ptr, "webp") == 0)
+		_strncpy(mime_type, "image/webp", max);
+	else if (strcmp(ptr, "svg") == 0)
+		_strncpy(mime_type, "image/svg+xml", max);
+	else if (strcmp(ptr, "ico") == 0)
+		_strncpy(mime_type, "image/x-icon", max);
+	else if (strcmp(ptr, "glb") == 0)
+		_strncpy(mime_type, "model/gltf-binary", max);
+	else if (strcmp(ptr, "gltf") == 0)
+		_strncpy(mime_type, "model/gltf+json", max);
 	else
 		_strncpy(mime_type, "text/plain", max);
+}
+
+bool is_mime_type_compressible(const char * mime_type)
+{
+	// Images are compressed already
+	return strncmp(mime_type, "text/", 5) == 0
+		|| strcmp(mime_type, "application/javascript") == 0
+		|| strcmp(mime_type, "application/json") == 0
+		|| strcmp(mime_type, "application/wasm") == 0
+		|| strcmp(mime_type, "image/svg+xml") == 0
+		|| strcmp(mime_type, "model/gltf-binary") == 0
+		|| strcmp(mime_type, "model/gltf+json") == 0;
 }
\ No newline at end of file
@@ -1,8 +1,12 @@
 #ifndef __MIME_TYPE_H__
 #define __MIME_TYPE_H__
 
+#include <stdbool.h>
 #include <stddef.h>
 
 void translate_url_to_mime_type(const char * url, char * mime_type, size_t max);
 
+/* Tells whether content of this type gets noticeably smaller with gzip or brotli */
+bool is_mime_type_compressible(const char * mime_type);
+
 #endif
\ No newline at end of file
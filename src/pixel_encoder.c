@@ -0,0 +1,182 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "pixel_encoder.h"
+
+#include <string.h>
+
+static void put_uint16(unsigned char * data, unsigned int value)
+{
+	data[0] = (unsigned char)(value);
+	data[1] = (unsigned char)(value >> 8);
+}
+
+static void put_uint32(unsigned char * data, unsigned long value)
+{
+	data[0] = (unsigned char)(value);
+	data[1] = (unsigned char)(value >> 8);
+	data[2] = (unsigned char)(value >> 16);
+	data[3] = (unsigned char)(value >> 24);
+}
+
+static void put_header(unsigned char * data, int width, int height, enum pixel_layout_t layout, int bytes_per_pixel,
+	size_t pixels_size)
+{
+	memcpy(data, "ETPX", 4);
+	put_uint16(data + 4, (unsigned int)width);
+	put_uint16(data + 6, (unsigned int)height);
+	data[8] = (unsigned char)layout;
+	data[9] = (unsigned char)bytes_per_pixel;
+	put_uint16(data + 10, 0);
+	put_uint32(data + 12, (unsigned long)pixels_size);
+}
+
+static bool is_size_valid(int width, int height, int bytes_per_pixel)
+{
+	return width > 0 && width <= 0xFFFF && height > 0 && height <= 0xFFFF
+		&& (bytes_per_pixel == 3 || bytes_per_pixel == 4);
+}
+
+size_t pixel_encoder__raw_size(int width, int height, int bytes_per_pixel)
+{
+	if (!is_size_valid(width, height, bytes_per_pixel))
+		return 0;
+	return PIXEL_HEADER_SIZE + (size_t)width * (size_t)height * (size_t)bytes_per_pixel;
+}
+
+void pixel_encoder__encode_raw(const unsigned char * pixels, int width, int height, int bytes_per_pixel,
+	unsigned char * data)
+{
+	size_t pixels_size = (size_t)width * (size_t)height * (size_t)bytes_per_pixel;
+
+	put_header(data, width, height,
+		(bytes_per_pixel == 4) ? PIXEL_LAYOUT_RGBA : PIXEL_LAYOUT_RGB, bytes_per_pixel, pixels_size);
+	memcpy(data + PIXEL_HEADER_SIZE, pixels, pixels_size);
+}
+
+static unsigned int pack_565(const int color[3])
+{
+	return ((unsigned int)(color[0] >> 3) << 11) | ((unsigned int)(color[1] >> 2) << 5) | (unsigned int)(color[2] >> 3);
+}
+
+static void unpack_565(unsigned int packed, int color[3])
+{
+	int r = (int)((packed >> 11) & 0x1F);
+	int g = (int)((packed >> 5) & 0x3F);
+	int b = (int)(packed & 0x1F);
+
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+/*
+Endpoints are the corners of the color bounding box inset by 1/16 of its size,
+which is cheap and close enough to the principal axis for photographic imagery.
+Every pixel takes the nearest of the four palette colors.
+*/
+static void encode_block(const unsigned char block[16][3], unsigned char * out)
+{
+	int low[3] = {255, 255, 255};
+	int high[3] = {0, 0, 0};
+	int palette[4][3];
+	unsigned int color0, color1, indices;
+
+	for (int i = 0; i < 16; ++i)
+		for (int c = 0; c < 3; ++c)
+		{
+			if (block[i][c] < low[c])
+				low[c] = block[i][c];
+			if (block[i][c] > high[c])
+				high[c] = block[i][c];
+		}
+	for (int c = 0; c < 3; ++c)
+	{
+		int inset = (high[c] - low[c]) >> 4;
+		low[c] += inset;
+		high[c] -= inset;
+	}
+
+	color0 = pack_565(high);
+	color1 = pack_565(low);
+	indices = 0;
+	if (color0 < color1)
+	{
+		unsigned int swap = color0;
+		color0 = color1;
+		color1 = swap;
+	}
+	if (color0 != color1)
+	{
+		// Four color mode requires color0 > color1
+		unpack_565(color0, palette[0]);
+		unpack_565(color1, palette[1]);
+		for (int c = 0; c < 3; ++c)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+		}
+		for (int i = 0; i < 16; ++i)
+		{
+			int best = 0;
+			int best_distance = 0x7FFFFFFF;
+			for (int p = 0; p < 4; ++p)
+			{
+				int dr = block[i][0] - palette[p][0];
+				int dg = block[i][1] - palette[p][1];
+				int db = block[i][2] - palette[p][2];
+				int distance = dr * dr + dg * dg + db * db;
+				if (distance < best_distance)
+				{
+					best_distance = distance;
+					best = p;
+				}
+			}
+			indices |= (unsigned int)best << (2 * i);
+		}
+	}
+	put_uint16(out, color0);
+	put_uint16(out + 2, color1);
+	put_uint32(out + 4, (unsigned long)indices);
+}
+
+size_t pixel_encoder__dxt1_size(int width, int height, int bytes_per_pixel)
+{
+	if (!is_size_valid(width, height, bytes_per_pixel))
+		return 0;
+	return PIXEL_HEADER_SIZE + (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4) * 8;
+}
+
+void pixel_encoder__encode_dxt1(const unsigned char * pixels, int width, int height, int bytes_per_pixel,
+	unsigned char * data)
+{
+	unsigned char block[16][3];
+	unsigned char * out;
+	size_t stride = (size_t)width * (size_t)bytes_per_pixel;
+	int blocks_x = (width + 3) / 4;
+	int blocks_y = (height + 3) / 4;
+
+	put_header(data, width, height, PIXEL_LAYOUT_DXT1, 0, (size_t)blocks_x * (size_t)blocks_y * 8);
+	out = data + PIXEL_HEADER_SIZE;
+	for (int by = 0; by < blocks_y; ++by)
+		for (int bx = 0; bx < blocks_x; ++bx)
+		{
+			// Gather the block, edge pixels are repeated
+			for (int j = 0; j < 4; ++j)
+			{
+				int y = (4 * by + j < height) ? 4 * by + j : height - 1;
+				for (int i = 0; i < 4; ++i)
+				{
+					int x = (4 * bx + i < width) ? 4 * bx + i : width - 1;
+					const unsigned char * pixel = pixels + (size_t)y * stride + (size_t)x * (size_t)bytes_per_pixel;
+					block[4 * j + i][0] = pixel[0];
+					block[4 * j + i][1] = pixel[1];
+					block[4 * j + i][2] = pixel[2];
+				}
+			}
+			encode_block((const unsigned char (*)[3])block, out);
+			out += 8;
+		}
+}
@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __PIXEL_ENCODER_H__
+#define __PIXEL_ENCODER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Size of the header preceding pixel data */
+#define PIXEL_HEADER_SIZE 16
+
+/**
+ * Layout of pixel data, part of the header
+ */
+enum pixel_layout_t {
+	PIXEL_LAYOUT_RGB = 0,  // top-down rows of 8-bit RGB
+	PIXEL_LAYOUT_RGBA = 1, // top-down rows of 8-bit RGBA
+	PIXEL_LAYOUT_DXT1 = 2  // BC1 blocks of 4x4 pixels, top-down rows of blocks, no alpha
+};
+
+/*
+Header fields are little-endian:
+  0: magic "ETPX"
+  4: uint16 width
+  6: uint16 height
+  8: uint8 layout
+  9: uint8 bytes per pixel of the source, 0 for compressed layouts
+ 10: uint16 reserved, 0
+ 12: uint32 size of the pixel data following the header
+*/
+
+/*
+Sizes are known before encoding, so callers provide the output memory
+and the encoders write header and pixels straight into it.
+*/
+
+/**
+ * Returns size of raw encoded image with header, or 0 if the image can't be encoded.
+ */
+size_t pixel_encoder__raw_size(int width, int height, int bytes_per_pixel);
+
+/**
+ * Copies pixels as they are, so clients upload them to a texture without decoding.
+ *
+ * @param[in] pixels           Source pixels.
+ * @param[in] width            Image width.
+ * @param[in] height           Image height.
+ * @param[in] bytes_per_pixel  3 or 4.
+ * @param[out] data            Header and pixels, pixel_encoder__raw_size bytes.
+ */
+void pixel_encoder__encode_raw(const unsigned char * pixels, int width, int height, int bytes_per_pixel,
+	unsigned char * data);
+
+/**
+ * Returns size of DXT1 encoded image with header, or 0 if the image can't be encoded.
+ */
+size_t pixel_encoder__dxt1_size(int width, int height, int bytes_per_pixel);
+
+/**
+ * Compresses pixels into DXT1 (BC1) texture blocks, 8 times smaller than RGBA.
+ * Edge blocks of sizes not divisible by 4 repeat the last row and column.
+ *
+ * @param[in] pixels           Source pixels.
+ * @param[in] width            Image width.
+ * @param[in] height           Image height.
+ * @param[in] bytes_per_pixel  3 or 4, alpha is ignored.
+ * @param[out] data            Header and blocks, pixel_encoder__dxt1_size bytes.
+ */
+void pixel_encoder__encode_dxt1(const unsigned char * pixels, int width, int height, int bytes_per_pixel,
+	unsigned char * data);
+
+#endif
@@ -0,0 +1,323 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "png_encoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#define PNG_PROFILE_COUNT 3
+
+enum png_filter_t {
+	PNG_FILTER_NONE = 0,
+	PNG_FILTER_SUB = 1,
+	PNG_FILTER_UP = 2,
+	PNG_FILTER_AVERAGE = 3,
+	PNG_FILTER_PAETH = 4,
+	PNG_FILTER_ADAPTIVE = 5 // not a PNG filter type, filter is chosen per row
+};
+
+struct profile_settings_t {
+	int level;
+	int strategy;
+	enum png_filter_t filter;
+};
+
+/* Indexed by profile - 1 */
+static const struct profile_settings_t kProfiles[PNG_PROFILE_COUNT] = {
+	{1, Z_DEFAULT_STRATEGY, PNG_FILTER_SUB},
+	{4, Z_DEFAULT_STRATEGY, PNG_FILTER_ADAPTIVE},
+	{9, Z_DEFAULT_STRATEGY, PNG_FILTER_ADAPTIVE}
+};
+
+static const unsigned char kSignature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+/* Signature, IHDR, IDAT header and crc, IEND */
+static const size_t kOverhead = 8 + 25 + 12 + 12;
+
+struct png_encoder_t {
+	z_stream streams[PNG_PROFILE_COUNT];
+	bool initialized[PNG_PROFILE_COUNT];
+	unsigned char * filtered; // filter type byte followed by filtered row, for every row
+	size_t filtered_capacity;
+	unsigned char * candidates; // scratch rows for adaptive filter
+	size_t candidates_capacity;
+	unsigned char * output;
+	size_t output_capacity;
+};
+
+static bool reserve(unsigned char ** buffer, size_t * capacity, size_t size)
+{
+	unsigned char * data;
+
+	if (*capacity >= size)
+		return true;
+	data = (unsigned char *) realloc(*buffer, size);
+	if (data == NULL)
+		return false;
+	*buffer = data;
+	*capacity = size;
+	return true;
+}
+
+static void put_uint32(unsigned char * data, unsigned long value)
+{
+	data[0] = (unsigned char)(value >> 24);
+	data[1] = (unsigned char)(value >> 16);
+	data[2] = (unsigned char)(value >> 8);
+	data[3] = (unsigned char)(value);
+}
+
+/**
+ * Writes chunk length and type, data is expected to follow them already
+ */
+static unsigned char * finish_chunk(unsigned char * chunk, const char * type, size_t length)
+{
+	put_uint32(chunk, (unsigned long)length);
+	memcpy(chunk + 4, type, 4);
+	put_uint32(chunk + 8 + length, crc32(0L, chunk + 4, (uInt)(length + 4)));
+	return chunk + 12 + length;
+}
+
+static unsigned char paeth(unsigned char a, unsigned char b, unsigned char c)
+{
+	int p = (int)a + (int)b - (int)c;
+	int pa = abs(p - (int)a);
+	int pb = abs(p - (int)b);
+	int pc = abs(p - (int)c);
+
+	if (pa <= pb && pa <= pc)
+		return a;
+	return (pb <= pc) ? b : c;
+}
+
+/**
+ * Filters the row, previous row is NULL for the first one
+ */
+static void filter_row(enum png_filter_t filter, const unsigned char * row, const unsigned char * previous,
+	size_t length, size_t bpp, unsigned char * out)
+{
+	size_t i;
+
+	switch (filter)
+	{
+	case PNG_FILTER_SUB:
+		for (i = 0; i < bpp; ++i)
+			out[i] = row[i];
+		for (; i < length; ++i)
+			out[i] = (unsigned char)(row[i] - row[i - bpp]);
+		break;
+	case PNG_FILTER_UP:
+		if (previous == NULL)
+			memcpy(out, row, length);
+		else
+			for (i = 0; i < length; ++i)
+				out[i] = (unsigned char)(row[i] - previous[i]);
+		break;
+	case PNG_FILTER_AVERAGE:
+		for (i = 0; i < length; ++i)
+		{
+			unsigned int left = (i >= bpp) ? row[i - bpp] : 0;
+			unsigned int up = (previous != NULL) ? previous[i] : 0;
+			out[i] = (unsigned char)(row[i] - (unsigned char)((left + up) / 2));
+		}
+		break;
+	case PNG_FILTER_PAETH:
+		for (i = 0; i < length; ++i)
+		{
+			unsigned char left = (i >= bpp) ? row[i - bpp] : 0;
+			unsigned char up = (previous != NULL) ? previous[i] : 0;
+			unsigned char corner = (i >= bpp && previous != NULL) ? previous[i - bpp] : 0;
+			out[i] = (unsigned char)(row[i] - paeth(left, up, corner));
+		}
+		break;
+	case PNG_FILTER_NONE:
+	default:
+		memcpy(out, row, length);
+		break;
+	}
+}
+
+/**
+ * Sum of absolute values of filtered bytes taken as signed, the usual heuristic
+ */
+static unsigned long estimate_row(const unsigned char * out, size_t length)
+{
+	unsigned long sum = 0;
+	for (size_t i = 0; i < length; ++i)
+		sum += (out[i] < 128) ? out[i] : 256 - out[i];
+	return sum;
+}
+
+static bool filter_image(struct png_encoder_t * encoder, const unsigned char * pixels,
+	int width, int height, int bytes_per_pixel, enum png_filter_t filter)
+{
+	size_t length = (size_t)width * (size_t)bytes_per_pixel;
+	size_t bpp = (size_t)bytes_per_pixel;
+	const unsigned char * previous = NULL;
+
+	if (!reserve(&encoder->filtered, &encoder->filtered_capacity, (length + 1) * (size_t)height))
+		return false;
+	if (filter == PNG_FILTER_ADAPTIVE
+		&& !reserve(&encoder->candidates, &encoder->candidates_capacity, length))
+		return false;
+
+	for (int y = 0; y < height; ++y)
+	{
+		const unsigned char * row = pixels + (size_t)y * length;
+		unsigned char * out = encoder->filtered + (size_t)y * (length + 1);
+
+		if (filter != PNG_FILTER_ADAPTIVE)
+		{
+			out[0] = (unsigned char)filter;
+			filter_row(filter, row, previous, length, bpp, out + 1);
+		}
+		else
+		{
+			// Best row is kept in the output, candidate is tried in scratch
+			unsigned char * candidate = encoder->candidates;
+			unsigned long best, estimate;
+
+			out[0] = PNG_FILTER_NONE;
+			memcpy(out + 1, row, length);
+			best = estimate_row(out + 1, length);
+			for (int type = PNG_FILTER_SUB; type <= PNG_FILTER_PAETH; ++type)
+			{
+				filter_row((enum png_filter_t)type, row, previous, length, bpp, candidate);
+				estimate = estimate_row(candidate, length);
+				if (estimate < best)
+				{
+					best = estimate;
+					out[0] = (unsigned char)type;
+					memcpy(out + 1, candidate, length);
+				}
+			}
+		}
+		previous = row;
+	}
+	return true;
+}
+
+static z_stream * get_stream(struct png_encoder_t * encoder, enum png_profile_t profile)
+{
+	int index = (int)profile - 1;
+	z_stream * stream = &encoder->streams[index];
+
+	if (encoder->initialized[index])
+	{
+		if (deflateReset(stream) != Z_OK)
+			return NULL;
+		return stream;
+	}
+	memset(stream, 0, sizeof(z_stream));
+	if (deflateInit2(stream, kProfiles[index].level, Z_DEFLATED, 15, 8, kProfiles[index].strategy) != Z_OK)
+		return NULL;
+	encoder->initialized[index] = true;
+	return stream;
+}
+
+struct png_encoder_t * png_encoder__create(void)
+{
+	return (struct png_encoder_t *) calloc(1, sizeof(struct png_encoder_t));
+}
+
+void png_encoder__destroy(struct png_encoder_t * encoder)
+{
+	if (encoder == NULL)
+		return;
+	for (int i = 0; i < PNG_PROFILE_COUNT; ++i)
+		if (encoder->initialized[i])
+			deflateEnd(&encoder->streams[i]);
+	free((void*)encoder->filtered);
+	free((void*)encoder->candidates);
+	free((void*)encoder->output);
+	free((void*)encoder);
+}
+
+bool png_encoder__encode(struct png_encoder_t * encoder, const unsigned char * pixels,
+	int width, int height, int bytes_per_pixel, enum png_profile_t profile,
+	const unsigned char ** data, size_t * size)
+{
+	const struct profile_settings_t * settings;
+	unsigned char * chunk;
+	z_stream * stream;
+	size_t filtered_size, idat_size;
+	int color_type;
+
+	switch (bytes_per_pixel)
+	{
+	case 1:
+		color_type = 0; // grayscale
+		break;
+	case 3:
+		color_type = 2; // truecolor
+		break;
+	case 4:
+		color_type = 6; // truecolor with alpha
+		break;
+	default:
+		return false;
+	}
+	if (profile < PNG_PROFILE_FAST || profile > PNG_PROFILE_SMALL)
+		return false;
+	settings = &kProfiles[(int)profile - 1];
+
+	if (!filter_image(encoder, pixels, width, height, bytes_per_pixel, settings->filter))
+		return false;
+	filtered_size = ((size_t)width * (size_t)bytes_per_pixel + 1) * (size_t)height;
+
+	stream = get_stream(encoder, profile);
+	if (stream == NULL)
+		return false;
+	if (!reserve(&encoder->output, &encoder->output_capacity,
+		kOverhead + (size_t)deflateBound(stream, (uLong)filtered_size)))
+		return false;
+
+	memcpy(encoder->output, kSignature, sizeof(kSignature));
+
+	// IHDR
+	chunk = encoder->output + sizeof(kSignature);
+	put_uint32(chunk + 8, (unsigned long)width);
+	put_uint32(chunk + 12, (unsigned long)height);
+	chunk[16] = 8; // bit depth
+	chunk[17] = (unsigned char)color_type;
+	chunk[18] = 0; // compression method
+	chunk[19] = 0; // filter method
+	chunk[20] = 0; // no interlace
+	chunk = finish_chunk(chunk, "IHDR", 13);
+
+	// IDAT, output has room for the whole stream
+	stream->next_in = encoder->filtered;
+	stream->avail_in = (uInt)filtered_size;
+	stream->next_out = chunk + 8;
+	stream->avail_out = (uInt)(encoder->output_capacity - (size_t)(chunk + 8 - encoder->output) - 16);
+	if (deflate(stream, Z_FINISH) != Z_STREAM_END)
+		return false;
+	idat_size = (size_t)stream->total_out;
+	chunk = finish_chunk(chunk, "IDAT", idat_size);
+
+	// IEND
+	chunk = finish_chunk(chunk, "IEND", 0);
+
+	// Caller copies the result out before the buffer is reused by the next image
+	*data = encoder->output;
+	*size = (size_t)(chunk - encoder->output);
+	return true;
+}
+
+bool png_encoder__parse_profile(const char * name, enum png_profile_t * profile)
+{
+	if (strcmp(name, "fast") == 0)
+		*profile = PNG_PROFILE_FAST;
+	else if (strcmp(name, "balanced") == 0)
+		*profile = PNG_PROFILE_BALANCED;
+	else if (strcmp(name, "small") == 0)
+		*profile = PNG_PROFILE_SMALL;
+	else
+		return false;
+	return true;
+}
@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __PNG_ENCODER_H__
+#define __PNG_ENCODER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Speed/size tradeoff of PNG encoding.
+ * Values are nonzero, so they may be used as tile key quality.
+ */
+enum png_profile_t {
+	PNG_PROFILE_FAST = 1,  // fastest zlib level with a cheap fixed filter
+	PNG_PROFILE_BALANCED,  // moderate zlib level with filter chosen per row
+	PNG_PROFILE_SMALL      // best zlib level with filter chosen per row
+};
+
+/**
+ * PNG encoder that keeps its deflate streams, filtered rows and output
+ * buffer between images. Each render context owns one.
+ * Not thread safe.
+ */
+struct png_encoder_t;
+
+struct png_encoder_t * png_encoder__create(void);
+void png_encoder__destroy(struct png_encoder_t * encoder);
+
+/**
+ * Encodes top-down grayscale, RGB or RGBA pixels.
+ *
+ * @param[in] encoder          The encoder.
+ * @param[in] pixels           Source pixels.
+ * @param[in] width            Image width.
+ * @param[in] height           Image height.
+ * @param[in] bytes_per_pixel  1, 3 or 4.
+ * @param[in] profile          Speed/size profile.
+ * @param[out] data            Encoded image in the encoder buffer, valid until the next call.
+ * @param[out] size            Encoded image size.
+ * @return True on success and false otherwise.
+ */
+bool png_encoder__encode(struct png_encoder_t * encoder, const unsigned char * pixels,
+	int width, int height, int bytes_per_pixel, enum png_profile_t profile,
+	const unsigned char ** data, size_t * size);
+
+/**
+ * Parses profile name like "fast", "balanced" or "small".
+ *
+ * @param[in] name      Profile name.
+ * @param[out] profile  Parsed profile.
+ * @return True on success and false if the name is unknown.
+ */
+bool png_encoder__parse_profile(const char * name, enum png_profile_t * profile);
+
+#endif
@@ -0,0 +1,230 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "prefetch.h"
+#include "server.h"
+#include "tile_render.h"
+#include "cube.h"
+
+#include "tinycthread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Time in milliseconds a thread waits for a spare render context */
+static const long kBackoffTime = 10;
+
+struct prefetch_t {
+	struct server_t * server;
+	struct tile_key_t * keys; // ring buffer, newest key is right before head
+	int capacity;
+	int head;
+	int count;
+	bool stopping;
+	mtx_t mutex;
+	cnd_t condition;
+	thrd_t * threads;
+	int thread_count;
+	struct prefetch_stats_t stats;
+};
+
+/* Should be called with mutex locked */
+static void push(struct prefetch_t * prefetch, const struct tile_key_t * key)
+{
+	int index = prefetch->head;
+
+	// Tile may be queued already by a nearby request
+	for (int i = 0; i < prefetch->count; ++i)
+	{
+		index = (index + prefetch->capacity - 1) % prefetch->capacity;
+		if (tile_key__equal(&prefetch->keys[index], key))
+			return;
+	}
+	prefetch->keys[prefetch->head] = *key;
+	prefetch->head = (prefetch->head + 1) % prefetch->capacity;
+	if (prefetch->count < prefetch->capacity)
+		++prefetch->count;
+	else
+		++prefetch->stats.dropped; // the oldest one is overwritten
+	++prefetch->stats.queued;
+}
+
+/* Should be called with mutex locked */
+static void pop(struct prefetch_t * prefetch, struct tile_key_t * key)
+{
+	prefetch->head = (prefetch->head + prefetch->capacity - 1) % prefetch->capacity;
+	--prefetch->count;
+	*key = prefetch->keys[prefetch->head];
+}
+
+static int thread_func(void * arg)
+{
+	struct prefetch_t * prefetch = (struct prefetch_t *) arg;
+	struct timespec duration;
+	struct tile_key_t key;
+	bool rendered;
+
+	duration.tv_sec = 0;
+	duration.tv_nsec = kBackoffTime * 1000000L;
+
+	for (;;)
+	{
+		mtx_lock(&prefetch->mutex);
+		while (!prefetch->stopping && prefetch->count == 0)
+			cnd_wait(&prefetch->condition, &prefetch->mutex);
+		if (prefetch->stopping)
+		{
+			mtx_unlock(&prefetch->mutex);
+			break;
+		}
+		pop(prefetch, &key);
+		mtx_unlock(&prefetch->mutex);
+
+		if (tile_render__prefetch(prefetch->server, &key, &rendered))
+		{
+			if (rendered)
+			{
+				mtx_lock(&prefetch->mutex);
+				++prefetch->stats.rendered;
+				mtx_unlock(&prefetch->mutex);
+			}
+			continue;
+		}
+
+		// Every render context is needed by requests, try later unless newer tiles came
+		mtx_lock(&prefetch->mutex);
+		if (prefetch->count < prefetch->capacity)
+		{
+			push(prefetch, &key);
+			--prefetch->stats.queued;
+		}
+		mtx_unlock(&prefetch->mutex);
+		thrd_sleep(&duration, NULL);
+	}
+	return 0;
+}
+
+struct prefetch_t * prefetch__create(struct server_t * server, int thread_count, int capacity)
+{
+	struct prefetch_t * prefetch;
+
+	if (thread_count < 1 || capacity < 1)
+		return NULL;
+	prefetch = (struct prefetch_t *) calloc(1, sizeof(struct prefetch_t));
+	if (prefetch == NULL)
+		return NULL;
+	prefetch->server = server;
+	prefetch->capacity = capacity;
+	prefetch->keys = (struct tile_key_t *) malloc(sizeof(struct tile_key_t) * (size_t)capacity);
+	prefetch->threads = (thrd_t *) malloc(sizeof(thrd_t) * (size_t)thread_count);
+	if (prefetch->keys == NULL || prefetch->threads == NULL)
+	{
+		free((void*)prefetch->threads);
+		free((void*)prefetch->keys);
+		free((void*)prefetch);
+		return NULL;
+	}
+	if (mtx_init(&prefetch->mutex, mtx_plain) == thrd_error)
+	{
+		free((void*)prefetch->threads);
+		free((void*)prefetch->keys);
+		free((void*)prefetch);
+		return NULL;
+	}
+	if (cnd_init(&prefetch->condition) == thrd_error)
+	{
+		mtx_destroy(&prefetch->mutex);
+		free((void*)prefetch->threads);
+		free((void*)prefetch->keys);
+		free((void*)prefetch);
+		return NULL;
+	}
+	for (int i = 0; i < thread_count; ++i)
+	{
+		if (thrd_create(&prefetch->threads[i], thread_func, (void*)prefetch) != thrd_success)
+		{
+			printf("Prefetch thread creation has failed\n");
+			break;
+		}
+		++prefetch->thread_count;
+	}
+	if (prefetch->thread_count == 0)
+	{
+		prefetch__destroy(prefetch);
+		return NULL;
+	}
+	return prefetch;
+}
+
+void prefetch__destroy(struct prefetch_t * prefetch)
+{
+	if (prefetch == NULL)
+		return;
+	mtx_lock(&prefetch->mutex);
+	prefetch->stopping = true;
+	cnd_broadcast(&prefetch->condition);
+	mtx_unlock(&prefetch->mutex);
+	for (int i = 0; i < prefetch->thread_count; ++i)
+		thrd_join(prefetch->threads[i], NULL);
+
+	cnd_destroy(&prefetch->condition);
+	mtx_destroy(&prefetch->mutex);
+	free((void*)prefetch->threads);
+	free((void*)prefetch->keys);
+	free((void*)prefetch);
+}
+
+static void make_key(struct server_t * server, const struct tile_key_t * served,
+	int face, int lod, int x, int y, struct tile_key_t * key)
+{
+	enum image_format_t format = (enum image_format_t) served->format;
+
+	key->face = face;
+	key->lod = lod;
+	key->x = x;
+	key->y = y;
+	key->format = served->format;
+	key->size = served->size;
+	// Explicitly requested quality is kept, default one follows the lod
+	if (served->quality == tile_render__default_quality(server, format, served->lod))
+		key->quality = tile_render__default_quality(server, format, lod);
+	else
+		key->quality = served->quality;
+}
+
+void prefetch__request(struct prefetch_t * prefetch, const struct tile_key_t * key)
+{
+	static const int kSteps[4][2] = {{0, -1}, {0, 1}, {-1, 0}, {1, 0}};
+	struct tile_key_t keys[8];
+	int count = 0;
+	int face, x, y;
+
+	if (key->lod < 0 || key->lod > 30)
+		return;
+
+	// Children are queued first, so neighbors of panning are taken first
+	if (key->lod < prefetch->server->prefetch_max_lod)
+		for (int i = 0; i < 4; ++i)
+			make_key(prefetch->server, key, key->face, key->lod + 1,
+				2 * key->x + (i & 1), 2 * key->y + (i >> 1), &keys[count++]);
+	for (int i = 0; i < 4; ++i)
+	{
+		cube__get_neighbor(key->face, key->lod, key->x, key->y, kSteps[i][0], kSteps[i][1], &face, &x, &y);
+		make_key(prefetch->server, key, face, key->lod, x, y, &keys[count++]);
+	}
+
+	mtx_lock(&prefetch->mutex);
+	for (int i = 0; i < count; ++i)
+		push(prefetch, &keys[i]);
+	cnd_broadcast(&prefetch->condition);
+	mtx_unlock(&prefetch->mutex);
+}
+
+void prefetch__get_stats(struct prefetch_t * prefetch, struct prefetch_stats_t * stats)
+{
+	mtx_lock(&prefetch->mutex);
+	*stats = prefetch->stats;
+	mtx_unlock(&prefetch->mutex);
+}
@@ -0,0 +1,45 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include "tile_key.h"
+
+struct server_t;
+
+/**
+ * Background renderer of tiles likely to be requested next:
+ * neighbors and children of served tiles. Rendered tiles go to the encoded tiles cache.
+ * Tiles are taken newest first from a bounded queue, the oldest ones are dropped when it's full.
+ * Only spare render contexts are used, so requests are never delayed.
+ */
+struct prefetch_t;
+
+struct prefetch_stats_t {
+	unsigned long long queued;
+	unsigned long long rendered;
+	unsigned long long dropped;
+};
+
+/**
+ * Creates the prefetcher and starts its threads.
+ *
+ * @param[in] server        The server with encoded tiles cache.
+ * @param[in] thread_count  Number of prefetch threads.
+ * @param[in] capacity      Queue capacity in tiles.
+ * @return The prefetcher or NULL on failure.
+ */
+struct prefetch_t * prefetch__create(struct server_t * server, int thread_count, int capacity);
+void prefetch__destroy(struct prefetch_t * prefetch);
+
+/**
+ * Queues neighbors and children of the served tile.
+ */
+void prefetch__request(struct prefetch_t * prefetch, const struct tile_key_t * key);
+
+void prefetch__get_stats(struct prefetch_t * prefetch, struct prefetch_stats_t * stats);
+
+#endif
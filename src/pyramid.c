@@ -0,0 +1,157 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "pyramid.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void make_raster_key(const struct tile_key_t * tile, int face, int lod, int x, int y, struct tile_key_t * key)
+{
+	key->face = face;
+	key->lod = lod;
+	key->x = x;
+	key->y = y;
+	key->format = 0;
+	key->quality = 0;
+	key->size = tile->size; // rasters of different tile sizes don't mix
+}
+
+/*
+Rows are summed vertically first into 16-bit sums, that loop is plain enough
+to be vectorized by the compiler, then adjacent pixels are averaged.
+*/
+static void downsample_rows(const unsigned char * row0, const unsigned char * row1,
+	int width, int bytes_per_pixel, unsigned short * sums, unsigned char * out)
+{
+	size_t length = (size_t)width * (size_t)bytes_per_pixel;
+	size_t bpp = (size_t)bytes_per_pixel;
+
+	for (size_t i = 0; i < length; ++i)
+		sums[i] = (unsigned short)(row0[i] + row1[i]);
+	for (size_t i = 0; i < length / 2; i += bpp)
+		for (size_t c = 0; c < bpp; ++c)
+			out[i + c] = (unsigned char)((sums[2 * i + c] + sums[2 * i + bpp + c] + 2) >> 2);
+}
+
+void pyramid__put(struct tile_cache_t * rasters, struct tile_buffer_pool_t * pool, const struct tile_key_t * key,
+	const unsigned char * pixels, size_t size)
+{
+	struct tile_key_t raster_key;
+	struct tile_buffer_t * buffer;
+
+	// Render context keeps its pixels, so the raster is copied once
+	buffer = tile_buffer__copy(pool, pixels, size);
+	if (buffer == NULL)
+		return;
+	make_raster_key(key, key->face, key->lod, key->x, key->y, &raster_key);
+	tile_cache__put(rasters, &raster_key, buffer);
+	tile_buffer__release(buffer);
+}
+
+bool pyramid__build_from_children(struct tile_cache_t * rasters, const struct tile_key_t * key,
+	int width, int height, int bytes_per_pixel, unsigned char * pixels)
+{
+	struct tile_key_t child_key;
+	struct tile_buffer_t * children[4] = {NULL, NULL, NULL, NULL};
+	unsigned short * sums;
+	size_t stride = (size_t)width * (size_t)bytes_per_pixel;
+	size_t expected = stride * (size_t)height;
+	bool result = false;
+
+	if ((width & 1) != 0 || (height & 1) != 0)
+		return false;
+	for (int i = 0; i < 4; ++i)
+	{
+		make_raster_key(key, key->face, key->lod + 1, 2 * key->x + (i & 1), 2 * key->y + (i >> 1), &child_key);
+		if (!tile_cache__get(rasters, &child_key, &children[i]) || children[i]->size != expected)
+			goto cleanup;
+	}
+	sums = (unsigned short *) malloc(sizeof(unsigned short) * stride);
+	if (sums == NULL)
+		goto cleanup;
+
+	for (int i = 0; i < 4; ++i)
+	{
+		// Child goes to its quadrant of the tile
+		unsigned char * quadrant = pixels
+			+ (size_t)(i >> 1) * (size_t)(height / 2) * stride
+			+ (size_t)(i & 1) * (stride / 2);
+		for (int y = 0; y < height / 2; ++y)
+		{
+			const unsigned char * row = tile_buffer__data(children[i]) + (size_t)(2 * y) * stride;
+			downsample_rows(row, row + stride, width, bytes_per_pixel, sums, quadrant + (size_t)y * stride);
+		}
+	}
+	free((void*)sums);
+	result = true;
+
+cleanup:
+	for (int i = 0; i < 4; ++i)
+		tile_buffer__release(children[i]);
+	return result;
+}
+
+/*
+Source coordinate of the output pixel center in parent pixels,
+split into the two nearest parent pixels and the weight of the second one out of 4.
+*/
+static void get_source_pixels(int position, int offset, int size, int * first, int * second, int * weight)
+{
+	// Quarter pixels: center of output pixel p lies at (2p + 1) / 4 - 1 / 2 in quadrant pixels
+	int quarter = 2 * position - 1 + 4 * offset;
+	int base = (quarter >= 0) ? quarter / 4 : -1;
+
+	*weight = quarter - 4 * base;
+	*first = (base < 0) ? 0 : base;
+	*second = (base + 1 >= size) ? size - 1 : base + 1;
+}
+
+bool pyramid__build_from_parent(struct tile_cache_t * rasters, const struct tile_key_t * key,
+	int width, int height, int bytes_per_pixel, unsigned char * pixels)
+{
+	struct tile_key_t parent_key;
+	struct tile_buffer_t * buffer;
+	const unsigned char * parent;
+	size_t stride = (size_t)width * (size_t)bytes_per_pixel;
+	size_t bpp = (size_t)bytes_per_pixel;
+	int x0, x1, wx, y0, y1, wy;
+
+	if (key->lod == 0 || (width & 1) != 0 || (height & 1) != 0)
+		return false;
+	make_raster_key(key, key->face, key->lod - 1, key->x / 2, key->y / 2, &parent_key);
+	if (!tile_cache__get(rasters, &parent_key, &buffer))
+		return false;
+	if (buffer->size != stride * (size_t)height)
+	{
+		tile_buffer__release(buffer);
+		return false;
+	}
+	parent = tile_buffer__data(buffer);
+
+	for (int y = 0; y < height; ++y)
+	{
+		get_source_pixels(y, (key->y & 1) * (height / 2), height, &y0, &y1, &wy);
+		for (int x = 0; x < width; ++x)
+		{
+			const unsigned char * p00, * p01, * p10, * p11;
+			unsigned char * out = pixels + (size_t)y * stride + (size_t)x * bpp;
+
+			get_source_pixels(x, (key->x & 1) * (width / 2), width, &x0, &x1, &wx);
+			p00 = parent + (size_t)y0 * stride + (size_t)x0 * bpp;
+			p01 = parent + (size_t)y0 * stride + (size_t)x1 * bpp;
+			p10 = parent + (size_t)y1 * stride + (size_t)x0 * bpp;
+			p11 = parent + (size_t)y1 * stride + (size_t)x1 * bpp;
+			for (size_t c = 0; c < bpp; ++c)
+			{
+				int top = p00[c] * (4 - wx) + p01[c] * wx;
+				int bottom = p10[c] * (4 - wx) + p11[c] * wx;
+				out[c] = (unsigned char)((top * (4 - wy) + bottom * wy + 8) >> 4);
+			}
+		}
+	}
+	tile_buffer__release(buffer);
+	return true;
+}
@@ -0,0 +1,48 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __PYRAMID_H__
+#define __PYRAMID_H__
+
+#include "tile_cache.h"
+#include "tile_key.h"
+
+/**
+ * Builds tile rasters from rasters of neighbouring lods kept in a raster cache,
+ * instead of rendering them from source imagery.
+ * Child (2x + i, 2y + j) of tile (x, y) covers its quadrant i, j,
+ * tile rows go the same direction as y.
+ */
+
+/**
+ * Stores a copy of the rendered raster of the tile. Rasters don't depend on image format.
+ */
+void pyramid__put(struct tile_cache_t * rasters, struct tile_buffer_pool_t * pool, const struct tile_key_t * key,
+	const unsigned char * pixels, size_t size);
+
+/**
+ * Builds the raster by 2x2 box downsampling of the four child rasters.
+ *
+ * @param[in] rasters          Raster cache.
+ * @param[in] key              Tile key.
+ * @param[in] width            Raster width, even.
+ * @param[in] height           Raster height, even.
+ * @param[in] bytes_per_pixel  Bytes per pixel.
+ * @param[out] pixels          Built raster.
+ * @return True if all children are cached and false otherwise.
+ */
+bool pyramid__build_from_children(struct tile_cache_t * rasters, const struct tile_key_t * key,
+	int width, int height, int bytes_per_pixel, unsigned char * pixels);
+
+/**
+ * Builds the raster by bilinear magnification of the parent raster quadrant.
+ * Used when source imagery of the tile is missing.
+ *
+ * @return True if the parent is cached and false otherwise.
+ */
+bool pyramid__build_from_parent(struct tile_cache_t * rasters, const struct tile_key_t * key,
+	int width, int height, int bytes_per_pixel, unsigned char * pixels);
+
+#endif
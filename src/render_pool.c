@@ -0,0 +1,318 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "render_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <unistd.h>
+#endif
+
+static void cleanup_targets(struct render_context_t * context)
+{
+	for (int i = 0; i < context->scale_count; ++i)
+	{
+		free((void*)context->targets[i].buffer);
+		context->targets[i].buffer = NULL;
+	}
+	context->scale_count = 0;
+	context->buffer = NULL;
+}
+
+static bool init_context(struct render_context_t * context, int width, int height, int bytes_per_pixel,
+	int max_scale)
+{
+	int saim_error;
+
+	context->bytes_per_pixel = bytes_per_pixel;
+
+	// Init saim
+	context->saim = saim_init(
+		"", // const char* path
+		NULL, // saim_provider_info * provider_info
+		0, // int flags
+		1, // int service_count
+		&saim_error); // int * error
+	if (context->saim == NULL)
+	{
+		printf("Saim init failed with error %i\n", saim_error);
+		return false;
+	}
+
+	// Allocate target buffers of every tile size
+	for (int i = 0; i < max_scale; ++i)
+	{
+		struct render_target_t * target = &context->targets[i];
+		target->width = width * (i + 1);
+		target->height = height * (i + 1);
+		target->buffer_size = sizeof(unsigned char) * target->width * target->height * bytes_per_pixel;
+		target->buffer = malloc(target->buffer_size);
+		if (target->buffer == NULL)
+		{
+			printf("Buffer allocation has failed O_o\n");
+			cleanup_targets(context);
+			saim_cleanup(context->saim);
+			context->saim = NULL;
+			return false;
+		}
+		++context->scale_count;
+	}
+
+	// Set saim target buffer
+	context->scale = 0;
+	render_pool__select_target(context, 1);
+	saim_set_bitmap_cache_size(context->saim, 50);
+
+	// Init encoders
+	context->jpeg = jpeg_encoder__create();
+	context->png = png_encoder__create();
+	if (context->jpeg == NULL || context->png == NULL)
+	{
+		printf("Encoders init has failed O_o\n");
+		jpeg_encoder__destroy(context->jpeg);
+		context->jpeg = NULL;
+		png_encoder__destroy(context->png);
+		context->png = NULL;
+		cleanup_targets(context);
+		saim_cleanup(context->saim);
+		context->saim = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+static void cleanup_context(struct render_context_t * context)
+{
+	if (context->jpeg != NULL)
+	{
+		jpeg_encoder__destroy(context->jpeg);
+		context->jpeg = NULL;
+	}
+	if (context->png != NULL)
+	{
+		png_encoder__destroy(context->png);
+		context->png = NULL;
+	}
+	cleanup_targets(context);
+	if (context->saim != NULL)
+	{
+		saim_cleanup(context->saim);
+		context->saim = NULL;
+	}
+}
+
+int render_pool__default_size(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (info.dwNumberOfProcessors > 0) ? (int)info.dwNumberOfProcessors : 1;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return (count > 0) ? (int)count : 1;
+#endif
+}
+
+struct render_pool_t * render_pool__create(int size, int width, int height, int bytes_per_pixel, int max_scale)
+{
+	struct render_pool_t * pool;
+
+	if (size < 1)
+		size = 1;
+	if (max_scale < 1)
+		max_scale = 1;
+	else if (max_scale > RENDER_MAX_SCALE)
+		max_scale = RENDER_MAX_SCALE;
+
+	pool = (struct render_pool_t *) malloc(sizeof(struct render_pool_t));
+	if (pool == NULL)
+		return NULL;
+	pool->contexts = (struct render_context_t *) calloc((size_t)size, sizeof(struct render_context_t));
+	if (pool->contexts == NULL)
+	{
+		free((void*)pool);
+		return NULL;
+	}
+	pool->size = 0;
+	pool->waiting = 0;
+
+	if (mtx_init(&pool->mutex, mtx_plain) == thrd_error)
+	{
+		free((void*)pool->contexts);
+		free((void*)pool);
+		return NULL;
+	}
+	if (cnd_init(&pool->condition) == thrd_error)
+	{
+		mtx_destroy(&pool->mutex);
+		free((void*)pool->contexts);
+		free((void*)pool);
+		return NULL;
+	}
+
+	for (int i = 0; i < size; ++i)
+	{
+		struct render_context_t * context = &pool->contexts[i];
+		if (!init_context(context, width, height, bytes_per_pixel, max_scale))
+		{
+			render_pool__destroy(pool);
+			return NULL;
+		}
+		context->index = i;
+		context->busy = false;
+		context->returning = 0;
+		++pool->size;
+	}
+
+	return pool;
+}
+
+void render_pool__destroy(struct render_pool_t * pool)
+{
+	if (pool == NULL)
+		return;
+	for (int i = 0; i < pool->size; ++i)
+		cleanup_context(&pool->contexts[i]);
+	cnd_destroy(&pool->condition);
+	mtx_destroy(&pool->mutex);
+	free((void*)pool->contexts);
+	free((void*)pool);
+}
+
+static struct render_context_t * find_free_context(struct render_pool_t * pool)
+{
+	for (int i = 0; i < pool->size; ++i)
+	{
+		struct render_context_t * context = &pool->contexts[i];
+		if (!context->busy && context->returning == 0)
+			return context;
+	}
+	return NULL;
+}
+
+struct render_context_t * render_pool__acquire(struct render_pool_t * pool)
+{
+	struct render_context_t * context;
+
+	mtx_lock(&pool->mutex);
+	++pool->waiting;
+	while ((context = find_free_context(pool)) == NULL)
+		cnd_wait(&pool->condition, &pool->mutex);
+	--pool->waiting;
+	context->busy = true;
+	mtx_unlock(&pool->mutex);
+
+	return context;
+}
+
+struct render_context_t * render_pool__acquire_timed(struct render_pool_t * pool, long milliseconds)
+{
+	struct render_context_t * context;
+	struct timespec deadline;
+
+	timespec_get(&deadline, TIME_UTC);
+	deadline.tv_sec += milliseconds / 1000;
+	deadline.tv_nsec += (milliseconds % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		++deadline.tv_sec;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	mtx_lock(&pool->mutex);
+	++pool->waiting;
+	while ((context = find_free_context(pool)) == NULL)
+		if (cnd_timedwait(&pool->condition, &pool->mutex, &deadline) == thrd_timedout)
+		{
+			context = find_free_context(pool);
+			break;
+		}
+	--pool->waiting;
+	if (context != NULL)
+		context->busy = true;
+	mtx_unlock(&pool->mutex);
+
+	return context;
+}
+
+struct render_context_t * render_pool__try_acquire(struct render_pool_t * pool)
+{
+	struct render_context_t * context = NULL;
+	int free_count = 0;
+
+	mtx_lock(&pool->mutex);
+	if (pool->waiting == 0)
+	{
+		for (int i = 0; i < pool->size; ++i)
+		{
+			struct render_context_t * candidate = &pool->contexts[i];
+			if (!candidate->busy && candidate->returning == 0)
+			{
+				context = candidate;
+				++free_count;
+			}
+		}
+		if (free_count < 2)
+			context = NULL;
+		else
+			context->busy = true;
+	}
+	mtx_unlock(&pool->mutex);
+
+	return context;
+}
+
+void render_pool__release(struct render_pool_t * pool, struct render_context_t * context)
+{
+	mtx_lock(&pool->mutex);
+	context->busy = false;
+	// Waiters may wait for a particular context, so wake all of them
+	cnd_broadcast(&pool->condition);
+	mtx_unlock(&pool->mutex);
+}
+
+void render_pool__park(struct render_pool_t * pool, struct render_context_t * context, long milliseconds)
+{
+	struct timespec duration;
+
+	render_pool__release(pool, context);
+
+	duration.tv_sec = milliseconds / 1000;
+	duration.tv_nsec = (milliseconds % 1000) * 1000000L;
+	thrd_sleep(&duration, NULL);
+
+	mtx_lock(&pool->mutex);
+	++context->returning;
+	while (context->busy)
+		cnd_wait(&pool->condition, &pool->mutex);
+	context->busy = true;
+	--context->returning;
+	mtx_unlock(&pool->mutex);
+}
+
+bool render_pool__select_target(struct render_context_t * context, int scale)
+{
+	struct render_target_t * target;
+
+	if (scale < 1 || scale > context->scale_count)
+		return false;
+	if (scale == context->scale)
+		return true;
+	target = &context->targets[scale - 1];
+	context->scale = scale;
+	context->buffer = target->buffer;
+	context->buffer_size = target->buffer_size;
+	context->width = target->width;
+	context->height = target->height;
+	saim_set_target(context->saim, context->buffer, context->width, context->height, context->bytes_per_pixel);
+	return true;
+}
@@ -0,0 +1,125 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __RENDER_POOL_H__
+#define __RENDER_POOL_H__
+
+#include "saim.h"
+#include "jpeg_encoder.h"
+#include "png_encoder.h"
+#include "tinycthread.h"
+
+#include <stddef.h>
+
+/* Maximum tile size multiplier, 2 is for HiDPI tiles */
+#define RENDER_MAX_SCALE 2
+
+/**
+ * Buffer of a single tile size
+ */
+struct render_target_t
+{
+	unsigned char * buffer;
+	size_t buffer_size;
+	int width;
+	int height;
+};
+
+/**
+ * Everything needed to render a single tile: saim instance with its own
+ * bitmap cache, the target buffers it renders to and encoders of the buffers.
+ */
+struct render_context_t
+{
+	struct saim_instance * saim;
+	struct jpeg_encoder_t * jpeg;
+	struct png_encoder_t * png;
+	struct render_target_t targets[RENDER_MAX_SCALE]; // target of scale i + 1
+	int scale_count;
+	int scale; // scale of the selected target, the fields below describe it
+	unsigned char * buffer;
+	size_t buffer_size;
+	int width;
+	int height;
+	int bytes_per_pixel;
+	int index;
+	bool busy;
+	int returning; // woken parked requests waiting to get this context back
+};
+
+/**
+ * Fixed set of render contexts checked out by requests
+ */
+struct render_pool_t
+{
+	struct render_context_t * contexts;
+	int size;
+	int waiting; // requests waiting for a free context
+	mtx_t mutex;
+	cnd_t condition;
+};
+
+/**
+ * Returns number of online processors, used as the default pool size.
+ */
+int render_pool__default_size(void);
+
+/**
+ * Creates the pool of contexts with targets of every scale up to the max one.
+ *
+ * @param[in] size             Number of contexts.
+ * @param[in] width            Width of the tile of scale 1.
+ * @param[in] height           Height of the tile of scale 1.
+ * @param[in] bytes_per_pixel  Bytes per pixel.
+ * @param[in] max_scale        Max tile size multiplier in range 1..RENDER_MAX_SCALE.
+ * @return The pool or NULL on failure.
+ */
+struct render_pool_t * render_pool__create(int size, int width, int height, int bytes_per_pixel, int max_scale);
+void render_pool__destroy(struct render_pool_t * pool);
+
+/**
+ * Checks out a context, waiting until one is free.
+ */
+struct render_context_t * render_pool__acquire(struct render_pool_t * pool);
+
+/**
+ * Checks out a context, waiting no longer than the given time.
+ *
+ * @return The context or NULL on timeout.
+ */
+struct render_context_t * render_pool__acquire_timed(struct render_pool_t * pool, long milliseconds);
+
+/**
+ * Checks out a context only if no request waits for one and another context
+ * stays free afterwards, so background work never delays requests.
+ *
+ * @return The context or NULL if there is no spare one.
+ */
+struct render_context_t * render_pool__try_acquire(struct render_pool_t * pool);
+
+void render_pool__release(struct render_pool_t * pool, struct render_context_t * context);
+
+/**
+ * Makes saim render into the target of the given scale.
+ * Other requests may select another target while the context is parked,
+ * so it has to be selected again before every render.
+ *
+ * @return False if the context has no target of that scale.
+ */
+bool render_pool__select_target(struct render_context_t * context, int scale);
+
+/**
+ * Parks the request while saim downloads its source tiles.
+ * The context is given to other requests for the given time and then
+ * checked out again, since pending downloads belong to its saim instance.
+ * Returning requests take precedence over new ones.
+ *
+ * @param[in] pool          The pool.
+ * @param[in] context       Context checked out by the caller.
+ * @param[in] milliseconds  Time to sleep without the context.
+ */
+void render_pool__park(struct render_pool_t * pool, struct render_context_t * context, long milliseconds);
+
+#endif
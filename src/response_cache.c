@@ -0,0 +1,234 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "response_cache.h"
+#include "lru_table.h"
+
+#include "tinycthread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define RESPONSE_CACHE_SHARD_COUNT 8
+#define RESPONSE_CACHE_BUCKET_COUNT 256
+
+/* Tile responses vary by Accept header when the format is negotiated */
+struct response_cache_key_t {
+	struct tile_key_t tile;
+	bool vary_accept;
+};
+
+struct response_cache_entry_t {
+	struct lru_node_t node; // first, entries are cast from nodes
+	struct response_cache_key_t key;
+	struct MHD_Response * response;
+	size_t size;
+};
+
+struct response_cache_shard_t {
+	mtx_t mutex;
+	struct lru_table_t table;
+	size_t bytes;
+	size_t max_bytes;
+	unsigned long long entries;
+	unsigned long long hits;
+};
+
+struct response_cache_t {
+	struct MHD_Response * pages[RESPONSE_PAGE_COUNT];
+	struct response_cache_shard_t shards[RESPONSE_CACHE_SHARD_COUNT];
+	size_t max_bytes;
+};
+
+static unsigned int get_hash(const struct response_cache_key_t * key)
+{
+	return tile_key__hash(&key->tile) ^ (key->vary_accept ? 0x9e3779b9u : 0u);
+}
+
+static bool match_key(const struct lru_node_t * node, const void * key)
+{
+	const struct response_cache_key_t * a = &((const struct response_cache_entry_t *) node)->key;
+	const struct response_cache_key_t * b = (const struct response_cache_key_t *) key;
+
+	return a->vary_accept == b->vary_accept && tile_key__equal(&a->tile, &b->tile);
+}
+
+static struct response_cache_entry_t * find_entry(struct response_cache_shard_t * shard,
+	const struct response_cache_key_t * key, unsigned int hash)
+{
+	return (struct response_cache_entry_t *) lru_table__find(&shard->table, hash, match_key, key);
+}
+
+static void remove_entry(struct response_cache_shard_t * shard, struct response_cache_entry_t * entry)
+{
+	lru_table__remove(&shard->table, &entry->node);
+	shard->bytes -= entry->size;
+	--shard->entries;
+	// Connections still sending the response keep it alive
+	MHD_destroy_response(entry->response);
+	free((void*)entry);
+}
+
+static struct response_cache_shard_t * get_shard(struct response_cache_t * cache, unsigned int hash)
+{
+	// Low bits select the bucket, so take the shard from the high ones
+	return &cache->shards[(hash >> 24) % RESPONSE_CACHE_SHARD_COUNT];
+}
+
+struct response_cache_t * response_cache__create(size_t max_bytes)
+{
+	struct response_cache_t * cache;
+
+	cache = (struct response_cache_t *) calloc(1, sizeof(struct response_cache_t));
+	if (cache == NULL)
+		return NULL;
+	cache->max_bytes = max_bytes;
+	for (int i = 0; i < RESPONSE_CACHE_SHARD_COUNT; ++i)
+	{
+		struct response_cache_shard_t * shard = &cache->shards[i];
+		shard->max_bytes = max_bytes / RESPONSE_CACHE_SHARD_COUNT;
+		if (!lru_table__init(&shard->table, RESPONSE_CACHE_BUCKET_COUNT) || mtx_init(&shard->mutex, mtx_plain) == thrd_error)
+		{
+			lru_table__free(&shard->table);
+			for (int j = 0; j < i; ++j)
+			{
+				mtx_destroy(&cache->shards[j].mutex);
+				lru_table__free(&cache->shards[j].table);
+			}
+			free((void*)cache);
+			return NULL;
+		}
+	}
+	return cache;
+}
+
+void response_cache__destroy(struct response_cache_t * cache)
+{
+	if (cache == NULL)
+		return;
+	for (int i = 0; i < RESPONSE_CACHE_SHARD_COUNT; ++i)
+	{
+		struct response_cache_shard_t * shard = &cache->shards[i];
+		while (lru_table__oldest(&shard->table) != NULL)
+			remove_entry(shard, (struct response_cache_entry_t *) lru_table__oldest(&shard->table));
+		mtx_destroy(&shard->mutex);
+		lru_table__free(&shard->table);
+	}
+	for (int i = 0; i < RESPONSE_PAGE_COUNT; ++i)
+		if (cache->pages[i] != NULL)
+			MHD_destroy_response(cache->pages[i]);
+	free((void*)cache);
+}
+
+void response_cache__set_page(struct response_cache_t * cache, enum response_page_t page, struct MHD_Response * response)
+{
+	if (cache->pages[page] != NULL)
+		MHD_destroy_response(cache->pages[page]);
+	cache->pages[page] = response;
+}
+
+bool response_cache__has_page(const struct response_cache_t * cache, enum response_page_t page)
+{
+	return cache->pages[page] != NULL;
+}
+
+int response_cache__queue_page(struct response_cache_t * cache, struct MHD_Connection * connection,
+	enum response_page_t page, unsigned int status)
+{
+	// Pages don't change once the daemon is started, so no lock is needed
+	if (cache->pages[page] == NULL)
+		return (int) MHD_NO;
+	return (int)MHD_queue_response(connection, status, cache->pages[page]);
+}
+
+bool response_cache__queue_tile(struct response_cache_t * cache, struct MHD_Connection * connection,
+	const struct tile_key_t * key, bool vary_accept, int * ret)
+{
+	struct response_cache_shard_t * shard;
+	struct response_cache_entry_t * entry;
+	struct response_cache_key_t lookup;
+	unsigned int hash;
+
+	if (cache->max_bytes == 0)
+		return false;
+	lookup.tile = *key;
+	lookup.vary_accept = vary_accept;
+	hash = get_hash(&lookup);
+	shard = get_shard(cache, hash);
+
+	// Response is queued under the lock, since queueing is the only way
+	// to take a reference that keeps it alive after eviction
+	mtx_lock(&shard->mutex);
+	entry = find_entry(shard, &lookup, hash);
+	if (entry != NULL)
+	{
+		*ret = (int)MHD_queue_response(connection, MHD_HTTP_OK, entry->response);
+		lru_table__touch(&shard->table, &entry->node);
+		++shard->hits;
+	}
+	mtx_unlock(&shard->mutex);
+
+	return entry != NULL;
+}
+
+void response_cache__put_tile(struct response_cache_t * cache, const struct tile_key_t * key, bool vary_accept,
+	struct MHD_Response * response, size_t size)
+{
+	struct response_cache_shard_t * shard;
+	struct response_cache_entry_t * entry;
+	struct response_cache_entry_t * existing;
+	struct response_cache_key_t lookup;
+	unsigned int hash;
+
+	lookup.tile = *key;
+	lookup.vary_accept = vary_accept;
+	hash = get_hash(&lookup);
+	shard = get_shard(cache, hash);
+	if (size > shard->max_bytes)
+	{
+		MHD_destroy_response(response);
+		return;
+	}
+
+	// Allocate outside of the lock
+	entry = (struct response_cache_entry_t *) malloc(sizeof(struct response_cache_entry_t));
+	if (entry == NULL)
+	{
+		MHD_destroy_response(response);
+		return;
+	}
+	entry->key = lookup;
+	entry->node.hash = hash;
+	entry->response = response;
+	entry->size = size;
+
+	mtx_lock(&shard->mutex);
+	// Concurrent requests of the same tile may have put it already
+	existing = find_entry(shard, &lookup, hash);
+	if (existing != NULL)
+		remove_entry(shard, existing);
+	// Free space
+	while (shard->bytes + size > shard->max_bytes && lru_table__oldest(&shard->table) != NULL)
+		remove_entry(shard, (struct response_cache_entry_t *) lru_table__oldest(&shard->table));
+	lru_table__insert(&shard->table, &entry->node);
+	shard->bytes += size;
+	++shard->entries;
+	mtx_unlock(&shard->mutex);
+}
+
+void response_cache__get_stats(struct response_cache_t * cache, struct response_cache_stats_t * stats)
+{
+	memset(stats, 0, sizeof(struct response_cache_stats_t));
+	stats->max_bytes = (unsigned long long) cache->max_bytes;
+	for (int i = 0; i < RESPONSE_CACHE_SHARD_COUNT; ++i)
+	{
+		struct response_cache_shard_t * shard = &cache->shards[i];
+		mtx_lock(&shard->mutex);
+		stats->hits += shard->hits;
+		stats->entries += shard->entries;
+		stats->bytes += (unsigned long long) shard->bytes;
+		mtx_unlock(&shard->mutex);
+	}
+}
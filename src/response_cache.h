@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __RESPONSE_CACHE_H__
+#define __RESPONSE_CACHE_H__
+
+#include "tile_key.h"
+
+#include <microhttpd.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Prebuilt MHD responses with all their headers attached.
+ * MHD responses are reference counted and may be queued on many connections at once,
+ * so fixed pages and hot tiles are queued as is instead of being built for every request.
+ * Tile responses are kept in a sharded LRU with a byte budget, like the tile cache.
+ */
+struct response_cache_t;
+
+enum response_page_t {
+	RESPONSE_PAGE_SERVER_ERROR,
+	RESPONSE_PAGE_NOT_FOUND,
+	RESPONSE_PAGE_OVERLOADED,
+	RESPONSE_PAGE_HELP,
+	RESPONSE_PAGE_HELP_GZIP,
+	RESPONSE_PAGE_COUNT
+};
+
+struct response_cache_stats_t {
+	unsigned long long hits;
+	unsigned long long entries;
+	unsigned long long bytes;
+	unsigned long long max_bytes;
+};
+
+/**
+ * Creates the cache.
+ *
+ * @param[in] max_bytes  Budget of tile data kept alive by tile responses, 0 disables tile responses.
+ * @return The cache or NULL on failure.
+ */
+struct response_cache_t * response_cache__create(size_t max_bytes);
+
+/**
+ * Destroys the cache. Responses still queued on connections live until they're sent.
+ */
+void response_cache__destroy(struct response_cache_t * cache);
+
+/**
+ * Sets the page response, the cache takes over the caller reference.
+ * Pages should be set before the daemon is started.
+ */
+void response_cache__set_page(struct response_cache_t * cache, enum response_page_t page, struct MHD_Response * response);
+
+bool response_cache__has_page(const struct response_cache_t * cache, enum response_page_t page);
+
+/**
+ * Queues the page response.
+ *
+ * @return MHD_queue_response result or MHD_NO when the page isn't set.
+ */
+int response_cache__queue_page(struct response_cache_t * cache, struct MHD_Connection * connection,
+	enum response_page_t page, unsigned int status);
+
+/**
+ * Queues the tile response with status 200 when it's cached.
+ *
+ * @param[in] cache        The cache.
+ * @param[in] connection   Connection to queue the response on.
+ * @param[in] key          Tile key.
+ * @param[in] vary_accept  Whether the response varies by Accept header.
+ * @param[out] ret         MHD_queue_response result.
+ * @return True on hit and false otherwise.
+ */
+bool response_cache__queue_tile(struct response_cache_t * cache, struct MHD_Connection * connection,
+	const struct tile_key_t * key, bool vary_accept, int * ret);
+
+/**
+ * Keeps the tile response, the cache takes over the caller reference.
+ *
+ * @param[in] size  Bytes of the tile buffer held by the response, accounted in the budget.
+ */
+void response_cache__put_tile(struct response_cache_t * cache, const struct tile_key_t * key, bool vary_accept,
+	struct MHD_Response * response, size_t size);
+
+void response_cache__get_stats(struct response_cache_t * cache, struct response_cache_stats_t * stats);
+
+#endif
@@ -5,69 +5,251 @@
 
 #include "server.h"
 #include "answer.h"
+#include "webp_encoder.h"
 
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-struct server_t * server__init(int width, int height, int bytes_per_pixel)
+/* Idle keep-alive connections cost nothing with epoll */
+#if defined(__linux__)
+# define SERVER_DAEMON_FLAGS MHD_USE_EPOLL_INTERNAL_THREAD
+#else
+# define SERVER_DAEMON_FLAGS MHD_USE_AUTO_INTERNAL_THREAD
+#endif
+
+void server_options__set_defaults(struct server_options_t * options)
+{
+	options->width = 256;
+	options->height = 256;
+	options->bytes_per_pixel = 3;
+	options->max_scale = 2;
+	options->cache_size = 64 * 1024 * 1024;
+	options->raster_cache_size = 32 * 1024 * 1024;
+	options->buffer_pool_size = 16 * 1024 * 1024;
+	options->hot_tiles_size = 16 * 1024 * 1024;
+	options->overzoom = false;
+	options->prefetch_threads = 0;
+	options->prefetch_max_lod = 18;
+	options->pool_size = render_pool__default_size();
+	options->render_queue = 64;
+	options->client_renders = 0;
+	options->max_connections = 1024;
+	options->retry_after = 1;
+	options->store_path = NULL;
+	options->store_size = (size_t)1024 * 1024 * 1024;
+	options->source_version = "1";
+	options->max_age = 86400;
+	options->max_age_rule_count = 0;
+	options->jpeg_quality = 95;
+	options->jpeg_subsampling = JPEG_SUBSAMPLING_420;
+	options->jpeg_rule_count = 0;
+	options->png_profile = PNG_PROFILE_FAST;
+	options->webp_quality = 80;
+	options->webp_lossless = false;
+	options->accept_webp = false;
+}
+
+struct server_t * server__init(const struct server_options_t * options)
 {
 	struct server_t * server;
-	int saim_error;
 
-	server = (struct server_t *) malloc(sizeof(struct server_t));
+	server = (struct server_t *) calloc(1, sizeof(struct server_t));
 	if (server == NULL)
 	{
 		printf("Server allocation has failed O_o\n");
 		return NULL;
 	}
 
-	server->saim = NULL;
-	server->daemon = NULL;
-	server->buffer = NULL;
-	server->width = width;
-	server->height = height;
-	server->bytes_per_pixel = bytes_per_pixel;
-	server->file_root = NULL;
-
-	// Init saim
-	server->saim = saim_init(
-		"", // const char* path
-		NULL, // saim_provider_info * provider_info
-		0, // int flags
-		1, // int service_count
-		&saim_error); // int * error
-	if (server->saim == NULL)
-	{
-		printf("Saim init failed with error %i\n", saim_error);
-		free((void*)server);
+	server->width = options->width;
+	server->height = options->height;
+	server->bytes_per_pixel = options->bytes_per_pixel;
+	strncpy(server->source_version, options->source_version, SERVER_SOURCE_VERSION_LENGTH - 1);
+	server->source_version[SERVER_SOURCE_VERSION_LENGTH - 1] = '\0';
+	server->max_age = options->max_age;
+	server->max_age_rule_count = options->max_age_rule_count;
+	memcpy(server->max_age_rules, options->max_age_rules, sizeof(server->max_age_rules));
+	server->jpeg_quality = options->jpeg_quality;
+	server->jpeg_subsampling = options->jpeg_subsampling;
+	server->jpeg_rule_count = options->jpeg_rule_count;
+	memcpy(server->jpeg_rules, options->jpeg_rules, sizeof(server->jpeg_rules));
+	server->png_profile = options->png_profile;
+	server->webp_quality = options->webp_quality;
+	server->webp_lossless = options->webp_lossless;
+	server->accept_webp = options->accept_webp && webp_encoder__is_available();
+	server->overzoom = options->overzoom && options->raster_cache_size != 0;
+	server->prefetch_max_lod = options->prefetch_max_lod;
+	server->max_connections = options->max_connections;
+	server->retry_after = options->retry_after;
+
+	// Init render contexts
+	server->pool = render_pool__create(options->pool_size,
+		options->width, options->height, options->bytes_per_pixel, options->max_scale);
+	if (server->pool == NULL)
+	{
+		printf("Render pool init has failed O_o\n");
+		server__free(server);
+		return NULL;
+	}
+	printf("Render pool size is %i\n", server->pool->size);
+	server->max_scale = server->pool->contexts[0].scale_count;
+
+	// Init pool of tile buffers, it outlives everything holding buffers
+	server->buffers = tile_buffer_pool__create(options->buffer_pool_size);
+	if (server->buffers == NULL)
+	{
+		printf("Tile buffer pool init has failed O_o\n");
+		server__free(server);
+		return NULL;
+	}
+
+	// Init encoded tiles cache
+	if (options->cache_size != 0)
+	{
+		server->cache = tile_cache__create(options->cache_size);
+		if (server->cache == NULL)
+		{
+			printf("Tile cache init has failed O_o\n");
+			server__free(server);
+			return NULL;
+		}
+	}
+
+	// Init rendered rasters cache
+	if (options->raster_cache_size != 0)
+	{
+		server->rasters = tile_cache__create(options->raster_cache_size);
+		if (server->rasters == NULL)
+		{
+			printf("Raster cache init has failed O_o\n");
+			server__free(server);
+			return NULL;
+		}
+	}
+
+	// Init persistent tile store
+	if (options->store_path != NULL)
+	{
+		server->store = tile_store__open(options->store_path, options->store_size);
+		if (server->store == NULL)
+		{
+			printf("Tile store init has failed O_o\n");
+			server__free(server);
+			return NULL;
+		}
+	}
+
+	// Init table of tiles being rendered
+	server->inflight = inflight_table__create();
+	if (server->inflight == NULL)
+	{
+		printf("In-flight table init has failed O_o\n");
+		server__free(server);
+		return NULL;
+	}
+
+	// Init cache of static file descriptors
+	server->files = file_cache__create(256, server->buffers);
+	if (server->files == NULL)
+	{
+		printf("File cache init has failed O_o\n");
+		server__free(server);
+		return NULL;
+	}
+
+	// Init request counters and latency histograms
+	server->metrics = metrics__create();
+	if (server->metrics == NULL)
+	{
+		printf("Metrics init has failed O_o\n");
+		server__free(server);
+		return NULL;
+	}
+
+	// Init prebuilt responses of fixed pages and hot tiles
+	server->responses = response_cache__create(options->hot_tiles_size);
+	if (server->responses == NULL || !answer__prepare_pages(server))
+	{
+		printf("Response cache init has failed O_o\n");
+		server__free(server);
 		return NULL;
 	}
 
-	// Set saim target buffer
-	server->buffer_size = sizeof(unsigned char) * width * height * bytes_per_pixel;
-	server->buffer = malloc(server->buffer_size);
-	if (server->buffer == NULL)
+	// Init admission control, requests rendering or waiting for a context are bounded
+	server->admission = admission__create(
+		server->pool->size + ((options->render_queue > 0) ? options->render_queue : 0),
+		options->client_renders);
+	if (server->admission == NULL)
 	{
-		printf("Buffer allocation has failed O_o\n");
-		saim_cleanup(server->saim);
-		free((void*)server);
+		printf("Admission control init has failed O_o\n");
+		server__free(server);
 		return NULL;
 	}
-	saim_set_target(server->saim, server->buffer, width, height, bytes_per_pixel);
-	saim_set_bitmap_cache_size(server->saim, 50);
 
-	// Init mutex
-	if (mtx_init(&server->mutex, mtx_plain) == thrd_error)
+	// Init render executor, twice as many threads as render contexts, since renders waiting
+	// for source tiles park their contexts for others. Coalesced requests don't take threads.
+	server->executor = executor__create(2 * server->pool->size);
+	if (server->executor == NULL)
 	{
-		printf("Mutex init has failed O_o\n");
-		saim_cleanup(server->saim);
-		free((void*)server);
+		printf("Render executor init has failed O_o\n");
+		server__free(server);
 		return NULL;
 	}
 
+	// Init prefetch of tiles to be requested next, it fills the encoded tiles cache
+	if (options->prefetch_threads > 0 && server->cache == NULL)
+		printf("Prefetch is disabled, since it requires the tile cache\n");
+	else if (options->prefetch_threads > 0)
+	{
+		server->prefetch = prefetch__create(server, options->prefetch_threads, 64);
+		if (server->prefetch == NULL)
+		{
+			printf("Prefetch init has failed O_o\n");
+			server__free(server);
+			return NULL;
+		}
+	}
+
 	return server;
 }
+int server__get_max_age(const struct server_t * server, int lod)
+{
+	// First matching rule wins
+	for (int i = 0; i < server->max_age_rule_count; ++i)
+	{
+		const struct max_age_rule_t * rule = &server->max_age_rules[i];
+		if (lod >= rule->min_lod && lod <= rule->max_lod)
+			return rule->seconds;
+	}
+	return server->max_age;
+}
+/* First matching rule wins, NULL when none matches */
+static const struct jpeg_rule_t * find_jpeg_rule(const struct server_t * server, int lod)
+{
+	for (int i = 0; i < server->jpeg_rule_count; ++i)
+	{
+		const struct jpeg_rule_t * rule = &server->jpeg_rules[i];
+		if (lod >= rule->min_lod && lod <= rule->max_lod)
+			return rule;
+	}
+	return NULL;
+}
+
+void server__get_jpeg_settings(const struct server_t * server, int lod,
+	int * quality, enum jpeg_subsampling_t * subsampling)
+{
+	const struct jpeg_rule_t * rule = find_jpeg_rule(server, lod);
+
+	*quality = (rule != NULL) ? rule->quality : server->jpeg_quality;
+	*subsampling = (rule != NULL) ? rule->subsampling : server->jpeg_subsampling;
+}
+
+enum jpeg_subsampling_t server__get_jpeg_subsampling(const struct server_t * server, int lod)
+{
+	const struct jpeg_rule_t * rule = find_jpeg_rule(server, lod);
+
+	return (rule != NULL) ? rule->subsampling : server->jpeg_subsampling;
+}
 int server__start(struct server_t * server, int port, const char * file_root, const char * index_file)
 {
 	if (server->daemon != NULL)
@@ -108,14 +290,18 @@ int server__start(struct server_t * server, int port, const char * file_root, co
 	}
 	// Start daemon
 	server->daemon = MHD_start_daemon(
-		MHD_USE_AUTO | MHD_USE_INTERNAL_POLLING_THREAD | MHD_USE_ERROR_LOG,
+		SERVER_DAEMON_FLAGS | MHD_ALLOW_SUSPEND_RESUME | MHD_USE_ERROR_LOG,
 		port, // port
 		NULL, // policy callback
 		NULL, // policy context
 		&answer_callback, // request callback
 		(void*)server, // request context
 		//MHD_OPTION_ARRAY, &array[0], MHD_OPTION_END
-		MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int) 120,
+		// Renders run on the executor, so these threads only do network I/O and cache hits
+		MHD_OPTION_THREAD_POOL_SIZE, (unsigned int) server->pool->size,
+		MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int) SERVER_CONNECTION_TIMEOUT,
+		MHD_OPTION_CONNECTION_LIMIT, (unsigned int) server->max_connections,
+		MHD_OPTION_NOTIFY_COMPLETED, &completed_callback, (void*)server,
 		MHD_OPTION_STRICT_FOR_CLIENT, (int) 1,
 		MHD_OPTION_END);
 	if (server->daemon == NULL)
@@ -130,6 +316,8 @@ void server__stop(struct server_t * server)
 {
 	if (server->daemon != NULL)
 	{
+		// Suspended connections have to be resumed before the daemon stops
+		executor__stop(server->executor);
 		MHD_stop_daemon(server->daemon);
 		server->daemon = NULL;
 	}
@@ -137,16 +325,65 @@ void server__stop(struct server_t * server)
 void server__free(struct server_t * server)
 {
 	server__stop(server);
-	mtx_destroy(&server->mutex);
-	if (server->buffer != NULL)
+	if (server->prefetch != NULL)
+	{
+		prefetch__destroy(server->prefetch);
+		server->prefetch = NULL;
+	}
+	if (server->executor != NULL)
+	{
+		executor__destroy(server->executor);
+		server->executor = NULL;
+	}
+	if (server->admission != NULL)
+	{
+		admission__destroy(server->admission);
+		server->admission = NULL;
+	}
+	if (server->responses != NULL)
+	{
+		response_cache__destroy(server->responses);
+		server->responses = NULL;
+	}
+	if (server->metrics != NULL)
+	{
+		metrics__destroy(server->metrics);
+		server->metrics = NULL;
+	}
+	if (server->files != NULL)
+	{
+		file_cache__destroy(server->files);
+		server->files = NULL;
+	}
+	if (server->inflight != NULL)
+	{
+		inflight_table__destroy(server->inflight);
+		server->inflight = NULL;
+	}
+	if (server->store != NULL)
+	{
+		tile_store__close(server->store);
+		server->store = NULL;
+	}
+	if (server->rasters != NULL)
+	{
+		tile_cache__destroy(server->rasters);
+		server->rasters = NULL;
+	}
+	if (server->cache != NULL)
+	{
+		tile_cache__destroy(server->cache);
+		server->cache = NULL;
+	}
+	if (server->buffers != NULL)
 	{
-		free((void*)server->buffer);
-		server->buffer = NULL;
+		tile_buffer_pool__destroy(server->buffers);
+		server->buffers = NULL;
 	}
-	if (server->saim != NULL)
+	if (server->pool != NULL)
 	{
-		saim_cleanup(server->saim);
-		server->saim = NULL;
+		render_pool__destroy(server->pool);
+		server->pool = NULL;
 	}
 	if (server->file_root != NULL)
 	{
@@ -6,25 +6,141 @@
 #ifndef __SERVER_H__
 #define __SERVER_H__
 
-#include "saim.h"
-#include "tinycthread.h"
+#include "render_pool.h"
+#include "tile_buffer.h"
+#include "tile_cache.h"
+#include "tile_store.h"
+#include "inflight.h"
+#include "file_cache.h"
+#include "metrics.h"
+#include "prefetch.h"
+#include "admission.h"
+#include "response_cache.h"
+#include "executor.h"
 #include <microhttpd.h>
 
+#define SERVER_MAX_AGE_RULE_COUNT 8
+#define SERVER_JPEG_RULE_COUNT 8
+#define SERVER_SOURCE_VERSION_LENGTH 32
+#define SERVER_CONNECTION_TIMEOUT 120 // seconds
+
+/**
+ * Cache lifetime of tiles in the range of lods
+ */
+struct max_age_rule_t
+{
+	int min_lod;
+	int max_lod;
+	int seconds;
+};
+
+/**
+ * JPEG encoder settings of tiles in the range of lods
+ */
+struct jpeg_rule_t
+{
+	int min_lod;
+	int max_lod;
+	int quality;
+	enum jpeg_subsampling_t subsampling;
+};
+
+/**
+ * Server options set from the command line
+ */
+struct server_options_t
+{
+	int width; // tile width of scale 1
+	int height; // tile height of scale 1
+	int bytes_per_pixel;
+	int max_scale; // tiles up to this multiple of the size are served, like 2 for 512x512 HiDPI tiles
+	size_t cache_size; // encoded tiles cache size in bytes, 0 disables the cache
+	size_t raster_cache_size; // rendered rasters cache size in bytes for building parent tiles, 0 disables it
+	size_t buffer_pool_size; // bytes of free tile buffers kept for reuse
+	size_t hot_tiles_size; // bytes of hot tiles with prebuilt responses, 0 disables them
+	bool overzoom; // tiles without source imagery are magnified from the cached parent raster
+	int prefetch_threads; // threads prefetching neighbors and children of served tiles, 0 disables prefetch
+	int prefetch_max_lod; // children are prefetched for tiles with smaller lods
+	int pool_size; // number of render contexts
+	int render_queue; // max number of requests waiting for a render context, the rest are rejected
+	int client_renders; // max number of renders of a single client address at once, 0 means no limit
+	int max_connections; // max number of connections accepted by the daemon
+	int retry_after; // seconds the rejected requests are told to wait
+	const char * store_path; // persistent tile store directory, NULL disables the store
+	size_t store_size; // persistent tile store size cap in bytes
+	const char * source_version; // imagery version, part of tile ETag
+	int max_age; // tile cache lifetime in seconds when no rule matches
+	struct max_age_rule_t max_age_rules[SERVER_MAX_AGE_RULE_COUNT];
+	int max_age_rule_count;
+	int jpeg_quality; // JPEG quality when no rule matches
+	enum jpeg_subsampling_t jpeg_subsampling; // JPEG chroma subsampling when no rule matches
+	struct jpeg_rule_t jpeg_rules[SERVER_JPEG_RULE_COUNT];
+	int jpeg_rule_count;
+	enum png_profile_t png_profile; // PNG encoding profile when not requested explicitly
+	int webp_quality; // WebP quality when not requested explicitly
+	bool webp_lossless; // WebP is lossless when not requested explicitly
+	bool accept_webp; // WebP is chosen by Accept header when format isn't given
+};
+
 struct server_t
 {
-	struct saim_instance * saim;
+	struct render_pool_t * pool;
+	struct tile_buffer_pool_t * buffers; // encoded tiles and rasters shared by caches and responses
+	struct tile_cache_t * cache;
+	struct tile_cache_t * rasters; // rendered rasters, for the pyramid of lower lods
+	struct tile_store_t * store;
+	struct inflight_table_t * inflight;
+	struct file_cache_t * files;
+	struct metrics_t * metrics;
+	struct response_cache_t * responses; // prebuilt responses of fixed pages and hot tiles
+	struct prefetch_t * prefetch;
+	struct admission_t * admission;
+	struct executor_t * executor;
 	struct MHD_Daemon * daemon;
-	unsigned char * buffer;
-	size_t buffer_size;
 	int width;
 	int height;
 	int bytes_per_pixel;
+	int max_scale;
+	char source_version[SERVER_SOURCE_VERSION_LENGTH];
+	int max_age;
+	struct max_age_rule_t max_age_rules[SERVER_MAX_AGE_RULE_COUNT];
+	int max_age_rule_count;
+	int jpeg_quality;
+	enum jpeg_subsampling_t jpeg_subsampling;
+	struct jpeg_rule_t jpeg_rules[SERVER_JPEG_RULE_COUNT];
+	int jpeg_rule_count;
+	enum png_profile_t png_profile;
+	int webp_quality;
+	bool webp_lossless;
+	bool accept_webp;
+	bool overzoom;
+	int prefetch_max_lod;
+	int max_connections;
+	int retry_after;
 	char * file_root;
 	char * index_file;
-	mtx_t mutex;
 };
 
-struct server_t * server__init(int width, int height, int bytes_per_pixel);
+void server_options__set_defaults(struct server_options_t * options);
+
+struct server_t * server__init(const struct server_options_t * options);
+
+/**
+ * Returns cache lifetime in seconds of tiles with given lod.
+ */
+int server__get_max_age(const struct server_t * server, int lod);
+
+/**
+ * Returns JPEG quality and chroma subsampling of tiles with given lod.
+ */
+void server__get_jpeg_settings(const struct server_t * server, int lod,
+	int * quality, enum jpeg_subsampling_t * subsampling);
+
+/**
+ * Returns JPEG chroma subsampling of tiles with given lod.
+ */
+enum jpeg_subsampling_t server__get_jpeg_subsampling(const struct server_t * server, int lod);
+
 int server__start(struct server_t * server, int port, const char * file_root, const char * index_file);
 void server__stop(struct server_t * server);
 void server__free(struct server_t * server);
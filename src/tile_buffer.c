@@ -0,0 +1,171 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "tile_buffer.h"
+
+#include "tinycthread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Size classes from 4 KiB to 1 MiB, enough for encoded tiles and rasters of 512x512 RGBA */
+#define TILE_BUFFER_MIN_CLASS_SHIFT 12
+#define TILE_BUFFER_CLASS_COUNT 9
+
+/* Data goes right after the header */
+#define TILE_BUFFER_HEADER_SIZE sizeof(struct tile_buffer_t)
+
+struct tile_buffer_class_t {
+	mtx_t mutex;
+	struct tile_buffer_t ** free_list; // stack of free buffers
+	int free_count;
+	int max_free_count;
+};
+
+struct tile_buffer_pool_t {
+	struct tile_buffer_class_t classes[TILE_BUFFER_CLASS_COUNT];
+};
+
+static size_t get_class_capacity(int size_class)
+{
+	return (size_t)1 << (TILE_BUFFER_MIN_CLASS_SHIFT + size_class);
+}
+
+/* Smallest class fitting the data, -1 when there is none */
+static int get_size_class(size_t size)
+{
+	for (int i = 0; i < TILE_BUFFER_CLASS_COUNT; ++i)
+		if (size <= get_class_capacity(i))
+			return i;
+	return -1;
+}
+
+struct tile_buffer_pool_t * tile_buffer_pool__create(size_t max_idle_bytes)
+{
+	struct tile_buffer_pool_t * pool;
+
+	pool = (struct tile_buffer_pool_t *) calloc(1, sizeof(struct tile_buffer_pool_t));
+	if (pool == NULL)
+		return NULL;
+	for (int i = 0; i < TILE_BUFFER_CLASS_COUNT; ++i)
+	{
+		struct tile_buffer_class_t * size_class = &pool->classes[i];
+
+		// Idle bytes are split evenly between the classes
+		size_class->max_free_count = (int)(max_idle_bytes / TILE_BUFFER_CLASS_COUNT / get_class_capacity(i));
+		size_class->free_list = (struct tile_buffer_t **) malloc(
+			sizeof(struct tile_buffer_t *) * (size_t)(size_class->max_free_count + 1));
+		if (size_class->free_list == NULL || mtx_init(&size_class->mutex, mtx_plain) == thrd_error)
+		{
+			free((void*)size_class->free_list);
+			for (int j = 0; j < i; ++j)
+			{
+				mtx_destroy(&pool->classes[j].mutex);
+				free((void*)pool->classes[j].free_list);
+			}
+			free((void*)pool);
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+void tile_buffer_pool__destroy(struct tile_buffer_pool_t * pool)
+{
+	if (pool == NULL)
+		return;
+	for (int i = 0; i < TILE_BUFFER_CLASS_COUNT; ++i)
+	{
+		struct tile_buffer_class_t * size_class = &pool->classes[i];
+		for (int j = 0; j < size_class->free_count; ++j)
+			free((void*)size_class->free_list[j]);
+		mtx_destroy(&size_class->mutex);
+		free((void*)size_class->free_list);
+	}
+	free((void*)pool);
+}
+
+struct tile_buffer_t * tile_buffer__create(struct tile_buffer_pool_t * pool, size_t size)
+{
+	struct tile_buffer_class_t * size_class;
+	struct tile_buffer_t * buffer = NULL;
+	int index;
+
+	index = get_size_class(size);
+	if (index >= 0)
+	{
+		size_class = &pool->classes[index];
+		mtx_lock(&size_class->mutex);
+		if (size_class->free_count > 0)
+			buffer = size_class->free_list[--size_class->free_count];
+		mtx_unlock(&size_class->mutex);
+		if (buffer == NULL)
+			buffer = (struct tile_buffer_t *) malloc(TILE_BUFFER_HEADER_SIZE + get_class_capacity(index));
+	}
+	else
+		buffer = (struct tile_buffer_t *) malloc(TILE_BUFFER_HEADER_SIZE + size);
+	if (buffer == NULL)
+		return NULL;
+	buffer->pool = pool;
+	buffer->size = size;
+	buffer->references = 1;
+	buffer->size_class = index;
+	return buffer;
+}
+
+struct tile_buffer_t * tile_buffer__copy(struct tile_buffer_pool_t * pool, const unsigned char * data, size_t size)
+{
+	struct tile_buffer_t * buffer;
+
+	buffer = tile_buffer__create(pool, size);
+	if (buffer != NULL)
+		memcpy(tile_buffer__data(buffer), data, size);
+	return buffer;
+}
+
+unsigned char * tile_buffer__data(struct tile_buffer_t * buffer)
+{
+	return (unsigned char *)buffer + TILE_BUFFER_HEADER_SIZE;
+}
+
+size_t tile_buffer__footprint(const struct tile_buffer_t * buffer)
+{
+	if (buffer->size_class < 0)
+		return TILE_BUFFER_HEADER_SIZE + buffer->size;
+	return TILE_BUFFER_HEADER_SIZE + get_class_capacity(buffer->size_class);
+}
+
+void tile_buffer__retain(struct tile_buffer_t * buffer)
+{
+	__atomic_fetch_add(&buffer->references, 1, __ATOMIC_RELAXED);
+}
+
+void tile_buffer__release(struct tile_buffer_t * buffer)
+{
+	struct tile_buffer_class_t * size_class;
+
+	if (buffer == NULL)
+		return;
+	// Writes of other owners happen before the buffer is reused
+	if (__atomic_sub_fetch(&buffer->references, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+	if (buffer->size_class >= 0)
+	{
+		size_class = &buffer->pool->classes[buffer->size_class];
+		mtx_lock(&size_class->mutex);
+		if (size_class->free_count < size_class->max_free_count)
+		{
+			size_class->free_list[size_class->free_count++] = buffer;
+			buffer = NULL;
+		}
+		mtx_unlock(&size_class->mutex);
+	}
+	free((void*)buffer);
+}
+
+void tile_buffer__free_callback(void * data)
+{
+	tile_buffer__release((struct tile_buffer_t *)((unsigned char *)data - TILE_BUFFER_HEADER_SIZE));
+}
@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __TILE_BUFFER_H__
+#define __TILE_BUFFER_H__
+
+#include <stddef.h>
+
+/**
+ * Pool of reference counted buffers of encoded tiles and rasters.
+ * A buffer is shared by the caches, coalesced requests and responses without copying,
+ * and goes back to the pool when the last reference is released.
+ * Buffers are taken from free lists of power of two sizes, so serving a tile doesn't allocate.
+ */
+struct tile_buffer_pool_t;
+
+/**
+ * Buffer header, data follows it in the same block
+ */
+struct tile_buffer_t {
+	struct tile_buffer_pool_t * pool;
+	size_t size;
+	int references;
+	int size_class; // -1 for buffers too large for the pool
+};
+
+/**
+ * Creates the pool.
+ *
+ * @param[in] max_idle_bytes  Max bytes of free buffers kept for reuse, the rest are freed.
+ * @return The pool or NULL on failure.
+ */
+struct tile_buffer_pool_t * tile_buffer_pool__create(size_t max_idle_bytes);
+
+/**
+ * Destroys the pool, every buffer should be released by then.
+ */
+void tile_buffer_pool__destroy(struct tile_buffer_pool_t * pool);
+
+/**
+ * Takes a buffer with a single reference, its data is uninitialized.
+ *
+ * @return The buffer or NULL on failure.
+ */
+struct tile_buffer_t * tile_buffer__create(struct tile_buffer_pool_t * pool, size_t size);
+
+/**
+ * Takes a buffer with a single reference and copies the data into it.
+ */
+struct tile_buffer_t * tile_buffer__copy(struct tile_buffer_pool_t * pool, const unsigned char * data, size_t size);
+
+unsigned char * tile_buffer__data(struct tile_buffer_t * buffer);
+
+/**
+ * Returns bytes the buffer actually holds: header and whole size class capacity,
+ * which is what memory budgets of buffer holders should account.
+ */
+size_t tile_buffer__footprint(const struct tile_buffer_t * buffer);
+
+void tile_buffer__retain(struct tile_buffer_t * buffer);
+
+/**
+ * Releases the reference, NULL is ignored.
+ */
+void tile_buffer__release(struct tile_buffer_t * buffer);
+
+/**
+ * Releases the reference given the buffer data, MHD free callback of responses made of buffers.
+ */
+void tile_buffer__free_callback(void * data);
+
+#endif
@@ -0,0 +1,213 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "tile_cache.h"
+#include "lru_table.h"
+
+#include "tinycthread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TILE_CACHE_SHARD_COUNT 16
+#define TILE_CACHE_AVERAGE_TILE_SIZE 16384
+
+struct tile_cache_entry_t {
+	struct lru_node_t node; // first, entries are cast from nodes
+	struct tile_key_t key;
+	struct tile_buffer_t * buffer;
+};
+
+struct tile_cache_shard_t {
+	mtx_t mutex;
+	struct lru_table_t table;
+	size_t bytes;
+	size_t max_bytes;
+	unsigned long long entries;
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+};
+
+struct tile_cache_t {
+	struct tile_cache_shard_t shards[TILE_CACHE_SHARD_COUNT];
+	size_t max_bytes;
+};
+
+static bool match_key(const struct lru_node_t * node, const void * key)
+{
+	return tile_key__equal(&((const struct tile_cache_entry_t *) node)->key, (const struct tile_key_t *) key);
+}
+
+static struct tile_cache_entry_t * find_entry(struct tile_cache_shard_t * shard, const struct tile_key_t * key, unsigned int hash)
+{
+	return (struct tile_cache_entry_t *) lru_table__find(&shard->table, hash, match_key, key);
+}
+
+static void remove_entry(struct tile_cache_shard_t * shard, struct tile_cache_entry_t * entry)
+{
+	lru_table__remove(&shard->table, &entry->node);
+	shard->bytes -= tile_buffer__footprint(entry->buffer);
+	--shard->entries;
+	// Buffer lives on while the tile is being sent
+	tile_buffer__release(entry->buffer);
+	free((void*)entry);
+}
+
+static struct tile_cache_shard_t * get_shard(struct tile_cache_t * cache, unsigned int hash)
+{
+	// Low bits select the bucket, so take the shard from the high ones
+	return &cache->shards[(hash >> 24) % TILE_CACHE_SHARD_COUNT];
+}
+
+struct tile_cache_t * tile_cache__create(size_t max_bytes)
+{
+	struct tile_cache_t * cache;
+	size_t shard_bytes;
+	unsigned int bucket_count;
+
+	cache = (struct tile_cache_t *) calloc(1, sizeof(struct tile_cache_t));
+	if (cache == NULL)
+		return NULL;
+	cache->max_bytes = max_bytes;
+
+	shard_bytes = max_bytes / TILE_CACHE_SHARD_COUNT;
+	bucket_count = 64;
+	while ((size_t)bucket_count * TILE_CACHE_AVERAGE_TILE_SIZE < shard_bytes && bucket_count < (1u << 20))
+		bucket_count <<= 1;
+
+	for (int i = 0; i < TILE_CACHE_SHARD_COUNT; ++i)
+	{
+		struct tile_cache_shard_t * shard = &cache->shards[i];
+		shard->max_bytes = shard_bytes;
+		if (!lru_table__init(&shard->table, bucket_count) || mtx_init(&shard->mutex, mtx_plain) == thrd_error)
+		{
+			lru_table__free(&shard->table);
+			for (int j = 0; j < i; ++j)
+			{
+				mtx_destroy(&cache->shards[j].mutex);
+				lru_table__free(&cache->shards[j].table);
+			}
+			free((void*)cache);
+			return NULL;
+		}
+	}
+	return cache;
+}
+
+void tile_cache__destroy(struct tile_cache_t * cache)
+{
+	if (cache == NULL)
+		return;
+	for (int i = 0; i < TILE_CACHE_SHARD_COUNT; ++i)
+	{
+		struct tile_cache_shard_t * shard = &cache->shards[i];
+		while (lru_table__oldest(&shard->table) != NULL)
+			remove_entry(shard, (struct tile_cache_entry_t *) lru_table__oldest(&shard->table));
+		mtx_destroy(&shard->mutex);
+		lru_table__free(&shard->table);
+	}
+	free((void*)cache);
+}
+
+bool tile_cache__get(struct tile_cache_t * cache, const struct tile_key_t * key, struct tile_buffer_t ** buffer)
+{
+	struct tile_cache_shard_t * shard;
+	struct tile_cache_entry_t * entry;
+	unsigned int hash;
+	bool found = false;
+
+	hash = tile_key__hash(key);
+	shard = get_shard(cache, hash);
+
+	mtx_lock(&shard->mutex);
+	entry = find_entry(shard, key, hash);
+	if (entry != NULL)
+	{
+		tile_buffer__retain(entry->buffer);
+		*buffer = entry->buffer;
+		lru_table__touch(&shard->table, &entry->node);
+		found = true;
+	}
+	if (found)
+		++shard->hits;
+	else
+		++shard->misses;
+	mtx_unlock(&shard->mutex);
+
+	return found;
+}
+
+bool tile_cache__contains(struct tile_cache_t * cache, const struct tile_key_t * key)
+{
+	struct tile_cache_shard_t * shard;
+	unsigned int hash;
+	bool found;
+
+	hash = tile_key__hash(key);
+	shard = get_shard(cache, hash);
+
+	mtx_lock(&shard->mutex);
+	found = find_entry(shard, key, hash) != NULL;
+	mtx_unlock(&shard->mutex);
+
+	return found;
+}
+
+void tile_cache__put(struct tile_cache_t * cache, const struct tile_key_t * key, struct tile_buffer_t * buffer)
+{
+	struct tile_cache_shard_t * shard;
+	struct tile_cache_entry_t * entry;
+	struct tile_cache_entry_t * existing;
+	unsigned int hash;
+	size_t size = tile_buffer__footprint(buffer);
+
+	hash = tile_key__hash(key);
+	shard = get_shard(cache, hash);
+	if (buffer->size == 0 || size > shard->max_bytes)
+		return;
+
+	// Allocate outside of the lock
+	entry = (struct tile_cache_entry_t *) malloc(sizeof(struct tile_cache_entry_t));
+	if (entry == NULL)
+		return;
+	tile_buffer__retain(buffer);
+	entry->buffer = buffer;
+	entry->key = *key;
+	entry->node.hash = hash;
+
+	mtx_lock(&shard->mutex);
+	// Replace an existing tile with the same key
+	existing = find_entry(shard, key, hash);
+	if (existing != NULL)
+		remove_entry(shard, existing);
+	// Free space
+	while (shard->bytes + size > shard->max_bytes && lru_table__oldest(&shard->table) != NULL)
+	{
+		remove_entry(shard, (struct tile_cache_entry_t *) lru_table__oldest(&shard->table));
+		++shard->evictions;
+	}
+	lru_table__insert(&shard->table, &entry->node);
+	shard->bytes += size;
+	++shard->entries;
+	mtx_unlock(&shard->mutex);
+}
+
+void tile_cache__get_stats(struct tile_cache_t * cache, struct tile_cache_stats_t * stats)
+{
+	memset(stats, 0, sizeof(struct tile_cache_stats_t));
+	stats->max_bytes = (unsigned long long) cache->max_bytes;
+	for (int i = 0; i < TILE_CACHE_SHARD_COUNT; ++i)
+	{
+		struct tile_cache_shard_t * shard = &cache->shards[i];
+		mtx_lock(&shard->mutex);
+		stats->hits += shard->hits;
+		stats->misses += shard->misses;
+		stats->evictions += shard->evictions;
+		stats->entries += shard->entries;
+		stats->bytes += (unsigned long long) shard->bytes;
+		mtx_unlock(&shard->mutex);
+	}
+}
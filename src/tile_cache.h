@@ -0,0 +1,55 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __TILE_CACHE_H__
+#define __TILE_CACHE_H__
+
+#include "tile_key.h"
+#include "tile_buffer.h"
+
+#include <stddef.h>
+
+/**
+ * Sharded LRU cache of encoded tiles with a total byte budget.
+ * Every shard has its own lock, so lookups of different tiles rarely contend.
+ * Tiles are kept as shared buffers, so neither lookups nor stores copy them.
+ */
+struct tile_cache_t;
+
+struct tile_cache_stats_t {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long entries;
+	unsigned long long bytes;
+	unsigned long long max_bytes;
+};
+
+struct tile_cache_t * tile_cache__create(size_t max_bytes);
+void tile_cache__destroy(struct tile_cache_t * cache);
+
+/**
+ * Looks up the tile and returns its buffer.
+ *
+ * @param[in] cache    The cache.
+ * @param[in] key      Tile key.
+ * @param[out] buffer  Tile buffer with a reference taken, must be released by the caller.
+ * @return True on hit and false otherwise.
+ */
+bool tile_cache__get(struct tile_cache_t * cache, const struct tile_key_t * key, struct tile_buffer_t ** buffer);
+
+/**
+ * Checks whether the tile is cached, without counting a hit or refreshing the tile.
+ */
+bool tile_cache__contains(struct tile_cache_t * cache, const struct tile_key_t * key);
+
+/**
+ * Stores the buffer taking a reference to it, evicting least recently used tiles of the shard when needed.
+ */
+void tile_cache__put(struct tile_cache_t * cache, const struct tile_key_t * key, struct tile_buffer_t * buffer);
+
+void tile_cache__get_stats(struct tile_cache_t * cache, struct tile_cache_stats_t * stats);
+
+#endif
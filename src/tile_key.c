@@ -0,0 +1,43 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "tile_key.h"
+
+static unsigned int mix(unsigned int hash, int value)
+{
+	// FNV-1a over the bytes of value
+	unsigned int v = (unsigned int) value;
+	for (int i = 0; i < 4; ++i)
+	{
+		hash ^= (v & 0xFFu);
+		hash *= 16777619u;
+		v >>= 8;
+	}
+	return hash;
+}
+
+unsigned int tile_key__hash(const struct tile_key_t * key)
+{
+	unsigned int hash = 2166136261u;
+	hash = mix(hash, key->face);
+	hash = mix(hash, key->lod);
+	hash = mix(hash, key->x);
+	hash = mix(hash, key->y);
+	hash = mix(hash, key->format);
+	hash = mix(hash, key->quality);
+	hash = mix(hash, key->size);
+	return hash;
+}
+
+bool tile_key__equal(const struct tile_key_t * a, const struct tile_key_t * b)
+{
+	return a->face == b->face
+		&& a->lod == b->lod
+		&& a->x == b->x
+		&& a->y == b->y
+		&& a->format == b->format
+		&& a->quality == b->quality
+		&& a->size == b->size;
+}
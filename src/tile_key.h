@@ -0,0 +1,27 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __TILE_KEY_H__
+#define __TILE_KEY_H__
+
+#include <stdbool.h>
+
+/**
+ * Identifies a single encoded tile
+ */
+struct tile_key_t {
+	int face;
+	int lod;
+	int x;
+	int y;
+	int format;  // enum image_format_t
+	int quality; // JPEG quality or PNG profile, 0 when format has none
+	int size;    // tile width in pixels
+};
+
+unsigned int tile_key__hash(const struct tile_key_t * key);
+bool tile_key__equal(const struct tile_key_t * a, const struct tile_key_t * b);
+
+#endif
@@ -0,0 +1,376 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "tile_render.h"
+#include "webp_encoder.h"
+#include "pixel_encoder.h"
+#include "pyramid.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Bounds of time in milliseconds a request sleeps between checks of its source tiles */
+static const long kMinSourceWaitTime = 1;
+static const long kMaxSourceWaitTime = 32;
+
+/* Time in milliseconds between cancellation checks while waiting for a render context */
+static const long kCancelCheckTime = 20;
+
+/**
+ * Render of a requested tile, abandoned when nobody waits for the tile anymore
+ */
+struct render_job_t {
+	struct tile_render_cancel_t * cancel; // NULL when the render is never abandoned
+	struct inflight_entry_t * entry; // NULL once abandoned or without coalescing
+};
+
+/*
+Context keeps its JPEG compressor between tiles,
+so only the quality and subsampling are set per tile.
+Encoded image stays in the compressor buffer and is copied once into a pooled buffer.
+*/
+static struct tile_buffer_t * encode_jpeg(struct server_t * server, struct render_context_t * context,
+	const struct tile_key_t * key)
+{
+	const unsigned char * data;
+	size_t size;
+
+	// Quality comes with the key, it's the per lod one unless requested explicitly
+	if (!jpeg_encoder__encode(context->jpeg, context->buffer,
+		context->width, context->height, context->bytes_per_pixel,
+		key->quality, server__get_jpeg_subsampling(server, key->lod), &data, &size))
+		return NULL;
+	return tile_buffer__copy(server->buffers, data, size);
+}
+
+/*
+PNG profile is kept in the key quality.
+*/
+static struct tile_buffer_t * encode_png(struct server_t * server, struct render_context_t * context,
+	const struct tile_key_t * key)
+{
+	const unsigned char * data;
+	size_t size;
+
+	if (!png_encoder__encode(context->png, context->buffer,
+		context->width, context->height, context->bytes_per_pixel,
+		(enum png_profile_t)key->quality, &data, &size))
+		return NULL;
+	return tile_buffer__copy(server->buffers, data, size);
+}
+
+static struct tile_buffer_t * encode_webp(struct server_t * server, struct render_context_t * context,
+	const struct tile_key_t * key)
+{
+	struct tile_buffer_t * buffer;
+	unsigned char * data;
+	size_t size;
+
+	if (!webp_encoder__encode(context->buffer, context->width, context->height, context->bytes_per_pixel,
+		key->quality, &data, &size))
+		return NULL;
+	buffer = tile_buffer__copy(server->buffers, data, size);
+	webp_encoder__free(data);
+	return buffer;
+}
+
+/*
+Pixel formats have known sizes, so they are encoded right into a pooled buffer.
+*/
+static struct tile_buffer_t * encode_pixels(struct server_t * server, struct render_context_t * context,
+	enum image_format_t format)
+{
+	struct tile_buffer_t * buffer;
+	size_t size;
+
+	if (format == FORMAT_RAW)
+		size = pixel_encoder__raw_size(context->width, context->height, context->bytes_per_pixel);
+	else
+		size = pixel_encoder__dxt1_size(context->width, context->height, context->bytes_per_pixel);
+	if (size == 0)
+		return NULL;
+	buffer = tile_buffer__create(server->buffers, size);
+	if (buffer == NULL)
+		return NULL;
+	if (format == FORMAT_RAW)
+		pixel_encoder__encode_raw(context->buffer, context->width, context->height, context->bytes_per_pixel,
+			tile_buffer__data(buffer));
+	else
+		pixel_encoder__encode_dxt1(context->buffer, context->width, context->height, context->bytes_per_pixel,
+			tile_buffer__data(buffer));
+	return buffer;
+}
+
+static struct tile_buffer_t * encode_tile(struct server_t * server, struct render_context_t * context,
+	const struct tile_key_t * key)
+{
+	switch ((enum image_format_t)key->format)
+	{
+	case FORMAT_JPEG:
+		return encode_jpeg(server, context, key);
+	case FORMAT_PNG:
+		return encode_png(server, context, key);
+	case FORMAT_WEBP:
+		return encode_webp(server, context, key);
+	case FORMAT_RAW:
+	case FORMAT_DXT1:
+		return encode_pixels(server, context, (enum image_format_t)key->format);
+	default:
+		return NULL;
+	}
+}
+
+/*
+Coalesced requests keep the render going even when its leader is gone.
+*/
+static bool is_abandoned(struct server_t * server, struct render_job_t * job)
+{
+	if (job == NULL || job->cancel == NULL)
+		return false;
+	if (job->cancel->cancelled)
+		return true;
+	if (!job->cancel->is_cancelled(job->cancel->arg))
+		return false;
+	if (job->entry != NULL)
+	{
+		if (!inflight_table__try_abandon(server->inflight, job->entry))
+			return false;
+		job->entry = NULL;
+	}
+	job->cancel->cancelled = true;
+	metrics__count_cancelled_render(server->metrics);
+	return true;
+}
+
+/* Tile size multiplier, 0 when the size isn't served */
+static int get_scale(const struct server_t * server, const struct tile_key_t * key)
+{
+	if (key->size <= 0 || key->size % server->width != 0)
+		return 0;
+	return key->size / server->width;
+}
+
+static bool render_mapped_cube(struct server_t * server, struct render_context_t * context, const struct tile_key_t * key,
+	struct render_job_t * job)
+{
+	long wait_time = kMinSourceWaitTime;
+	unsigned int iterations = 0;
+	unsigned long long start;
+	int tiles_left;
+
+	for (;;)
+	{
+		// Context may have rendered tiles of another size while parked
+		render_pool__select_target(context, get_scale(server, key));
+		start = metrics__now();
+		tiles_left = saim_render_mapped_cube(context->saim, key->face, key->lod, key->x, key->y);
+		metrics__observe(server->metrics, METRICS_STAGE_RENDER, metrics__now() - start);
+		++iterations;
+		if (tiles_left <= 0)
+			break;
+		// Source tiles are still being downloaded by saim service thread.
+		// Sleep and let requests that are ready to rasterize use the context meanwhile.
+		start = metrics__now();
+		render_pool__park(server->pool, context, wait_time);
+		metrics__observe(server->metrics, METRICS_STAGE_SOURCE_WAIT, metrics__now() - start);
+		if (wait_time < kMaxSourceWaitTime)
+			wait_time *= 2;
+		if (is_abandoned(server, job))
+		{
+			metrics__count_render_iterations(server->metrics, iterations);
+			return false;
+		}
+	}
+	metrics__count_render_iterations(server->metrics, iterations);
+
+	// -1 means that inner error has occured
+	return tiles_left == 0;
+}
+
+int tile_render__default_quality(const struct server_t * server, enum image_format_t format, int lod)
+{
+	enum jpeg_subsampling_t subsampling;
+	int quality;
+
+	switch (format)
+	{
+	case FORMAT_JPEG:
+		server__get_jpeg_settings(server, lod, &quality, &subsampling);
+		return quality;
+	case FORMAT_PNG:
+		return (int)server->png_profile;
+	case FORMAT_WEBP:
+		return server->webp_lossless ? 0 : server->webp_quality;
+	default:
+		return 0;
+	}
+}
+
+/*
+Raster comes from cached children rasters when all of them are there,
+otherwise it's rendered from source imagery. Tiles without source imagery
+may be magnified from the cached parent raster.
+*/
+static bool build_raster(struct server_t * server, struct render_context_t * context, const struct tile_key_t * key,
+	struct render_job_t * job)
+{
+	if (!render_pool__select_target(context, get_scale(server, key)))
+		return false;
+	if (server->rasters == NULL)
+		return render_mapped_cube(server, context, key, job);
+
+	if (pyramid__build_from_children(server->rasters, key,
+		context->width, context->height, context->bytes_per_pixel, context->buffer))
+	{
+		metrics__count_pyramid_tile(server->metrics, false);
+	}
+	else if (!render_mapped_cube(server, context, key, job))
+	{
+		if (!server->overzoom || is_abandoned(server, job) || !pyramid__build_from_parent(server->rasters, key,
+			context->width, context->height, context->bytes_per_pixel, context->buffer))
+			return false;
+		// Magnified raster isn't cached, so it's never downsampled back into the parent
+		metrics__count_pyramid_tile(server->metrics, true);
+		return true;
+	}
+	pyramid__put(server->rasters, server->buffers, key, context->buffer, context->buffer_size);
+	return true;
+}
+
+/*
+The context buffer is only valid until the context is released,
+so encoding has to happen before that. Encoded tile ends up in a pooled buffer
+that is shared by the caches and responses from then on.
+*/
+static bool render_tile(struct server_t * server, struct render_context_t * context, const struct tile_key_t * key,
+	struct render_job_t * job, struct tile_buffer_t ** buffer)
+{
+	unsigned long long start;
+
+	if (!build_raster(server, context, key, job) || is_abandoned(server, job))
+		return false;
+	start = metrics__now();
+	*buffer = encode_tile(server, context, key);
+	metrics__observe(server->metrics, METRICS_STAGE_ENCODE, metrics__now() - start);
+	return *buffer != NULL;
+}
+
+/*
+Requests that may be abandoned don't wait for a context indefinitely,
+so nothing is rendered for them once their clients are gone.
+*/
+static struct render_context_t * acquire_context(struct server_t * server, struct render_job_t * job)
+{
+	struct render_context_t * context;
+	unsigned long long start;
+
+	start = metrics__now();
+	if (job == NULL || job->cancel == NULL)
+		context = render_pool__acquire(server->pool);
+	else
+		while ((context = render_pool__acquire_timed(server->pool, kCancelCheckTime)) == NULL)
+			if (is_abandoned(server, job))
+				break;
+	metrics__observe(server->metrics, METRICS_STAGE_CONTEXT_WAIT, metrics__now() - start);
+
+	return context;
+}
+
+bool tile_render__render(struct server_t * server, const struct tile_key_t * key, struct tile_buffer_t ** buffer)
+{
+	struct render_context_t * context;
+	bool result;
+
+	context = acquire_context(server, NULL);
+	result = render_tile(server, context, key, NULL, buffer);
+	render_pool__release(server->pool, context);
+
+	return result;
+}
+
+bool tile_render__get_cached(struct server_t * server, const struct tile_key_t * key,
+	struct tile_buffer_t ** buffer)
+{
+	// Encoded tiles cache is consulted before checking out a render context
+	if (server->cache != NULL && tile_cache__get(server->cache, key, buffer))
+		return true;
+
+	// Then the persistent store, warming up the cache on hit
+	if (server->store != NULL && tile_store__get(server->store, key, server->buffers, buffer))
+	{
+		if (server->cache != NULL)
+			tile_cache__put(server->cache, key, *buffer);
+		return true;
+	}
+	return false;
+}
+
+enum tile_render_result_t tile_render__get_rendered(struct server_t * server, const struct tile_key_t * key,
+	struct tile_render_cancel_t * cancel, struct inflight_waiter_t * waiter, struct tile_buffer_t ** buffer)
+{
+	struct render_context_t * context;
+	struct render_job_t job;
+	bool rendered;
+
+	if (cancel != NULL)
+		cancel->cancelled = false;
+
+	// Concurrent requests for the same tile share a single render
+	job.cancel = cancel;
+	if (!inflight_table__begin(server->inflight, key, &job.entry, waiter))
+		return TILE_RENDER_WAITING;
+
+	// Render and encode depending on requested image format
+	rendered = false;
+	context = acquire_context(server, &job);
+	if (context != NULL)
+	{
+		rendered = render_tile(server, context, key, &job, buffer);
+		render_pool__release(server->pool, context);
+	}
+	if (rendered && server->cache != NULL)
+		tile_cache__put(server->cache, key, *buffer);
+	if (rendered && server->store != NULL)
+		tile_store__put(server->store, key, *buffer);
+	inflight_table__finish(server->inflight, job.entry, rendered ? *buffer : NULL);
+	return rendered ? TILE_RENDER_DONE : TILE_RENDER_FAILED;
+}
+
+bool tile_render__prefetch(struct server_t * server, const struct tile_key_t * key, bool * rendered)
+{
+	struct render_context_t * context;
+	struct inflight_entry_t * entry;
+	struct tile_buffer_t * buffer;
+
+	*rendered = false;
+	if (tile_cache__contains(server->cache, key))
+		return true;
+	if (server->store != NULL && tile_store__get(server->store, key, server->buffers, &buffer))
+	{
+		tile_cache__put(server->cache, key, buffer);
+		tile_buffer__release(buffer);
+		return true;
+	}
+
+	context = render_pool__try_acquire(server->pool);
+	if (context == NULL)
+		return false;
+	// Tile requested meanwhile is rendered by the request
+	if (inflight_table__try_begin(server->inflight, key, &entry))
+	{
+		*rendered = render_tile(server, context, key, NULL, &buffer);
+		if (*rendered)
+		{
+			tile_cache__put(server->cache, key, buffer);
+			if (server->store != NULL)
+				tile_store__put(server->store, key, buffer);
+		}
+		inflight_table__finish(server->inflight, entry, *rendered ? buffer : NULL);
+		if (*rendered)
+			tile_buffer__release(buffer);
+	}
+	render_pool__release(server->pool, context);
+	return true;
+}
@@ -0,0 +1,85 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __TILE_RENDER_H__
+#define __TILE_RENDER_H__
+
+#include "server.h"
+#include "image_format.h"
+#include "tile_key.h"
+#include "tile_buffer.h"
+#include "inflight.h"
+
+/**
+ * Tells whether the tile is still needed by its requester.
+ * Long renders check it while waiting for a render context or source tiles.
+ */
+struct tile_render_cancel_t {
+	bool (*is_cancelled)(void * arg);
+	void * arg;
+	bool cancelled; // set when the render has been abandoned
+};
+
+enum tile_render_result_t {
+	TILE_RENDER_FAILED,
+	TILE_RENDER_DONE,
+	TILE_RENDER_WAITING // tile is rendered by another request, the waiter gets the result
+};
+
+/**
+ * Returns encoder quality used for the format and lod when it's not requested explicitly.
+ */
+int tile_render__default_quality(const struct server_t * server, enum image_format_t format, int lod);
+
+/**
+ * Renders the tile on a render context from the server pool and encodes it.
+ *
+ * @param[in] server   The server.
+ * @param[in] key      Tile key, format and quality select the encoder.
+ * @param[out] buffer  Encoded tile, must be released by the caller.
+ * @return True on success and false otherwise.
+ */
+bool tile_render__render(struct server_t * server, const struct tile_key_t * key, struct tile_buffer_t ** buffer);
+
+/**
+ * Returns the tile from the encoded tiles cache or the persistent store.
+ * Store hit is put into the cache.
+ *
+ * @param[in] server   The server.
+ * @param[in] key      Tile key.
+ * @param[out] buffer  Encoded tile, must be released by the caller.
+ * @return True if the tile has been found and false otherwise.
+ */
+bool tile_render__get_cached(struct server_t * server, const struct tile_key_t * key,
+	struct tile_buffer_t ** buffer);
+
+/**
+ * Renders the tile, the caches aren't consulted. Rendered tile is put into the cache and the store.
+ * When the tile is being rendered by another request already, the waiter is registered
+ * and notified with its result instead, so the caller thread isn't held.
+ * Render is abandoned once it's cancelled, unless waiters wait for it.
+ *
+ * @param[in] server   The server.
+ * @param[in] key      Tile key.
+ * @param[in] cancel   Cancellation check, may be NULL.
+ * @param[in] waiter   Waiter of the render of another request.
+ * @param[out] buffer  Encoded tile when done, must be released by the caller.
+ * @return Render result, the caller job belongs to the waiter notification when it's waiting.
+ */
+enum tile_render_result_t tile_render__get_rendered(struct server_t * server, const struct tile_key_t * key,
+	struct tile_render_cancel_t * cancel, struct inflight_waiter_t * waiter, struct tile_buffer_t ** buffer);
+
+/**
+ * Renders the tile into the encoded tiles cache on a spare render context,
+ * unless it's cached, stored or being rendered already.
+ *
+ * @param[in] server     The server with encoded tiles cache.
+ * @param[in] key        Tile key.
+ * @param[out] rendered  True if the tile has been rendered.
+ * @return False if there is no spare render context and true otherwise.
+ */
+bool tile_render__prefetch(struct server_t * server, const struct tile_key_t * key, bool * rendered);
+
+#endif
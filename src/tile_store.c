@@ -0,0 +1,680 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#if !defined(_WIN32) && !defined(_XOPEN_SOURCE)
+# define _XOPEN_SOURCE 500 // pread, pwrite, ftruncate
+#endif
+
+#include "tile_store.h"
+
+#include "tinycthread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+
+/* Memory mapped store is implemented for POSIX systems only */
+
+struct tile_store_t * tile_store__open(const char * path, size_t max_bytes)
+{
+	(void) path;
+	(void) max_bytes;
+	printf("Tile store isn't supported on this platform\n");
+	return NULL;
+}
+void tile_store__close(struct tile_store_t * store)
+{
+	(void) store;
+}
+bool tile_store__get(struct tile_store_t * store, const struct tile_key_t * key,
+	struct tile_buffer_pool_t * pool, struct tile_buffer_t ** buffer)
+{
+	(void) store; (void) key; (void) pool; (void) buffer;
+	return false;
+}
+bool tile_store__contains(struct tile_store_t * store, const struct tile_key_t * key)
+{
+	(void) store; (void) key;
+	return false;
+}
+void tile_store__put(struct tile_store_t * store, const struct tile_key_t * key, struct tile_buffer_t * buffer)
+{
+	(void) store; (void) key; (void) buffer;
+}
+void tile_store__flush(struct tile_store_t * store)
+{
+	(void) store;
+}
+void tile_store__get_stats(struct tile_store_t * store, struct tile_store_stats_t * stats)
+{
+	(void) store;
+	memset(stats, 0, sizeof(struct tile_store_stats_t));
+}
+
+#else
+
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define TILE_STORE_SEGMENT_COUNT 4
+#define TILE_STORE_MAX_QUEUE_BYTES (32 * 1024 * 1024)
+#define TILE_STORE_INITIAL_BUCKET_COUNT 1024
+#define TILE_STORE_SEGMENT_MAGIC 0x50535445u // "ETSP"
+#define TILE_STORE_RECORD_MAGIC 0x454C4954u // "TILE"
+#define TILE_STORE_VERSION 2u
+
+/* Both headers are written in host byte order */
+struct tile_store_segment_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t generation;
+};
+
+struct tile_store_record_header_t {
+	uint32_t magic;
+	uint32_t size;
+	int32_t face;
+	int32_t lod;
+	int32_t x;
+	int32_t y;
+	int32_t format;
+	int32_t quality;
+	int32_t tile_size;
+};
+
+struct tile_store_segment_t {
+	int fd;
+	unsigned char * map; // mapping of the whole segment capacity
+	uint64_t generation;
+	size_t end;          // end of the last complete record
+	int readers;         // readers copying from the mapping
+};
+
+struct tile_store_entry_t {
+	struct tile_key_t key;
+	unsigned int hash;
+	int segment;
+	size_t offset;       // data offset in the segment
+	size_t size;
+	struct tile_store_entry_t * next;
+};
+
+struct tile_store_item_t {
+	struct tile_key_t key;
+	struct tile_buffer_t * buffer;
+	size_t size;
+	struct tile_store_item_t * next;
+};
+
+struct tile_store_t {
+	struct tile_store_segment_t segments[TILE_STORE_SEGMENT_COUNT];
+	size_t segment_capacity;
+	int active;
+
+	// Index
+	struct tile_store_entry_t ** buckets;
+	unsigned int bucket_count;
+	unsigned long long entries;
+	unsigned long long bytes;
+
+	// Write queue
+	struct tile_store_item_t * queue_head;
+	struct tile_store_item_t * queue_tail;
+	size_t queue_bytes;
+	bool writing;
+	bool finishing;
+	thrd_t writer;
+
+	mtx_t mutex;
+	cnd_t readers_condition;
+	cnd_t queue_condition;
+
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long writes;
+	unsigned long long dropped;
+	unsigned long long evictions;
+};
+
+static size_t align_record_size(size_t size)
+{
+	return (sizeof(struct tile_store_record_header_t) + size + 7) & ~(size_t)7;
+}
+
+static struct tile_store_entry_t ** find_slot(struct tile_store_t * store, const struct tile_key_t * key, unsigned int hash)
+{
+	struct tile_store_entry_t ** slot = &store->buckets[hash & (store->bucket_count - 1)];
+	while (*slot != NULL)
+	{
+		if ((*slot)->hash == hash && tile_key__equal(&(*slot)->key, key))
+			break;
+		slot = &(*slot)->next;
+	}
+	return slot;
+}
+
+static void grow_index(struct tile_store_t * store)
+{
+	struct tile_store_entry_t ** buckets;
+	unsigned int bucket_count = store->bucket_count * 2;
+
+	buckets = (struct tile_store_entry_t **) calloc(bucket_count, sizeof(struct tile_store_entry_t *));
+	if (buckets == NULL)
+		return; // keep longer chains
+	for (unsigned int i = 0; i < store->bucket_count; ++i)
+	{
+		struct tile_store_entry_t * entry = store->buckets[i];
+		while (entry != NULL)
+		{
+			struct tile_store_entry_t * next = entry->next;
+			entry->next = buckets[entry->hash & (bucket_count - 1)];
+			buckets[entry->hash & (bucket_count - 1)] = entry;
+			entry = next;
+		}
+	}
+	free((void*)store->buckets);
+	store->buckets = buckets;
+	store->bucket_count = bucket_count;
+}
+
+/* Should be called with store mutex locked */
+static void index_insert(struct tile_store_t * store, const struct tile_key_t * key, int segment, size_t offset, size_t size)
+{
+	struct tile_store_entry_t ** slot;
+	struct tile_store_entry_t * entry;
+	unsigned int hash;
+
+	hash = tile_key__hash(key);
+	slot = find_slot(store, key, hash);
+	entry = *slot;
+	if (entry == NULL)
+	{
+		entry = (struct tile_store_entry_t *) malloc(sizeof(struct tile_store_entry_t));
+		if (entry == NULL)
+			return;
+		entry->key = *key;
+		entry->hash = hash;
+		entry->next = NULL;
+		*slot = entry;
+		++store->entries;
+		if (store->entries > 2 * (unsigned long long)store->bucket_count)
+			grow_index(store);
+	}
+	else
+		store->bytes -= entry->size;
+	entry->segment = segment;
+	entry->offset = offset;
+	entry->size = size;
+	store->bytes += size;
+}
+
+/* Should be called with store mutex locked */
+static void index_remove_segment(struct tile_store_t * store, int segment)
+{
+	for (unsigned int i = 0; i < store->bucket_count; ++i)
+	{
+		struct tile_store_entry_t ** slot = &store->buckets[i];
+		while (*slot != NULL)
+		{
+			struct tile_store_entry_t * entry = *slot;
+			if (entry->segment == segment)
+			{
+				*slot = entry->next;
+				store->bytes -= entry->size;
+				--store->entries;
+				++store->evictions;
+				free((void*)entry);
+			}
+			else
+				slot = &entry->next;
+		}
+	}
+}
+
+static bool reset_segment(struct tile_store_segment_t * segment, uint64_t generation)
+{
+	struct tile_store_segment_header_t header;
+
+	header.magic = TILE_STORE_SEGMENT_MAGIC;
+	header.version = TILE_STORE_VERSION;
+	header.generation = generation;
+	if (ftruncate(segment->fd, 0) != 0)
+		return false;
+	if (pwrite(segment->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+		return false;
+	segment->generation = generation;
+	segment->end = sizeof(header);
+	return true;
+}
+
+static bool open_segment(struct tile_store_t * store, int index, const char * path)
+{
+	struct tile_store_segment_t * segment = &store->segments[index];
+	struct tile_store_segment_header_t header;
+	char filename[1024];
+	struct stat info;
+
+	snprintf(filename, sizeof(filename), "%s/tiles.%i.pack", path, index);
+	segment->fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if (segment->fd < 0)
+	{
+		printf("Failed to open pack file %s\n", filename);
+		return false;
+	}
+	if (fstat(segment->fd, &info) != 0)
+		return false;
+
+	// Start a new segment when the file is empty or unknown
+	if ((size_t)info.st_size < sizeof(header)
+		|| pread(segment->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+		|| header.magic != TILE_STORE_SEGMENT_MAGIC
+		|| header.version != TILE_STORE_VERSION)
+	{
+		if (!reset_segment(segment, 0))
+			return false;
+		info.st_size = (off_t)segment->end;
+	}
+	else
+		segment->generation = header.generation;
+
+	// Mapping covers the whole capacity, so it never has to be remapped as file grows
+	segment->map = (unsigned char *) mmap(NULL, store->segment_capacity, PROT_READ, MAP_SHARED, segment->fd, 0);
+	if (segment->map == (unsigned char *) MAP_FAILED)
+	{
+		segment->map = NULL;
+		printf("Failed to map pack file %s\n", filename);
+		return false;
+	}
+
+	// Find the end of complete records, the rest is a torn write
+	segment->end = sizeof(header);
+	while (segment->end + sizeof(struct tile_store_record_header_t) <= (size_t)info.st_size)
+	{
+		struct tile_store_record_header_t record;
+		size_t record_size;
+
+		memcpy(&record, segment->map + segment->end, sizeof(record));
+		record_size = align_record_size(record.size);
+		if (record.magic != TILE_STORE_RECORD_MAGIC
+			|| record.size == 0
+			|| segment->end + record_size > (size_t)info.st_size
+			|| segment->end + record_size > store->segment_capacity)
+			break;
+		segment->end += record_size;
+	}
+	if ((size_t)info.st_size != segment->end && ftruncate(segment->fd, (off_t)segment->end) != 0)
+		return false;
+
+	return true;
+}
+
+static void index_segment(struct tile_store_t * store, int index)
+{
+	struct tile_store_segment_t * segment = &store->segments[index];
+	size_t offset = sizeof(struct tile_store_segment_header_t);
+
+	while (offset < segment->end)
+	{
+		struct tile_store_record_header_t record;
+		struct tile_key_t key;
+
+		memcpy(&record, segment->map + offset, sizeof(record));
+		key.face = record.face;
+		key.lod = record.lod;
+		key.x = record.x;
+		key.y = record.y;
+		key.format = record.format;
+		key.quality = record.quality;
+		key.size = record.tile_size;
+		index_insert(store, &key, index, offset + sizeof(record), (size_t)record.size);
+		offset += align_record_size(record.size);
+	}
+}
+
+/* Should be called with store mutex locked */
+static void rotate_segments(struct tile_store_t * store)
+{
+	struct tile_store_segment_t * segment;
+	uint64_t generation;
+	int oldest;
+
+	oldest = (store->active + 1) % TILE_STORE_SEGMENT_COUNT;
+	generation = store->segments[store->active].generation + 1;
+	for (int i = 0; i < TILE_STORE_SEGMENT_COUNT; ++i)
+		if (store->segments[i].generation < store->segments[oldest].generation)
+			oldest = i;
+
+	segment = &store->segments[oldest];
+	index_remove_segment(store, oldest);
+	while (segment->readers > 0)
+		cnd_wait(&store->readers_condition, &store->mutex);
+	if (!reset_segment(segment, generation))
+		printf("Failed to reset pack file %i\n", oldest);
+	store->active = oldest;
+}
+
+static void write_item(struct tile_store_t * store, struct tile_store_item_t * item)
+{
+	struct tile_store_segment_t * segment;
+	struct tile_store_record_header_t record;
+	size_t record_size, offset;
+	int index;
+
+	record_size = align_record_size(item->size);
+	if (record_size > store->segment_capacity - sizeof(struct tile_store_segment_header_t))
+		return;
+
+	mtx_lock(&store->mutex);
+	if (store->segments[store->active].end + record_size > store->segment_capacity)
+		rotate_segments(store);
+	index = store->active;
+	segment = &store->segments[index];
+	offset = segment->end;
+	mtx_unlock(&store->mutex);
+
+	// Only the writer thread appends, so the range is ours
+	memset(&record, 0, sizeof(record));
+	record.magic = TILE_STORE_RECORD_MAGIC;
+	record.size = (uint32_t)item->size;
+	record.face = item->key.face;
+	record.lod = item->key.lod;
+	record.x = item->key.x;
+	record.y = item->key.y;
+	record.format = item->key.format;
+	record.quality = item->key.quality;
+	record.tile_size = item->key.size;
+	if (pwrite(segment->fd, tile_buffer__data(item->buffer), item->size, (off_t)(offset + sizeof(record))) != (ssize_t)item->size
+		|| pwrite(segment->fd, &record, sizeof(record), (off_t)offset) != (ssize_t)sizeof(record)
+		|| ftruncate(segment->fd, (off_t)(offset + record_size)) != 0)
+	{
+		printf("Failed to write tile to pack file %i\n", index);
+		return;
+	}
+
+	mtx_lock(&store->mutex);
+	segment->end = offset + record_size;
+	index_insert(store, &item->key, index, offset + sizeof(record), item->size);
+	++store->writes;
+	mtx_unlock(&store->mutex);
+}
+
+static int writer_thread_func(void * arg)
+{
+	struct tile_store_t * store = (struct tile_store_t *) arg;
+	struct tile_store_item_t * item;
+
+	mtx_lock(&store->mutex);
+	for (;;)
+	{
+		while (store->queue_head == NULL && !store->finishing)
+			cnd_wait(&store->queue_condition, &store->mutex);
+		if (store->queue_head == NULL)
+			break;
+		item = store->queue_head;
+		store->queue_head = item->next;
+		if (store->queue_head == NULL)
+			store->queue_tail = NULL;
+		store->writing = true;
+		mtx_unlock(&store->mutex);
+
+		write_item(store, item);
+
+		mtx_lock(&store->mutex);
+		store->queue_bytes -= item->size;
+		store->writing = false;
+		cnd_broadcast(&store->queue_condition);
+		mtx_unlock(&store->mutex);
+		tile_buffer__release(item->buffer);
+		free((void*)item);
+		mtx_lock(&store->mutex);
+	}
+	mtx_unlock(&store->mutex);
+
+	return 0;
+}
+
+static void cleanup_store(struct tile_store_t * store)
+{
+	for (int i = 0; i < TILE_STORE_SEGMENT_COUNT; ++i)
+	{
+		struct tile_store_segment_t * segment = &store->segments[i];
+		if (segment->map != NULL)
+			munmap((void*)segment->map, store->segment_capacity);
+		if (segment->fd >= 0)
+			close(segment->fd);
+	}
+	if (store->buckets != NULL)
+	{
+		for (unsigned int i = 0; i < store->bucket_count; ++i)
+		{
+			struct tile_store_entry_t * entry = store->buckets[i];
+			while (entry != NULL)
+			{
+				struct tile_store_entry_t * next = entry->next;
+				free((void*)entry);
+				entry = next;
+			}
+		}
+		free((void*)store->buckets);
+	}
+	free((void*)store);
+}
+
+struct tile_store_t * tile_store__open(const char * path, size_t max_bytes)
+{
+	struct tile_store_t * store;
+	int order[TILE_STORE_SEGMENT_COUNT];
+
+	store = (struct tile_store_t *) calloc(1, sizeof(struct tile_store_t));
+	if (store == NULL)
+		return NULL;
+	for (int i = 0; i < TILE_STORE_SEGMENT_COUNT; ++i)
+		store->segments[i].fd = -1;
+	store->segment_capacity = max_bytes / TILE_STORE_SEGMENT_COUNT;
+	if (store->segment_capacity < 1024 * 1024)
+		store->segment_capacity = 1024 * 1024;
+
+	store->bucket_count = TILE_STORE_INITIAL_BUCKET_COUNT;
+	store->buckets = (struct tile_store_entry_t **) calloc(store->bucket_count, sizeof(struct tile_store_entry_t *));
+	if (store->buckets == NULL)
+	{
+		cleanup_store(store);
+		return NULL;
+	}
+
+	if (mkdir(path, 0755) != 0 && errno != EEXIST)
+	{
+		printf("Failed to create tile store directory %s\n", path);
+		cleanup_store(store);
+		return NULL;
+	}
+	for (int i = 0; i < TILE_STORE_SEGMENT_COUNT; ++i)
+	{
+		if (!open_segment(store, i, path))
+		{
+			cleanup_store(store);
+			return NULL;
+		}
+	}
+
+	// Index segments from oldest to newest, so newer records win
+	for (int i = 0; i < TILE_STORE_SEGMENT_COUNT; ++i)
+		order[i] = i;
+	for (int i = 1; i < TILE_STORE_SEGMENT_COUNT; ++i)
+		for (int j = i; j > 0 && store->segments[order[j]].generation < store->segments[order[j-1]].generation; --j)
+		{
+			int temp = order[j];
+			order[j] = order[j-1];
+			order[j-1] = temp;
+		}
+	for (int i = 0; i < TILE_STORE_SEGMENT_COUNT; ++i)
+		index_segment(store, order[i]);
+	store->active = order[TILE_STORE_SEGMENT_COUNT - 1];
+	store->evictions = 0;
+
+	if (mtx_init(&store->mutex, mtx_plain) == thrd_error)
+	{
+		cleanup_store(store);
+		return NULL;
+	}
+	if (cnd_init(&store->readers_condition) == thrd_error)
+	{
+		mtx_destroy(&store->mutex);
+		cleanup_store(store);
+		return NULL;
+	}
+	if (cnd_init(&store->queue_condition) == thrd_error)
+	{
+		cnd_destroy(&store->readers_condition);
+		mtx_destroy(&store->mutex);
+		cleanup_store(store);
+		return NULL;
+	}
+	if (thrd_create(&store->writer, writer_thread_func, (void*)store) != thrd_success)
+	{
+		cnd_destroy(&store->queue_condition);
+		cnd_destroy(&store->readers_condition);
+		mtx_destroy(&store->mutex);
+		cleanup_store(store);
+		return NULL;
+	}
+
+	printf("Tile store %s has %llu tiles\n", path, store->entries);
+	return store;
+}
+
+void tile_store__close(struct tile_store_t * store)
+{
+	if (store == NULL)
+		return;
+
+	mtx_lock(&store->mutex);
+	store->finishing = true;
+	cnd_broadcast(&store->queue_condition);
+	mtx_unlock(&store->mutex);
+	thrd_join(store->writer, NULL);
+
+	cnd_destroy(&store->queue_condition);
+	cnd_destroy(&store->readers_condition);
+	mtx_destroy(&store->mutex);
+	cleanup_store(store);
+}
+
+bool tile_store__get(struct tile_store_t * store, const struct tile_key_t * key,
+	struct tile_buffer_pool_t * pool, struct tile_buffer_t ** buffer)
+{
+	struct tile_store_segment_t * segment;
+	struct tile_store_entry_t * entry;
+	size_t offset, size;
+
+	mtx_lock(&store->mutex);
+	entry = *find_slot(store, key, tile_key__hash(key));
+	if (entry == NULL)
+	{
+		++store->misses;
+		mtx_unlock(&store->mutex);
+		return false;
+	}
+	segment = &store->segments[entry->segment];
+	offset = entry->offset;
+	size = entry->size;
+	// Segment can't be recycled while we're reading it
+	++segment->readers;
+	mtx_unlock(&store->mutex);
+
+	*buffer = tile_buffer__copy(pool, segment->map + offset, size);
+
+	mtx_lock(&store->mutex);
+	if (--segment->readers == 0)
+		cnd_broadcast(&store->readers_condition);
+	if (*buffer != NULL)
+		++store->hits;
+	else
+		++store->misses;
+	mtx_unlock(&store->mutex);
+
+	return *buffer != NULL;
+}
+
+bool tile_store__contains(struct tile_store_t * store, const struct tile_key_t * key)
+{
+	struct tile_store_item_t * item;
+	bool found;
+
+	mtx_lock(&store->mutex);
+	found = *find_slot(store, key, tile_key__hash(key)) != NULL;
+	for (item = store->queue_head; item != NULL && !found; item = item->next)
+		found = tile_key__equal(&item->key, key);
+	mtx_unlock(&store->mutex);
+
+	return found;
+}
+
+void tile_store__put(struct tile_store_t * store, const struct tile_key_t * key, struct tile_buffer_t * buffer)
+{
+	struct tile_store_item_t * item;
+	size_t size = buffer->size;
+
+	item = (struct tile_store_item_t *) malloc(sizeof(struct tile_store_item_t));
+	if (item == NULL)
+		return;
+	tile_buffer__retain(buffer);
+	item->buffer = buffer;
+	item->key = *key;
+	item->size = size;
+	item->next = NULL;
+
+	mtx_lock(&store->mutex);
+	if (store->finishing || store->queue_bytes + size > TILE_STORE_MAX_QUEUE_BYTES)
+	{
+		++store->dropped;
+		mtx_unlock(&store->mutex);
+		tile_buffer__release(item->buffer);
+		free((void*)item);
+		return;
+	}
+	if (store->queue_tail != NULL)
+		store->queue_tail->next = item;
+	else
+		store->queue_head = item;
+	store->queue_tail = item;
+	store->queue_bytes += size;
+	cnd_signal(&store->queue_condition);
+	mtx_unlock(&store->mutex);
+}
+
+void tile_store__flush(struct tile_store_t * store)
+{
+	mtx_lock(&store->mutex);
+	while (store->queue_head != NULL || store->writing)
+		cnd_wait(&store->queue_condition, &store->mutex);
+	mtx_unlock(&store->mutex);
+
+	for (int i = 0; i < TILE_STORE_SEGMENT_COUNT; ++i)
+		fsync(store->segments[i].fd);
+}
+
+void tile_store__get_stats(struct tile_store_t * store, struct tile_store_stats_t * stats)
+{
+	mtx_lock(&store->mutex);
+	stats->hits = store->hits;
+	stats->misses = store->misses;
+	stats->writes = store->writes;
+	stats->dropped = store->dropped;
+	stats->evictions = store->evictions;
+	stats->entries = store->entries;
+	stats->bytes = store->bytes;
+	stats->max_bytes = (unsigned long long)store->segment_capacity * TILE_STORE_SEGMENT_COUNT;
+	mtx_unlock(&store->mutex);
+}
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __TILE_STORE_H__
+#define __TILE_STORE_H__
+
+#include "tile_key.h"
+#include "tile_buffer.h"
+
+#include <stddef.h>
+
+/**
+ * Persistent store of encoded tiles.
+ *
+ * Tiles are appended to a fixed number of pack files (segments) in the store directory.
+ * Segments are memory mapped for reading and the index is rebuilt from their records on open.
+ * When the active segment is full, the oldest one is emptied and reused, so the store
+ * never grows above its size cap. New tiles are written by a background thread.
+ */
+struct tile_store_t;
+
+struct tile_store_stats_t {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long writes;
+	unsigned long long dropped;   // tiles not written because write queue was full
+	unsigned long long evictions; // tiles dropped with recycled segments
+	unsigned long long entries;
+	unsigned long long bytes;
+	unsigned long long max_bytes;
+};
+
+/**
+ * Opens the store, creating its directory and pack files when they don't exist.
+ *
+ * @param[in] path       Store directory.
+ * @param[in] max_bytes  Size cap of all pack files together.
+ * @return The store on success and NULL otherwise.
+ */
+struct tile_store_t * tile_store__open(const char * path, size_t max_bytes);
+
+/**
+ * Writes all queued tiles and closes the store.
+ */
+void tile_store__close(struct tile_store_t * store);
+
+/**
+ * Looks up the tile and copies its data into a buffer.
+ *
+ * @param[in] store    The store.
+ * @param[in] key      Tile key.
+ * @param[in] pool     Pool the buffer is taken from.
+ * @param[out] buffer  Buffer with the data, must be released by the caller.
+ * @return True on hit and false otherwise.
+ */
+bool tile_store__get(struct tile_store_t * store, const struct tile_key_t * key,
+	struct tile_buffer_pool_t * pool, struct tile_buffer_t ** buffer);
+
+/**
+ * Checks whether the tile is in the store or in its write queue.
+ */
+bool tile_store__contains(struct tile_store_t * store, const struct tile_key_t * key);
+
+/**
+ * Queues the tile for writing, taking a reference to the buffer.
+ */
+void tile_store__put(struct tile_store_t * store, const struct tile_key_t * key, struct tile_buffer_t * buffer);
+
+/**
+ * Waits until the write queue is empty and flushes pack files to disk.
+ */
+void tile_store__flush(struct tile_store_t * store);
+
+void tile_store__get_stats(struct tile_store_t * store, struct tile_store_stats_t * stats);
+
+#endif
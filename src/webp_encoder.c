@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "webp_encoder.h"
+
+#if defined(HAVE_WEBP)
+
+#include <webp/encode.h>
+
+/*
+Tiles are encoded at method 4 (libwebp default): lower methods lose much of
+the size advantage over JPEG, higher ones cost a lot of time for little gain.
+*/
+static const int kMethod = 4;
+
+bool webp_encoder__is_available(void)
+{
+	return true;
+}
+
+bool webp_encoder__encode(const unsigned char * pixels, int width, int height, int bytes_per_pixel,
+	int quality, unsigned char ** data, size_t * size)
+{
+	WebPConfig config;
+	WebPPicture picture;
+	WebPMemoryWriter writer;
+	int stride = width * bytes_per_pixel;
+	int imported;
+
+	if (bytes_per_pixel != 3 && bytes_per_pixel != 4)
+		return false;
+	if (!WebPConfigInit(&config) || !WebPPictureInit(&picture))
+		return false;
+	if (quality == 0)
+	{
+		// Lossless encoding, quality sets the effort then
+		config.lossless = 1;
+		config.quality = 50.0f;
+	}
+	else
+		config.quality = (float)quality;
+	config.method = kMethod;
+	if (!WebPValidateConfig(&config))
+		return false;
+
+	// Lossless encoder works on ARGB, lossy one is faster when given YUV
+	picture.use_argb = config.lossless;
+	picture.width = width;
+	picture.height = height;
+	if (bytes_per_pixel == 3)
+		imported = WebPPictureImportRGB(&picture, pixels, stride);
+	else
+		imported = WebPPictureImportRGBA(&picture, pixels, stride);
+	if (!imported)
+	{
+		WebPPictureFree(&picture);
+		return false;
+	}
+
+	WebPMemoryWriterInit(&writer);
+	picture.writer = WebPMemoryWrite;
+	picture.custom_ptr = &writer;
+	if (!WebPEncode(&config, &picture))
+	{
+		WebPPictureFree(&picture);
+		WebPMemoryWriterClear(&writer);
+		return false;
+	}
+	WebPPictureFree(&picture);
+
+	// Writer memory is handed over as is, caller frees it with webp_encoder__free
+	*data = writer.mem;
+	*size = writer.size;
+	return true;
+}
+
+void webp_encoder__free(unsigned char * data)
+{
+	WebPFree((void*)data);
+}
+
+#else // HAVE_WEBP
+
+bool webp_encoder__is_available(void)
+{
+	return false;
+}
+
+bool webp_encoder__encode(const unsigned char * pixels, int width, int height, int bytes_per_pixel,
+	int quality, unsigned char ** data, size_t * size)
+{
+	(void) pixels;
+	(void) width;
+	(void) height;
+	(void) bytes_per_pixel;
+	(void) quality;
+	(void) data;
+	(void) size;
+	return false;
+}
+
+void webp_encoder__free(unsigned char * data)
+{
+	(void) data;
+}
+
+#endif // HAVE_WEBP
@@ -0,0 +1,37 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __WEBP_ENCODER_H__
+#define __WEBP_ENCODER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Returns true when the server is built with libwebp (HAVE_WEBP defined).
+ */
+bool webp_encoder__is_available(void);
+
+/**
+ * Encodes top-down RGB or RGBA pixels.
+ *
+ * @param[in] pixels           Source pixels.
+ * @param[in] width            Image width.
+ * @param[in] height           Image height.
+ * @param[in] bytes_per_pixel  3 or 4.
+ * @param[in] quality          Lossy quality in range 1..100 or 0 for lossless encoding.
+ * @param[out] data            Encoded image, to be freed with webp_encoder__free.
+ * @param[out] size            Encoded image size.
+ * @return True on success and false otherwise.
+ */
+bool webp_encoder__encode(const unsigned char * pixels, int width, int height, int bytes_per_pixel,
+	int quality, unsigned char ** data, size_t * size);
+
+/**
+ * Frees encoded image, it belongs to libwebp allocator. NULL is ignored.
+ */
+void webp_encoder__free(unsigned char * data);
+
+#endif
@@ -0,0 +1,36 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdio.h>
+
+/*
+Minimal checks for unit tests. Every test is a program of its own,
+failed checks are reported and the program exits with nonzero status.
+*/
+
+static int test_failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) \
+		{ \
+			printf("%s:%i: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			++test_failures; \
+		} \
+	} while (0)
+
+#define RUN_TEST(function) \
+	do { \
+		int failures_before = test_failures; \
+		function(); \
+		printf("%s %s\n", (test_failures == failures_before) ? "ok  " : "FAIL", #function); \
+	} while (0)
+
+#define TEST_RESULT() ((test_failures == 0) ? 0 : 1)
+
+#endif
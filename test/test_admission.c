@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "test.h"
+#include "admission.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+# include <winsock2.h>
+# include <ws2tcpip.h>
+#else
+# include <sys/socket.h>
+# include <netinet/in.h>
+#endif
+
+static struct admission_client_t make_client(unsigned char last)
+{
+	struct admission_client_t client;
+
+	memset(&client, 0, sizeof(client));
+	client.address[0] = 10;
+	client.address[3] = last;
+	client.length = 4;
+	return client;
+}
+
+static void test_total_limit(void)
+{
+	struct admission_t * admission = admission__create(3, 0);
+	struct admission_client_t client = make_client(1);
+	struct admission_stats_t stats;
+
+	for (int i = 0; i < 3; ++i)
+		CHECK(admission__enter(admission, &client) == ADMISSION_ADMITTED);
+	CHECK(admission__enter(admission, &client) == ADMISSION_QUEUE_FULL);
+	admission__leave(admission, &client);
+	CHECK(admission__enter(admission, &client) == ADMISSION_ADMITTED);
+
+	admission__get_stats(admission, &stats);
+	CHECK(stats.pending == 3);
+	CHECK(stats.admitted == 4);
+	CHECK(stats.queue_full == 1);
+	CHECK(stats.client_busy == 0);
+	admission__destroy(admission);
+}
+
+static void test_per_client_limit(void)
+{
+	struct admission_t * admission = admission__create(10, 2);
+	struct admission_client_t first = make_client(1);
+	struct admission_client_t second = make_client(2);
+	struct admission_stats_t stats;
+
+	CHECK(admission__enter(admission, &first) == ADMISSION_ADMITTED);
+	CHECK(admission__enter(admission, &first) == ADMISSION_ADMITTED);
+	CHECK(admission__enter(admission, &first) == ADMISSION_CLIENT_BUSY);
+	// Other clients aren't affected
+	CHECK(admission__enter(admission, &second) == ADMISSION_ADMITTED);
+	admission__leave(admission, &first);
+	CHECK(admission__enter(admission, &first) == ADMISSION_ADMITTED);
+
+	admission__get_stats(admission, &stats);
+	CHECK(stats.pending == 3);
+	CHECK(stats.client_busy == 1);
+	CHECK(stats.queue_full == 0);
+
+	// Client is forgotten when it has nothing pending, then starts over
+	admission__leave(admission, &first);
+	admission__leave(admission, &first);
+	CHECK(admission__enter(admission, &first) == ADMISSION_ADMITTED);
+	CHECK(admission__enter(admission, &first) == ADMISSION_ADMITTED);
+	CHECK(admission__enter(admission, &first) == ADMISSION_CLIENT_BUSY);
+	admission__destroy(admission);
+}
+
+static void test_total_limit_goes_first(void)
+{
+	struct admission_t * admission = admission__create(2, 2);
+	struct admission_client_t first = make_client(1);
+	struct admission_client_t second = make_client(2);
+
+	CHECK(admission__enter(admission, &first) == ADMISSION_ADMITTED);
+	CHECK(admission__enter(admission, &second) == ADMISSION_ADMITTED);
+	CHECK(admission__enter(admission, &first) == ADMISSION_QUEUE_FULL);
+	admission__destroy(admission);
+}
+
+static void test_unknown_client(void)
+{
+	struct admission_t * admission = admission__create(0, 1);
+	struct admission_client_t unknown;
+
+	// Clients of unknown address aren't limited one by one, and zero total means no limit
+	admission__get_client(NULL, &unknown);
+	CHECK(unknown.length == 0);
+	for (int i = 0; i < 100; ++i)
+		CHECK(admission__enter(admission, &unknown) == ADMISSION_ADMITTED);
+	for (int i = 0; i < 100; ++i)
+		admission__leave(admission, &unknown);
+	admission__destroy(admission);
+}
+
+static void test_get_client(void)
+{
+	struct sockaddr_in ipv4;
+	struct sockaddr_in6 ipv6;
+	struct admission_client_t client;
+
+	memset(&ipv4, 0, sizeof(ipv4));
+	ipv4.sin_family = AF_INET;
+	ipv4.sin_port = htons(8080);
+	ipv4.sin_addr.s_addr = htonl(0x7F000001);
+	admission__get_client((const struct sockaddr *)&ipv4, &client);
+	CHECK(client.length == 4);
+	CHECK(memcmp(client.address, "\x7F\x00\x00\x01", 4) == 0);
+
+	// Port isn't part of the client, reconnects are the same one
+	{
+		struct admission_client_t other;
+		ipv4.sin_port = htons(9090);
+		admission__get_client((const struct sockaddr *)&ipv4, &other);
+		CHECK(other.length == client.length && memcmp(other.address, client.address, 16) == 0);
+	}
+
+	memset(&ipv6, 0, sizeof(ipv6));
+	ipv6.sin6_family = AF_INET6;
+	ipv6.sin6_addr.s6_addr[15] = 1;
+	admission__get_client((const struct sockaddr *)&ipv6, &client);
+	CHECK(client.length == 16);
+	CHECK(client.address[15] == 1 && client.address[0] == 0);
+}
+
+int main(void)
+{
+	RUN_TEST(test_total_limit);
+	RUN_TEST(test_per_client_limit);
+	RUN_TEST(test_total_limit_goes_first);
+	RUN_TEST(test_unknown_client);
+	RUN_TEST(test_get_client);
+	return TEST_RESULT();
+}
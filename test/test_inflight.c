@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "test.h"
+#include "inflight.h"
+
+#include <string.h>
+
+struct test_waiter_t {
+	struct inflight_waiter_t waiter; // first, waiters are cast back
+	int notified;
+	struct tile_buffer_t * buffer;
+};
+
+static void notify(struct inflight_waiter_t * waiter, struct tile_buffer_t * buffer)
+{
+	struct test_waiter_t * test_waiter = (struct test_waiter_t *) waiter;
+
+	++test_waiter->notified;
+	test_waiter->buffer = buffer;
+}
+
+static void init_waiter(struct test_waiter_t * waiter)
+{
+	memset(waiter, 0, sizeof(struct test_waiter_t));
+	waiter->waiter.notify = notify;
+}
+
+static struct tile_key_t make_key(int x)
+{
+	struct tile_key_t key;
+
+	memset(&key, 0, sizeof(key));
+	key.lod = 3;
+	key.x = x;
+	key.size = 256;
+	return key;
+}
+
+static void test_followers_get_leader_result(void)
+{
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(0);
+	struct inflight_table_t * table = inflight_table__create();
+	struct tile_key_t key = make_key(1);
+	struct inflight_entry_t * leader = NULL;
+	struct inflight_entry_t * entry = NULL;
+	struct test_waiter_t waiters[3];
+	struct tile_buffer_t * buffer;
+
+	for (int i = 0; i < 3; ++i)
+		init_waiter(&waiters[i]);
+
+	CHECK(inflight_table__begin(table, &key, &leader, &waiters[0].waiter));
+	CHECK(leader != NULL);
+	CHECK(waiters[0].notified == 0); // leader doesn't wait for itself
+	CHECK(!inflight_table__begin(table, &key, &entry, &waiters[1].waiter));
+	CHECK(entry == NULL);
+	CHECK(!inflight_table__begin(table, &key, &entry, &waiters[2].waiter));
+	CHECK(inflight_table__get_coalesced(table) == 2);
+	CHECK(waiters[1].notified == 0 && waiters[2].notified == 0);
+
+	buffer = tile_buffer__create(pool, 10);
+	inflight_table__finish(table, leader, buffer);
+	CHECK(waiters[0].notified == 0);
+	for (int i = 1; i < 3; ++i)
+	{
+		CHECK(waiters[i].notified == 1);
+		CHECK(waiters[i].buffer == buffer);
+	}
+	// Every follower got its own reference
+	CHECK(buffer->references == 3);
+	tile_buffer__release(waiters[1].buffer);
+	tile_buffer__release(waiters[2].buffer);
+	tile_buffer__release(buffer);
+
+	// The key is free again
+	CHECK(inflight_table__begin(table, &key, &leader, &waiters[0].waiter));
+	inflight_table__finish(table, leader, NULL);
+
+	inflight_table__destroy(table);
+	tile_buffer_pool__destroy(pool);
+}
+
+static void test_failed_leader(void)
+{
+	struct inflight_table_t * table = inflight_table__create();
+	struct tile_key_t key = make_key(1);
+	struct inflight_entry_t * leader = NULL;
+	struct inflight_entry_t * entry = NULL;
+	struct test_waiter_t waiter;
+
+	init_waiter(&waiter);
+	waiter.buffer = (struct tile_buffer_t *) &waiter; // not NULL before notify
+	CHECK(inflight_table__begin(table, &key, &leader, &waiter.waiter));
+	CHECK(!inflight_table__begin(table, &key, &entry, &waiter.waiter));
+	inflight_table__finish(table, leader, NULL);
+	CHECK(waiter.notified == 1);
+	CHECK(waiter.buffer == NULL);
+	inflight_table__destroy(table);
+}
+
+static void test_distinct_keys(void)
+{
+	struct inflight_table_t * table = inflight_table__create();
+	struct tile_key_t first = make_key(1);
+	struct tile_key_t second = make_key(2);
+	struct inflight_entry_t * entries[2];
+	struct test_waiter_t waiter;
+
+	init_waiter(&waiter);
+	CHECK(inflight_table__begin(table, &first, &entries[0], &waiter.waiter));
+	CHECK(inflight_table__begin(table, &second, &entries[1], &waiter.waiter));
+	CHECK(inflight_table__get_coalesced(table) == 0);
+	inflight_table__finish(table, entries[0], NULL);
+	inflight_table__finish(table, entries[1], NULL);
+	CHECK(waiter.notified == 0);
+	inflight_table__destroy(table);
+}
+
+static void test_try_begin_and_abandon(void)
+{
+	struct inflight_table_t * table = inflight_table__create();
+	struct tile_key_t key = make_key(1);
+	struct inflight_entry_t * leader = NULL;
+	struct inflight_entry_t * entry = NULL;
+	struct test_waiter_t waiter;
+
+	init_waiter(&waiter);
+
+	// Prefetch takes the key only when nobody renders it
+	CHECK(inflight_table__try_begin(table, &key, &leader));
+	CHECK(leader != NULL);
+	CHECK(!inflight_table__try_begin(table, &key, &entry));
+	CHECK(entry == NULL);
+	CHECK(inflight_table__get_coalesced(table) == 0);
+
+	// Without waiters it may give up
+	CHECK(inflight_table__try_abandon(table, leader));
+	CHECK(inflight_table__try_begin(table, &key, &leader));
+
+	// With waiters it has to finish
+	CHECK(!inflight_table__begin(table, &key, &entry, &waiter.waiter));
+	CHECK(!inflight_table__try_abandon(table, leader));
+	inflight_table__finish(table, leader, NULL);
+	CHECK(waiter.notified == 1);
+	inflight_table__destroy(table);
+}
+
+int main(void)
+{
+	RUN_TEST(test_followers_get_leader_result);
+	RUN_TEST(test_failed_leader);
+	RUN_TEST(test_distinct_keys);
+	RUN_TEST(test_try_begin_and_abandon);
+	return TEST_RESULT();
+}
@@ -0,0 +1,107 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "test.h"
+#include "lru_table.h"
+
+struct item_t {
+	struct lru_node_t node; // first, items are cast from nodes
+	int key;
+};
+
+static bool match_item(const struct lru_node_t * node, const void * key)
+{
+	return ((const struct item_t *) node)->key == *(const int *) key;
+}
+
+/* Few buckets and colliding hashes, so chains get long */
+static void insert_item(struct lru_table_t * table, struct item_t * item, int key)
+{
+	item->key = key;
+	item->node.hash = (unsigned int)(key % 3);
+	lru_table__insert(table, &item->node);
+}
+
+static struct item_t * find_item(struct lru_table_t * table, int key)
+{
+	return (struct item_t *) lru_table__find(table, (unsigned int)(key % 3), match_item, &key);
+}
+
+static void test_insert_and_find(void)
+{
+	struct lru_table_t table;
+	struct item_t items[10];
+
+	CHECK(lru_table__init(&table, 4));
+	CHECK(lru_table__oldest(&table) == NULL);
+	for (int i = 0; i < 10; ++i)
+		insert_item(&table, &items[i], i);
+	for (int i = 0; i < 10; ++i)
+		CHECK(find_item(&table, i) == &items[i]);
+	CHECK(find_item(&table, 10) == NULL);
+	CHECK(find_item(&table, -3) == NULL);
+
+	// Find doesn't change the order
+	CHECK(lru_table__oldest(&table) == &items[0].node);
+	lru_table__free(&table);
+}
+
+static void test_lru_order(void)
+{
+	struct lru_table_t table;
+	struct item_t items[4];
+
+	CHECK(lru_table__init(&table, 4));
+	for (int i = 0; i < 4; ++i)
+		insert_item(&table, &items[i], i);
+
+	// Touched go to the front, so eviction order is 1, 3, 0, 2
+	lru_table__touch(&table, &items[0].node);
+	lru_table__touch(&table, &items[2].node);
+	CHECK(lru_table__oldest(&table) == &items[1].node);
+	lru_table__remove(&table, &items[1].node);
+	CHECK(lru_table__oldest(&table) == &items[3].node);
+	lru_table__remove(&table, &items[3].node);
+	CHECK(lru_table__oldest(&table) == &items[0].node);
+	lru_table__remove(&table, &items[0].node);
+	CHECK(lru_table__oldest(&table) == &items[2].node);
+	lru_table__remove(&table, &items[2].node);
+	CHECK(lru_table__oldest(&table) == NULL);
+	CHECK(table.lru_head == NULL);
+	lru_table__free(&table);
+}
+
+static void test_remove_from_chain(void)
+{
+	struct lru_table_t table;
+	struct item_t items[9];
+
+	CHECK(lru_table__init(&table, 1));
+	for (int i = 0; i < 9; ++i)
+		insert_item(&table, &items[i], i);
+
+	// Head, middle and tail of the single chain
+	lru_table__remove(&table, &items[8].node);
+	lru_table__remove(&table, &items[4].node);
+	lru_table__remove(&table, &items[0].node);
+	for (int i = 0; i < 9; ++i)
+		CHECK(find_item(&table, i) == ((i % 4 == 0) ? NULL : &items[i]));
+	CHECK(lru_table__oldest(&table) == &items[1].node);
+	CHECK(table.lru_head == &items[7].node);
+
+	// Removed node can be inserted again
+	insert_item(&table, &items[4], 4);
+	CHECK(find_item(&table, 4) == &items[4]);
+	CHECK(table.lru_head == &items[4].node);
+	lru_table__free(&table);
+}
+
+int main(void)
+{
+	RUN_TEST(test_insert_and_find);
+	RUN_TEST(test_lru_order);
+	RUN_TEST(test_remove_from_chain);
+	return TEST_RESULT();
+}
@@ -0,0 +1,191 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "test.h"
+#include "pixel_encoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned int get_uint16(const unsigned char * data)
+{
+	return (unsigned int)data[0] | ((unsigned int)data[1] << 8);
+}
+
+static unsigned long get_uint32(const unsigned char * data)
+{
+	return (unsigned long)data[0] | ((unsigned long)data[1] << 8)
+		| ((unsigned long)data[2] << 16) | ((unsigned long)data[3] << 24);
+}
+
+static void unpack_565(unsigned int packed, int color[3])
+{
+	int r = (int)((packed >> 11) & 0x1F);
+	int g = (int)((packed >> 5) & 0x3F);
+	int b = (int)(packed & 0x1F);
+
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+/* Decodes the pixel of BC1 block like GPU does */
+static void decode_dxt1_pixel(const unsigned char * block, int index, int color[3])
+{
+	unsigned int packed0 = get_uint16(block);
+	unsigned int packed1 = get_uint16(block + 2);
+	int selector = (int)((get_uint32(block + 4) >> (2 * index)) & 3);
+	int c0[3], c1[3];
+
+	unpack_565(packed0, c0);
+	unpack_565(packed1, c1);
+	for (int i = 0; i < 3; ++i)
+	{
+		if (selector == 0)
+			color[i] = c0[i];
+		else if (selector == 1)
+			color[i] = c1[i];
+		else if (packed0 > packed1)
+			color[i] = (selector == 2) ? (2 * c0[i] + c1[i]) / 3 : (c0[i] + 2 * c1[i]) / 3;
+		else
+			color[i] = (selector == 2) ? (c0[i] + c1[i]) / 2 : 0;
+	}
+}
+
+static unsigned char * make_pixels(int width, int height, int bytes_per_pixel)
+{
+	unsigned char * pixels = (unsigned char *) malloc((size_t)(width * height * bytes_per_pixel));
+
+	for (int i = 0; i < width * height * bytes_per_pixel; ++i)
+		pixels[i] = (unsigned char)(i * 7 + i / 5);
+	return pixels;
+}
+
+static void test_raw_header_and_pixels(void)
+{
+	const int width = 5, height = 3;
+	unsigned char * pixels = make_pixels(width, height, 4);
+	size_t size = pixel_encoder__raw_size(width, height, 4);
+	unsigned char * data = (unsigned char *) malloc(size);
+
+	CHECK(size == PIXEL_HEADER_SIZE + (size_t)(width * height * 4));
+	pixel_encoder__encode_raw(pixels, width, height, 4, data);
+	CHECK(memcmp(data, "ETPX", 4) == 0);
+	CHECK(get_uint16(data + 4) == (unsigned int)width);
+	CHECK(get_uint16(data + 6) == (unsigned int)height);
+	CHECK(data[8] == PIXEL_LAYOUT_RGBA);
+	CHECK(data[9] == 4);
+	CHECK(get_uint16(data + 10) == 0);
+	CHECK(get_uint32(data + 12) == (unsigned long)(width * height * 4));
+	CHECK(memcmp(data + PIXEL_HEADER_SIZE, pixels, (size_t)(width * height * 4)) == 0);
+	free((void*)data);
+	free((void*)pixels);
+
+	pixels = make_pixels(width, height, 3);
+	data = (unsigned char *) malloc(pixel_encoder__raw_size(width, height, 3));
+	pixel_encoder__encode_raw(pixels, width, height, 3, data);
+	CHECK(data[8] == PIXEL_LAYOUT_RGB);
+	CHECK(data[9] == 3);
+	free((void*)data);
+	free((void*)pixels);
+}
+
+static void test_unsupported_sizes(void)
+{
+	CHECK(pixel_encoder__raw_size(0, 4, 3) == 0);
+	CHECK(pixel_encoder__raw_size(4, 0x10000, 3) == 0);
+	CHECK(pixel_encoder__raw_size(4, 4, 1) == 0);
+	CHECK(pixel_encoder__dxt1_size(4, 4, 2) == 0);
+	CHECK(pixel_encoder__dxt1_size(-1, 4, 4) == 0);
+}
+
+static void test_dxt1_header_and_size(void)
+{
+	const int width = 9, height = 5; // 3x2 blocks, edges partial
+	unsigned char * pixels = make_pixels(width, height, 3);
+	size_t size = pixel_encoder__dxt1_size(width, height, 3);
+	unsigned char * data = (unsigned char *) malloc(size);
+
+	CHECK(size == PIXEL_HEADER_SIZE + 3 * 2 * 8);
+	pixel_encoder__encode_dxt1(pixels, width, height, 3, data);
+	CHECK(memcmp(data, "ETPX", 4) == 0);
+	CHECK(get_uint16(data + 4) == (unsigned int)width);
+	CHECK(get_uint16(data + 6) == (unsigned int)height);
+	CHECK(data[8] == PIXEL_LAYOUT_DXT1);
+	CHECK(data[9] == 0);
+	CHECK(get_uint32(data + 12) == 3 * 2 * 8);
+	free((void*)data);
+	free((void*)pixels);
+}
+
+static void test_dxt1_solid_block(void)
+{
+	// Color representable in 565 decodes exactly
+	const unsigned char color[3] = {0x84, 0x41, 0xC6};
+	unsigned char pixels[4 * 4 * 4];
+	unsigned char data[PIXEL_HEADER_SIZE + 8];
+	int decoded[3];
+
+	for (int i = 0; i < 16; ++i)
+	{
+		memcpy(pixels + 4 * i, color, 3);
+		pixels[4 * i + 3] = 0x10; // alpha is ignored
+	}
+	pixel_encoder__encode_dxt1(pixels, 4, 4, 4, data);
+	for (int i = 0; i < 16; ++i)
+	{
+		decode_dxt1_pixel(data + PIXEL_HEADER_SIZE, i, decoded);
+		CHECK(decoded[0] == color[0] && decoded[1] == color[1] && decoded[2] == color[2]);
+	}
+}
+
+static void test_dxt1_two_colors(void)
+{
+	// Left half black and right half white. Endpoints are inset by 1/16 of the range,
+	// so colors come back within that plus 565 rounding
+	unsigned char pixels[4 * 4 * 3];
+	unsigned char data[PIXEL_HEADER_SIZE + 8];
+	int decoded[3];
+
+	for (int y = 0; y < 4; ++y)
+		for (int x = 0; x < 4; ++x)
+			memset(pixels + 3 * (4 * y + x), (x < 2) ? 0x00 : 0xFF, 3);
+	pixel_encoder__encode_dxt1(pixels, 4, 4, 3, data);
+	CHECK(get_uint16(data + PIXEL_HEADER_SIZE) > get_uint16(data + PIXEL_HEADER_SIZE + 2)); // four color mode
+	for (int i = 0; i < 16; ++i)
+	{
+		int expected = (i % 4 < 2) ? 0x00 : 0xFF;
+		decode_dxt1_pixel(data + PIXEL_HEADER_SIZE, i, decoded);
+		for (int c = 0; c < 3; ++c)
+			CHECK(abs(decoded[c] - expected) <= 0xFF / 16 + 8);
+	}
+}
+
+static void test_dxt1_edge_repeat(void)
+{
+	// Pixels beyond 1x1 image repeat the only one, so the block is solid
+	const unsigned char color[3] = {0xFF, 0x00, 0x00};
+	unsigned char data[PIXEL_HEADER_SIZE + 8];
+	int decoded[3];
+
+	CHECK(pixel_encoder__dxt1_size(1, 1, 3) == sizeof(data));
+	pixel_encoder__encode_dxt1(color, 1, 1, 3, data);
+	for (int i = 0; i < 16; ++i)
+	{
+		decode_dxt1_pixel(data + PIXEL_HEADER_SIZE, i, decoded);
+		CHECK(decoded[0] == 0xFF && decoded[1] == 0x00 && decoded[2] == 0x00);
+	}
+}
+
+int main(void)
+{
+	RUN_TEST(test_raw_header_and_pixels);
+	RUN_TEST(test_unsupported_sizes);
+	RUN_TEST(test_dxt1_header_and_size);
+	RUN_TEST(test_dxt1_solid_block);
+	RUN_TEST(test_dxt1_two_colors);
+	RUN_TEST(test_dxt1_edge_repeat);
+	return TEST_RESULT();
+}
@@ -0,0 +1,227 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "test.h"
+#include "png_encoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+static const unsigned char kSignature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+static unsigned long get_uint32(const unsigned char * data)
+{
+	return ((unsigned long)data[0] << 24) | ((unsigned long)data[1] << 16)
+		| ((unsigned long)data[2] << 8) | (unsigned long)data[3];
+}
+
+/* Smooth gradient with noise, so that every filter type gets picked somewhere */
+static unsigned char * make_pixels(int width, int height, int bytes_per_pixel)
+{
+	unsigned char * pixels = (unsigned char *) malloc((size_t)(width * height * bytes_per_pixel));
+	unsigned int seed = 12345;
+
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+			for (int c = 0; c < bytes_per_pixel; ++c)
+			{
+				seed = seed * 1103515245u + 12345u;
+				pixels[(y * width + x) * bytes_per_pixel + c] = (y < height / 2)
+					? (unsigned char)(x * 3 + y * 5 + c * 40)
+					: (unsigned char)(seed >> 16);
+			}
+	return pixels;
+}
+
+static unsigned char paeth(unsigned char a, unsigned char b, unsigned char c)
+{
+	int p = (int)a + (int)b - (int)c;
+	int pa = abs(p - (int)a);
+	int pb = abs(p - (int)b);
+	int pc = abs(p - (int)c);
+
+	if (pa <= pb && pa <= pc)
+		return a;
+	return (pb <= pc) ? b : c;
+}
+
+/* Reverses filters of rows preceded by filter type into pixels, false on unknown type */
+static bool unfilter(unsigned char * data, size_t length, int height, size_t bpp, unsigned char * pixels)
+{
+	const unsigned char * previous = NULL;
+
+	for (int y = 0; y < height; ++y)
+	{
+		const unsigned char * in = data + (size_t)y * (length + 1);
+		unsigned char * row = pixels + (size_t)y * length;
+
+		for (size_t i = 0; i < length; ++i)
+		{
+			unsigned char left = (i >= bpp) ? row[i - bpp] : 0;
+			unsigned char up = (previous != NULL) ? previous[i] : 0;
+			unsigned char corner = (i >= bpp && previous != NULL) ? previous[i - bpp] : 0;
+			unsigned char value = in[1 + i];
+
+			switch (in[0])
+			{
+			case 0: row[i] = value; break;
+			case 1: row[i] = (unsigned char)(value + left); break;
+			case 2: row[i] = (unsigned char)(value + up); break;
+			case 3: row[i] = (unsigned char)(value + ((unsigned int)left + up) / 2); break;
+			case 4: row[i] = (unsigned char)(value + paeth(left, up, corner)); break;
+			default: return false;
+			}
+		}
+		previous = row;
+	}
+	return true;
+}
+
+/* Checks chunk structure and CRCs, decodes the image and compares it to the source */
+static void check_png(const unsigned char * data, size_t size, const unsigned char * pixels,
+	int width, int height, int bytes_per_pixel)
+{
+	static const unsigned char kColorTypes[5] = {0, 0, 0, 2, 6};
+	const unsigned char * chunk = data + sizeof(kSignature);
+	const unsigned char * end = data + size;
+	const unsigned char * idat = NULL;
+	size_t idat_size = 0;
+	bool has_end = false;
+
+	CHECK(size > sizeof(kSignature));
+	CHECK(memcmp(data, kSignature, sizeof(kSignature)) == 0);
+
+	// IHDR goes first
+	CHECK(get_uint32(chunk) == 13);
+	CHECK(memcmp(chunk + 4, "IHDR", 4) == 0);
+	CHECK(get_uint32(chunk + 8) == (unsigned long)width);
+	CHECK(get_uint32(chunk + 12) == (unsigned long)height);
+	CHECK(chunk[16] == 8);
+	CHECK(chunk[17] == kColorTypes[bytes_per_pixel]);
+	CHECK(chunk[18] == 0 && chunk[19] == 0 && chunk[20] == 0);
+
+	while (chunk + 12 <= end && !has_end)
+	{
+		size_t length = (size_t)get_uint32(chunk);
+
+		CHECK(chunk + 12 + length <= end);
+		if (chunk + 12 + length > end)
+			return;
+		CHECK(get_uint32(chunk + 8 + length) == crc32(0L, chunk + 4, (uInt)(length + 4)));
+		if (memcmp(chunk + 4, "IDAT", 4) == 0)
+		{
+			CHECK(idat == NULL); // single IDAT
+			idat = chunk + 8;
+			idat_size = length;
+		}
+		else if (memcmp(chunk + 4, "IEND", 4) == 0)
+		{
+			CHECK(length == 0);
+			has_end = true;
+		}
+		chunk += 12 + length;
+	}
+	CHECK(has_end && chunk == end);
+	CHECK(idat != NULL);
+	if (idat == NULL)
+		return;
+
+	{
+		size_t length = (size_t)(width * bytes_per_pixel);
+		uLongf filtered_size = (uLongf)((length + 1) * (size_t)height);
+		unsigned char * filtered = (unsigned char *) malloc((size_t)filtered_size + 1);
+		unsigned char * decoded = (unsigned char *) malloc(length * (size_t)height);
+		uLongf inflated_size = filtered_size + 1;
+
+		CHECK(uncompress(filtered, &inflated_size, idat, (uLong)idat_size) == Z_OK);
+		CHECK(inflated_size == filtered_size);
+		CHECK(unfilter(filtered, length, height, (size_t)bytes_per_pixel, decoded));
+		CHECK(memcmp(decoded, pixels, length * (size_t)height) == 0);
+		free((void*)decoded);
+		free((void*)filtered);
+	}
+}
+
+static void test_round_trip(void)
+{
+	static const int kBytesPerPixel[3] = {1, 3, 4};
+	static const enum png_profile_t kProfiles[3] = {PNG_PROFILE_FAST, PNG_PROFILE_BALANCED, PNG_PROFILE_SMALL};
+	struct png_encoder_t * encoder = png_encoder__create();
+	const unsigned char * data;
+	size_t size;
+
+	CHECK(encoder != NULL);
+	// Encoder is reused between images of different sizes and profiles
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+		{
+			const int width = 37 + 10 * i, height = 29 - 5 * j;
+			unsigned char * pixels = make_pixels(width, height, kBytesPerPixel[i]);
+
+			CHECK(png_encoder__encode(encoder, pixels, width, height, kBytesPerPixel[i], kProfiles[j], &data, &size));
+			check_png(data, size, pixels, width, height, kBytesPerPixel[i]);
+			free((void*)pixels);
+		}
+	png_encoder__destroy(encoder);
+}
+
+static void test_smaller_profile_is_not_larger(void)
+{
+	const int width = 64, height = 64;
+	struct png_encoder_t * encoder = png_encoder__create();
+	unsigned char * pixels = (unsigned char *) malloc((size_t)(width * height * 3));
+	const unsigned char * data;
+	size_t fast_size, small_size;
+
+	// Smooth image, the kind tiles mostly are
+	for (int i = 0; i < width * height; ++i)
+	{
+		pixels[3 * i + 0] = (unsigned char)(i % width * 2);
+		pixels[3 * i + 1] = (unsigned char)(i / width * 3);
+		pixels[3 * i + 2] = (unsigned char)(i % width + i / width);
+	}
+
+	CHECK(png_encoder__encode(encoder, pixels, width, height, 3, PNG_PROFILE_FAST, &data, &fast_size));
+	CHECK(png_encoder__encode(encoder, pixels, width, height, 3, PNG_PROFILE_SMALL, &data, &small_size));
+	CHECK(small_size <= fast_size);
+	free((void*)pixels);
+	png_encoder__destroy(encoder);
+}
+
+static void test_invalid_arguments(void)
+{
+	struct png_encoder_t * encoder = png_encoder__create();
+	unsigned char pixels[4 * 4 * 4] = {0};
+	const unsigned char * data;
+	size_t size;
+
+	CHECK(!png_encoder__encode(encoder, pixels, 4, 4, 2, PNG_PROFILE_FAST, &data, &size));
+	CHECK(!png_encoder__encode(encoder, pixels, 4, 4, 5, PNG_PROFILE_FAST, &data, &size));
+	CHECK(!png_encoder__encode(encoder, pixels, 4, 4, 3, (enum png_profile_t)0, &data, &size));
+	CHECK(!png_encoder__encode(encoder, pixels, 4, 4, 3, (enum png_profile_t)4, &data, &size));
+	png_encoder__destroy(encoder);
+}
+
+static void test_parse_profile(void)
+{
+	enum png_profile_t profile = PNG_PROFILE_BALANCED;
+
+	CHECK(png_encoder__parse_profile("fast", &profile) && profile == PNG_PROFILE_FAST);
+	CHECK(png_encoder__parse_profile("balanced", &profile) && profile == PNG_PROFILE_BALANCED);
+	CHECK(png_encoder__parse_profile("small", &profile) && profile == PNG_PROFILE_SMALL);
+	CHECK(!png_encoder__parse_profile("best", &profile) && profile == PNG_PROFILE_SMALL);
+	CHECK(!png_encoder__parse_profile("", &profile));
+}
+
+int main(void)
+{
+	RUN_TEST(test_round_trip);
+	RUN_TEST(test_smaller_profile_is_not_larger);
+	RUN_TEST(test_invalid_arguments);
+	RUN_TEST(test_parse_profile);
+	return TEST_RESULT();
+}
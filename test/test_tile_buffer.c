@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "test.h"
+#include "tile_buffer.h"
+
+#include <string.h>
+
+#define MEGABYTE ((size_t)1 << 20)
+
+static void test_create_and_copy(void)
+{
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(16 * MEGABYTE);
+	const unsigned char source[5] = {1, 2, 3, 4, 5};
+	struct tile_buffer_t * buffer;
+
+	buffer = tile_buffer__create(pool, 100);
+	CHECK(buffer != NULL);
+	CHECK(buffer->size == 100);
+	CHECK(buffer->references == 1);
+	CHECK(buffer->pool == pool);
+	memset(tile_buffer__data(buffer), 0xAB, 100); // whole size is writable
+	tile_buffer__release(buffer);
+
+	buffer = tile_buffer__copy(pool, source, sizeof(source));
+	CHECK(buffer != NULL);
+	CHECK(buffer->size == sizeof(source));
+	CHECK(memcmp(tile_buffer__data(buffer), source, sizeof(source)) == 0);
+	tile_buffer__release(buffer);
+
+	tile_buffer__release(NULL);
+	tile_buffer_pool__destroy(pool);
+}
+
+static void test_retain_and_release(void)
+{
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(16 * MEGABYTE);
+	struct tile_buffer_t * buffer = tile_buffer__create(pool, 10);
+
+	tile_buffer__retain(buffer);
+	tile_buffer__retain(buffer);
+	CHECK(buffer->references == 3);
+	tile_buffer__release(buffer);
+	tile_buffer__release(buffer);
+	CHECK(buffer->references == 1);
+	tile_buffer__data(buffer)[9] = 1; // still alive
+	tile_buffer__release(buffer);
+	tile_buffer_pool__destroy(pool);
+}
+
+static void test_reuse_from_class(void)
+{
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(16 * MEGABYTE);
+	struct tile_buffer_t * first;
+	struct tile_buffer_t * second;
+
+	// Sizes of the same class share released buffers
+	first = tile_buffer__create(pool, 3000);
+	tile_buffer__release(first);
+	second = tile_buffer__create(pool, 4000);
+	CHECK(second == first);
+	CHECK(second->size == 4000 && second->references == 1);
+	tile_buffer__release(second);
+
+	// Other class gets its own
+	second = tile_buffer__create(pool, 5000);
+	CHECK(second != first);
+	tile_buffer__release(second);
+	tile_buffer_pool__destroy(pool);
+}
+
+static void test_no_idle_buffers(void)
+{
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(0);
+	struct tile_buffer_t * buffer;
+
+	// Pool keeps nothing, buffers are freed on release
+	buffer = tile_buffer__create(pool, 100);
+	CHECK(buffer != NULL);
+	tile_buffer__release(buffer);
+	buffer = tile_buffer__create(pool, 100);
+	CHECK(buffer != NULL);
+	tile_buffer__release(buffer);
+	tile_buffer_pool__destroy(pool);
+}
+
+static void test_footprint(void)
+{
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(16 * MEGABYTE);
+	const size_t header = sizeof(struct tile_buffer_t);
+	struct tile_buffer_t * buffer;
+
+	// Pooled buffers cost their whole class
+	buffer = tile_buffer__create(pool, 1);
+	CHECK(tile_buffer__footprint(buffer) == header + 4096);
+	tile_buffer__release(buffer);
+	buffer = tile_buffer__create(pool, 4097);
+	CHECK(tile_buffer__footprint(buffer) == header + 8192);
+	tile_buffer__release(buffer);
+	buffer = tile_buffer__create(pool, MEGABYTE);
+	CHECK(tile_buffer__footprint(buffer) == header + MEGABYTE);
+	tile_buffer__release(buffer);
+
+	// Larger ones are allocated exactly
+	buffer = tile_buffer__create(pool, MEGABYTE + 1);
+	CHECK(buffer->size_class == -1);
+	CHECK(tile_buffer__footprint(buffer) == header + MEGABYTE + 1);
+	tile_buffer__release(buffer);
+	tile_buffer_pool__destroy(pool);
+}
+
+static void test_free_callback(void)
+{
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(16 * MEGABYTE);
+	struct tile_buffer_t * buffer = tile_buffer__create(pool, 10);
+
+	// Callback gets the data pointer, as responses do
+	tile_buffer__retain(buffer);
+	tile_buffer__free_callback(tile_buffer__data(buffer));
+	CHECK(buffer->references == 1);
+	tile_buffer__free_callback(tile_buffer__data(buffer));
+	tile_buffer_pool__destroy(pool);
+}
+
+int main(void)
+{
+	RUN_TEST(test_create_and_copy);
+	RUN_TEST(test_retain_and_release);
+	RUN_TEST(test_reuse_from_class);
+	RUN_TEST(test_no_idle_buffers);
+	RUN_TEST(test_footprint);
+	RUN_TEST(test_free_callback);
+	return TEST_RESULT();
+}
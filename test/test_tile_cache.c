@@ -0,0 +1,211 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#include "test.h"
+#include "tile_cache.h"
+
+#include <string.h>
+
+#define MEGABYTE ((size_t)1 << 20)
+#define SHARD_COUNT 16 // as in tile_cache.c
+
+static struct tile_key_t make_key(int x)
+{
+	struct tile_key_t key;
+
+	memset(&key, 0, sizeof(key));
+	key.lod = 10;
+	key.x = x;
+	key.y = 7;
+	key.size = 256;
+	return key;
+}
+
+static int get_shard(const struct tile_key_t * key)
+{
+	return (int)((tile_key__hash(key) >> 24) % SHARD_COUNT);
+}
+
+static struct tile_buffer_t * make_buffer(struct tile_buffer_pool_t * pool, size_t size, unsigned char fill)
+{
+	struct tile_buffer_t * buffer = tile_buffer__create(pool, size);
+
+	memset(tile_buffer__data(buffer), fill, size);
+	return buffer;
+}
+
+static void test_get_and_put(void)
+{
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(0);
+	struct tile_cache_t * cache = tile_cache__create(16 * MEGABYTE);
+	struct tile_key_t key = make_key(1);
+	struct tile_key_t other = make_key(2);
+	struct tile_buffer_t * buffer = make_buffer(pool, 100, 0x11);
+	struct tile_buffer_t * found = NULL;
+	struct tile_cache_stats_t stats;
+
+	CHECK(!tile_cache__get(cache, &key, &found));
+	tile_cache__put(cache, &key, buffer);
+	CHECK(buffer->references == 2); // cache holds its own reference
+	CHECK(tile_cache__contains(cache, &key));
+	CHECK(!tile_cache__contains(cache, &other));
+	CHECK(tile_cache__get(cache, &key, &found));
+	CHECK(found == buffer);
+	CHECK(buffer->references == 3);
+	tile_buffer__release(found);
+	CHECK(!tile_cache__get(cache, &other, &found));
+
+	tile_cache__get_stats(cache, &stats);
+	CHECK(stats.hits == 1);
+	CHECK(stats.misses == 2); // contains isn't counted
+	CHECK(stats.entries == 1);
+	CHECK(stats.bytes == tile_buffer__footprint(buffer));
+	CHECK(stats.max_bytes == 16 * MEGABYTE);
+	CHECK(stats.evictions == 0);
+
+	tile_buffer__release(buffer);
+	tile_cache__destroy(cache);
+	tile_buffer_pool__destroy(pool);
+}
+
+static void test_replace(void)
+{
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(0);
+	struct tile_cache_t * cache = tile_cache__create(16 * MEGABYTE);
+	struct tile_key_t key = make_key(1);
+	struct tile_buffer_t * first = make_buffer(pool, 100, 0x11);
+	struct tile_buffer_t * second = make_buffer(pool, 5000, 0x22);
+	struct tile_buffer_t * found = NULL;
+	struct tile_cache_stats_t stats;
+
+	tile_cache__put(cache, &key, first);
+	tile_cache__put(cache, &key, second);
+	CHECK(first->references == 1); // replaced tile is released
+	CHECK(tile_cache__get(cache, &key, &found) && found == second);
+	tile_buffer__release(found);
+
+	tile_cache__get_stats(cache, &stats);
+	CHECK(stats.entries == 1);
+	CHECK(stats.bytes == tile_buffer__footprint(second));
+	CHECK(stats.evictions == 0);
+
+	tile_buffer__release(first);
+	tile_buffer__release(second);
+	tile_cache__destroy(cache);
+	tile_buffer_pool__destroy(pool);
+}
+
+static void test_budget_counts_footprint(void)
+{
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(0);
+	struct tile_cache_t * cache = tile_cache__create(MEGABYTE);
+	struct tile_cache_stats_t stats;
+
+	// Tiny tiles still take a whole 4 KiB class each
+	for (int i = 0; i < 1000; ++i)
+	{
+		struct tile_key_t key = make_key(i);
+		struct tile_buffer_t * buffer = make_buffer(pool, 10, (unsigned char)i);
+
+		tile_cache__put(cache, &key, buffer);
+		tile_buffer__release(buffer);
+	}
+	tile_cache__get_stats(cache, &stats);
+	CHECK(stats.bytes <= stats.max_bytes);
+	CHECK(stats.evictions > 0);
+	CHECK(stats.entries + stats.evictions == 1000);
+	CHECK(stats.bytes == stats.entries * (sizeof(struct tile_buffer_t) + 4096));
+
+	tile_cache__destroy(cache);
+	tile_buffer_pool__destroy(pool);
+}
+
+static void test_evicts_least_recently_used(void)
+{
+	const size_t footprint = sizeof(struct tile_buffer_t) + 4096;
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(0);
+	// Every shard fits two tiles
+	struct tile_cache_t * cache = tile_cache__create(SHARD_COUNT * 2 * footprint);
+	struct tile_key_t keys[3];
+	struct tile_buffer_t * found = NULL;
+	int count = 0;
+
+	// Eviction is per shard, so take keys of the same one
+	for (int x = 0; count < 3; ++x)
+	{
+		struct tile_key_t key = make_key(x);
+		if (get_shard(&key) == 0)
+			keys[count++] = key;
+	}
+	for (int i = 0; i < 3; ++i)
+	{
+		struct tile_buffer_t * buffer = make_buffer(pool, 100, (unsigned char)i);
+
+		tile_cache__put(cache, &keys[i], buffer);
+		tile_buffer__release(buffer);
+		if (i == 1)
+		{
+			// Makes the first one recent, the second one goes
+			CHECK(tile_cache__get(cache, &keys[0], &found));
+			tile_buffer__release(found);
+		}
+	}
+	CHECK(tile_cache__contains(cache, &keys[0]));
+	CHECK(!tile_cache__contains(cache, &keys[1]));
+	CHECK(tile_cache__contains(cache, &keys[2]));
+
+	tile_cache__destroy(cache);
+	tile_buffer_pool__destroy(pool);
+}
+
+static void test_too_large_and_empty(void)
+{
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(0);
+	struct tile_cache_t * cache = tile_cache__create(16 * MEGABYTE);
+	struct tile_key_t key = make_key(1);
+	struct tile_buffer_t * large = make_buffer(pool, 2 * MEGABYTE, 0x33); // more than a shard
+	struct tile_buffer_t * empty = tile_buffer__create(pool, 0);
+
+	tile_cache__put(cache, &key, large);
+	CHECK(!tile_cache__contains(cache, &key));
+	CHECK(large->references == 1);
+	tile_cache__put(cache, &key, empty);
+	CHECK(!tile_cache__contains(cache, &key));
+
+	tile_buffer__release(large);
+	tile_buffer__release(empty);
+	tile_cache__destroy(cache);
+	tile_buffer_pool__destroy(pool);
+}
+
+static void test_buffer_outlives_cache(void)
+{
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(0);
+	struct tile_cache_t * cache = tile_cache__create(16 * MEGABYTE);
+	struct tile_key_t key = make_key(1);
+	struct tile_buffer_t * buffer = make_buffer(pool, 100, 0x44);
+	struct tile_buffer_t * found = NULL;
+
+	tile_cache__put(cache, &key, buffer);
+	tile_buffer__release(buffer);
+	CHECK(tile_cache__get(cache, &key, &found));
+	// Tile being sent stays valid when the cache goes away
+	tile_cache__destroy(cache);
+	CHECK(found->references == 1);
+	CHECK(tile_buffer__data(found)[99] == 0x44);
+	tile_buffer__release(found);
+	tile_buffer_pool__destroy(pool);
+}
+
+int main(void)
+{
+	RUN_TEST(test_get_and_put);
+	RUN_TEST(test_replace);
+	RUN_TEST(test_budget_counts_footprint);
+	RUN_TEST(test_evicts_least_recently_used);
+	RUN_TEST(test_too_large_and_empty);
+	RUN_TEST(test_buffer_outlives_cache);
+	return TEST_RESULT();
+}
@@ -0,0 +1,256 @@
+/**
+ * Copyright (c) 2022 Vladimir Sviridov <v.shtille@gmail.com>.
+ * Distributed under the MIT License (license terms are at http://opensource.org/licenses/MIT).
+ */
+
+#if !defined(_WIN32) && !defined(_XOPEN_SOURCE)
+# define _XOPEN_SOURCE 700 // mkdtemp
+#endif
+
+#include "test.h"
+#include "tile_store.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+
+int main(void)
+{
+	printf("Tile store isn't supported on this platform, skipped\n");
+	return 0;
+}
+
+#else
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MEGABYTE ((size_t)1 << 20)
+#define SEGMENT_COUNT 4 // as in tile_store.c
+
+static char directory[64];
+
+static struct tile_key_t make_key(int x)
+{
+	struct tile_key_t key;
+
+	memset(&key, 0, sizeof(key));
+	key.face = 2;
+	key.lod = 12;
+	key.x = x;
+	key.y = 34;
+	key.format = 1;
+	key.quality = 80;
+	key.size = 256;
+	return key;
+}
+
+static void put_tile(struct tile_store_t * store, struct tile_buffer_pool_t * pool, int x, size_t size, unsigned char fill)
+{
+	struct tile_key_t key = make_key(x);
+	struct tile_buffer_t * buffer = tile_buffer__create(pool, size);
+
+	memset(tile_buffer__data(buffer), fill, size);
+	tile_store__put(store, &key, buffer);
+	tile_buffer__release(buffer); // store holds its own reference until written
+}
+
+/* Tells whether the stored tile has the size and every byte equal to fill */
+static bool has_tile(struct tile_store_t * store, struct tile_buffer_pool_t * pool, int x, size_t size, unsigned char fill)
+{
+	struct tile_key_t key = make_key(x);
+	struct tile_buffer_t * buffer = NULL;
+	bool equal;
+
+	if (!tile_store__get(store, &key, pool, &buffer))
+		return false;
+	equal = buffer->size == size;
+	for (size_t i = 0; i < buffer->size && equal; ++i)
+		equal = tile_buffer__data(buffer)[i] == fill;
+	tile_buffer__release(buffer);
+	return equal;
+}
+
+static void get_pack_name(int index, char * filename, size_t length)
+{
+	snprintf(filename, length, "%s/tiles.%i.pack", directory, index);
+}
+
+static long get_file_size(const char * filename)
+{
+	struct stat info;
+
+	if (stat(filename, &info) != 0)
+		return -1;
+	return (long)info.st_size;
+}
+
+static void remove_store(void)
+{
+	char filename[128];
+
+	for (int i = 0; i < SEGMENT_COUNT; ++i)
+	{
+		get_pack_name(i, filename, sizeof(filename));
+		unlink(filename);
+	}
+}
+
+static void test_put_and_get(void)
+{
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(0);
+	struct tile_store_t * store = tile_store__open(directory, 4 * MEGABYTE);
+	struct tile_key_t missing = make_key(99);
+	struct tile_buffer_t * buffer = NULL;
+	struct tile_store_stats_t stats;
+
+	CHECK(store != NULL);
+	put_tile(store, pool, 1, 1000, 0x11);
+	put_tile(store, pool, 2, 1, 0x22);
+	tile_store__flush(store);
+	CHECK(has_tile(store, pool, 1, 1000, 0x11));
+	CHECK(has_tile(store, pool, 2, 1, 0x22));
+	CHECK(!tile_store__get(store, &missing, pool, &buffer));
+	CHECK(!tile_store__contains(store, &missing));
+	{
+		struct tile_key_t key = make_key(1);
+		CHECK(tile_store__contains(store, &key));
+		key.quality = 81; // every field is part of the key
+		CHECK(!tile_store__contains(store, &key));
+	}
+
+	tile_store__get_stats(store, &stats);
+	CHECK(stats.writes == 2);
+	CHECK(stats.entries == 2);
+	CHECK(stats.hits == 2);
+	CHECK(stats.misses == 1);
+	CHECK(stats.dropped == 0);
+	CHECK(stats.max_bytes == 4 * MEGABYTE);
+	tile_store__close(store);
+	tile_buffer_pool__destroy(pool);
+	remove_store();
+}
+
+static void test_reopen(void)
+{
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(0);
+	struct tile_store_t * store = tile_store__open(directory, 4 * MEGABYTE);
+	struct tile_store_stats_t stats;
+
+	put_tile(store, pool, 1, 1000, 0x11);
+	put_tile(store, pool, 2, 2000, 0x22);
+	put_tile(store, pool, 1, 3000, 0x33); // newer record of the same tile
+	tile_store__close(store); // writes the queue before closing
+
+	store = tile_store__open(directory, 4 * MEGABYTE);
+	CHECK(store != NULL);
+	CHECK(has_tile(store, pool, 1, 3000, 0x33));
+	CHECK(has_tile(store, pool, 2, 2000, 0x22));
+	tile_store__get_stats(store, &stats);
+	CHECK(stats.entries == 2);
+	tile_store__close(store);
+	tile_buffer_pool__destroy(pool);
+	remove_store();
+}
+
+static void test_torn_tail(void)
+{
+	static const unsigned char kGarbage[100] = {0x54, 0x49, 0x4C, 0x45, 0xFF, 0xFF, 0xFF, 0x7F};
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(0);
+	struct tile_store_t * store = tile_store__open(directory, 4 * MEGABYTE);
+	long sizes[SEGMENT_COUNT];
+	char filename[128];
+
+	put_tile(store, pool, 1, 1000, 0x11);
+	put_tile(store, pool, 2, 2000, 0x22);
+	tile_store__close(store);
+
+	// Crash in the middle of a write leaves part of a record, with a huge size here
+	for (int i = 0; i < SEGMENT_COUNT; ++i)
+	{
+		FILE * file;
+
+		get_pack_name(i, filename, sizeof(filename));
+		sizes[i] = get_file_size(filename);
+		file = fopen(filename, "ab");
+		CHECK(file != NULL);
+		if (file == NULL)
+			continue;
+		fwrite(kGarbage, 1, sizeof(kGarbage), file);
+		fclose(file);
+	}
+
+	store = tile_store__open(directory, 4 * MEGABYTE);
+	CHECK(store != NULL);
+	CHECK(has_tile(store, pool, 1, 1000, 0x11));
+	CHECK(has_tile(store, pool, 2, 2000, 0x22));
+	for (int i = 0; i < SEGMENT_COUNT; ++i)
+	{
+		get_pack_name(i, filename, sizeof(filename));
+		CHECK(get_file_size(filename) == sizes[i]);
+	}
+
+	// Appending goes on after the cut
+	put_tile(store, pool, 3, 500, 0x33);
+	tile_store__close(store);
+	store = tile_store__open(directory, 4 * MEGABYTE);
+	CHECK(has_tile(store, pool, 1, 1000, 0x11));
+	CHECK(has_tile(store, pool, 3, 500, 0x33));
+	tile_store__close(store);
+	tile_buffer_pool__destroy(pool);
+	remove_store();
+}
+
+static void test_rotation(void)
+{
+	const size_t tile_size = 100 * 1024;
+	const int tile_count = 60; // about 6 MiB into 4 MiB store
+	struct tile_buffer_pool_t * pool = tile_buffer_pool__create(0);
+	struct tile_store_t * store = tile_store__open(directory, 4 * MEGABYTE);
+	struct tile_store_stats_t stats;
+
+	for (int i = 0; i < tile_count; ++i)
+	{
+		put_tile(store, pool, i, tile_size, (unsigned char)i);
+		tile_store__flush(store); // queue stays short, nothing dropped
+	}
+	tile_store__get_stats(store, &stats);
+	CHECK(stats.writes == (unsigned long long)tile_count);
+	CHECK(stats.bytes <= stats.max_bytes);
+	CHECK(stats.evictions > 0);
+	CHECK(stats.entries + stats.evictions == (unsigned long long)tile_count);
+
+	// Oldest segment is recycled first
+	CHECK(!has_tile(store, pool, 0, tile_size, 0));
+	CHECK(has_tile(store, pool, tile_count - 1, tile_size, (unsigned char)(tile_count - 1)));
+	tile_store__close(store);
+
+	// Recycled segments stay recycled after reopening
+	store = tile_store__open(directory, 4 * MEGABYTE);
+	tile_store__get_stats(store, &stats);
+	CHECK(stats.bytes <= stats.max_bytes);
+	CHECK(!has_tile(store, pool, 0, tile_size, 0));
+	CHECK(has_tile(store, pool, tile_count - 1, tile_size, (unsigned char)(tile_count - 1)));
+	tile_store__close(store);
+	tile_buffer_pool__destroy(pool);
+	remove_store();
+}
+
+int main(void)
+{
+	strcpy(directory, "/tmp/tile_store_test.XXXXXX");
+	if (mkdtemp(directory) == NULL)
+	{
+		printf("Failed to create temporary directory\n");
+		return 1;
+	}
+	RUN_TEST(test_put_and_get);
+	RUN_TEST(test_reopen);
+	RUN_TEST(test_torn_tail);
+	RUN_TEST(test_rotation);
+	rmdir(directory);
+	return TEST_RESULT();
+}
+
+#endif